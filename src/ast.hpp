@@ -1,5 +1,6 @@
 #pragma once
 #include "source.hpp"
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <string>
@@ -30,6 +31,8 @@ struct TopicDecl {
     std::string name;
     std::string path;
     TypeInfo type;
+    bool latched = false; // keeps the last published value readable as `Node.topic.value`
+    int history = 0;      // `history N`: keep the last N samples (0 = none)
 };
 
 // ----------------------------
@@ -59,15 +62,26 @@ struct Expr {
     };
     struct Unary { UnaryOp op{}; ExprPtr rhs; };
     struct Binary { BinaryOp op{}; ExprPtr lhs; ExprPtr rhs; };
+    // Node.topic.value / Node.topic.count / Node.topic.at(i)
+    struct TopicRead {
+        enum class Kind { Value, Count, At };
+        Kind kind = Kind::Value;
+        std::string node;
+        std::string topic;
+        ExprPtr index; // At only
+    };
 
     SourceLoc loc{};
-    std::variant<Literal, Ident, Call, Unary, Binary> v = Literal{};
+    std::variant<Literal, Ident, Call, Unary, Binary, TopicRead> v = Literal{};
 };
 
 // ----------------------------
 // Statements
 // ----------------------------
 
+struct Stmt;
+using StmtPtr = std::shared_ptr<Stmt>;
+
 struct CallStmt {
     SourceLoc loc{};
     std::string callee;
@@ -80,6 +94,29 @@ struct RequestStmt {
     std::string target_node;
     std::string func_name;
     std::vector<std::string> args;
+
+    // request async Node.fn(args) -> result timeout 200ms
+    // The call is queued on the target and the caller carries on. A group of
+    // these is joined by the `on a, b:` block after the last of them, which
+    // runs on the caller's executor once every named reply is in; `on timeout:`
+    // runs instead if a request's timeout passes first.
+    bool is_async = false;
+    std::string result;     // empty: fire and forget
+    int64_t timeout_ns = 0; // 0: wait for ever
+    std::vector<std::string> awaits;
+    std::vector<StmtPtr> on_reply;
+    std::vector<StmtPtr> on_timeout;
+
+    // await request Node.fn(args) -> result timeout 200ms
+    // Suspends the body until the reply is in; `result` names it for the rest
+    // of the block. A body with an await or a wait runs as a coroutine.
+    bool is_await = false;
+};
+
+// wait 50ms: suspends the body, without holding a thread, for a while.
+struct WaitStmt {
+    SourceLoc loc{};
+    int64_t ns = 0;
 };
 
 struct PublishStmt {
@@ -110,9 +147,6 @@ struct LogStmt {
     std::vector<std::string> args;
 };
 
-struct Stmt;
-using StmtPtr = std::shared_ptr<Stmt>;
-
 struct IfElifBranch {
     SourceLoc loc{};
     ExprPtr cond;
@@ -129,9 +163,25 @@ struct IfStmt {
 
 struct Stmt {
     SourceLoc loc{};
-    std::variant<CallStmt, RequestStmt, PublishStmt, ReturnStmt, TransitionStmt, LogStmt, IfStmt> v;
+    std::variant<CallStmt, RequestStmt, PublishStmt, ReturnStmt, TransitionStmt, LogStmt, IfStmt, WaitStmt> v;
 };
 
+// Whether a body awaits or waits, and so runs as a coroutine. `on` blocks are
+// not searched; validation keeps suspension out of them.
+inline bool body_suspends(const std::vector<StmtPtr>& body) {
+    for (const auto& sp : body) {
+        if (!sp) continue;
+        if (std::holds_alternative<WaitStmt>(sp->v)) return true;
+        if (auto rq = std::get_if<RequestStmt>(&sp->v); rq && rq->is_await) return true;
+        if (auto is = std::get_if<IfStmt>(&sp->v)) {
+            if (body_suspends(is->then_body) || body_suspends(is->else_body)) return true;
+            for (const auto& br : is->elifs)
+                if (body_suspends(br.body)) return true;
+        }
+    }
+    return false;
+}
+
 // ----------------------------
 // Declarations
 // ----------------------------
@@ -152,6 +202,9 @@ struct OnRequestDecl {
     FuncSignature sig;
     std::vector<StmtPtr> body;
     std::string delegate_to;
+    // onRequest idempotent ...: a call whose arguments match one already
+    // queued or running shares its reply instead of running the body again.
+    bool idempotent = false;
 };
 
 struct OnListenDecl {
@@ -161,6 +214,20 @@ struct OnListenDecl {
     std::string delegate_to;
     FuncSignature sig;
     std::vector<StmtPtr> body;
+    bool replay = false; // deliver the source topic's buffered history on subscribe
+
+    // Rate policies, applied on the publishing side (0 = off).
+    int64_t every_ns = 0;    // `every 20ms`: at most one sample per period
+    int64_t debounce_ns = 0; // `debounce 5ms`: only samples after a quiet gap
+    int sample_every = 0;    // `sample 1/N`: every Nth sample
+};
+
+// `every 10ms do tick()` or `every 10ms` + indented block: a periodic timer.
+struct EveryDecl {
+    SourceLoc loc{};
+    int64_t period_ns = 0;
+    std::string delegate_to;
+    std::vector<StmtPtr> body;
 };
 
 struct NodeDecl {
@@ -173,6 +240,7 @@ struct NodeDecl {
     std::vector<TopicDecl> topics;
     std::vector<OnRequestDecl> requests;
     std::vector<OnListenDecl> listeners;
+    std::vector<EveryDecl> timers;
     std::vector<FuncDecl> private_funcs;
 };
 
@@ -189,6 +257,7 @@ struct ModeDecl {
     ModeName mode_name;
     std::vector<StmtPtr> body;
     std::vector<OnListenDecl> listeners;
+    std::vector<EveryDecl> timers;
 };
 
 using Decl = std::variant<SystemModeDecl, NodeDecl, ModeDecl, FuncDecl>;
@@ -1,80 +1,546 @@
 #include "codegen_cpp.hpp"
+#include "runtime_cpp.hpp"
+#include <algorithm>
+#include <functional>
 #include <variant>
 #include <string>
 #include <regex>
 #include <sstream>
+#include <unordered_map>
 #include <unordered_set>
-
-const char* RIVET_RUNTIME = R"(
-#include <iostream>
-#include <string>
-#include <vector>
-#include <functional>
-#include <thread>
-#include <chrono>
-#include <sstream>
-#include <algorithm>
 #include <utility>
 
-enum class LogLevel { INFO, WARN, ERROR, DEBUG };
-struct Logger {
-    static void log(const std::string& node, LogLevel level, const std::string& msg) {
-        std::cout << "[" << node << "] ";
-        switch(level) {
-            case LogLevel::INFO:  std::cout << "[INFO] "; break;
-            case LogLevel::WARN:  std::cout << "\033[33m[WARN]\033[0m "; break;
-            case LogLevel::ERROR: std::cout << "\033[31m[ERROR]\033[0m "; break;
-            case LogLevel::DEBUG: std::cout << "\033[36m[DEBUG]\033[0m "; break;
+// --dispatch=static: every onListen edge of a topic gets a fixed slot in that
+// topic's table. Node-level listeners are enabled once in main(); mode-scoped
+// ones toggle their slot's enable bit where they would otherwise subscribe.
+struct ListenEdge {
+    std::string owner; // the listening node
+    const OnListenDecl* decl = nullptr;
+};
+struct DispatchTable {
+    std::string src;
+    std::string topic;
+    TypeInfo type;
+    std::vector<ListenEdge> edges;
+};
+
+// Listeners with an `every` / `debounce` / `sample` clause get a ListenGate
+// member on the listening node, named after the listener's position:
+// __rivet_gate_n<li> for node-level listeners, __rivet_gate_m<mi>_l<li> for
+// the li-th listener of the node's mi-th mode block.
+struct GateInfo {
+    std::string owner;
+    std::string member;
+};
+
+// --transport=shm: a topic gets a shared-memory ring if some other node could
+// consume it -- it has a listener on another node, or is latched / keeps
+// history and so can be read from anywhere. Which rings a process writes or
+// reads is decided at startup from RIVET_NODES.
+struct SharedTopic {
+    std::string owner;
+    const TopicDecl* decl = nullptr;
+    std::vector<std::string> consumers;
+};
+
+// --deploy: which process is being generated. Requests to a node hosted by
+// another process go through a generated stub that sends the arguments to
+// it; every process decodes the ones aimed at its own nodes in
+// __rivet_rpc_dispatch. Nodes and requests are numbered in declaration order.
+// A `transition Node "X"` to a node in another process goes the same way.
+struct RemoteCall {
+    std::string target;
+    const OnRequestDecl* decl = nullptr;
+    int node_index = 0;
+    int fn_index = 0;
+};
+struct RemoteTransition {
+    std::string target;
+    int node_index = 0;
+};
+
+// --record: every topic with a wire codec, numbered in declaration order. The
+// number is the topic's index in the log's topic table and in __rivet_inject.
+struct RecordedTopic {
+    std::string owner;
+    const TopicDecl* decl = nullptr;
+};
+
+// What one generate_cpp call works from: the options, the tables collected
+// from the program up front, and the node whose bodies are being emitted.
+struct GenContext {
+    CppGenOptions opts;
+
+    std::vector<DispatchTable> tables;
+    std::unordered_map<const OnListenDecl*, std::pair<size_t, size_t>> edge_slots; // -> (table, slot)
+    std::unordered_map<const OnListenDecl*, GateInfo> gates;
+    std::vector<SharedTopic> shared;
+    std::unordered_set<const TopicDecl*> shared_decls;
+    std::vector<RemoteCall> remote_calls; // requests this process sends
+    std::vector<RemoteCall> served_calls; // requests other processes may send it
+    std::vector<RemoteTransition> remote_transitions;
+    std::vector<RemoteTransition> served_transitions;
+    std::unordered_set<std::string> remote_nodes;
+    std::vector<RecordedTopic> recorded;
+    std::unordered_map<const TopicDecl*, size_t> recorded_ids;
+    std::vector<std::string> sys_modes;
+    std::unordered_map<std::string, std::vector<std::string>> local_modes; // node -> names
+    std::unordered_map<std::string, const OnRequestDecl*> request_decls; // "Node.fn" ->
+    int future_count = 0;
+
+    std::string node; // the node whose bodies are being emitted
+    LogLevel node_log = LogLevel::Debug; // and the lowest `log` level it keeps
+    bool node_hosted = true; // false: it runs in another process
+    bool in_sequence = false; // the body is a coroutine
+
+    bool async_executor() const { return opts.executor != ExecutorKind::Inline; }
+    bool simulated() const { return opts.executor == ExecutorKind::Sim; }
+    bool static_dispatch() const { return opts.dispatch == DispatchKind::Static; }
+    bool shm_transport() const { return opts.transport == TransportKind::Shm; }
+    bool deployed() const { return opts.deploy_process >= 0; }
+    bool recording() const { return opts.record; }
+};
+
+// Looks up `key` in a node's `{key: value, ...}` config blob (as captured by the parser).
+static std::string config_value(const std::string& blob, const std::string& key) {
+    std::string body = blob;
+    if (!body.empty() && body.front() == '{') body.erase(0, 1);
+    if (!body.empty() && body.back() == '}') body.pop_back();
+    auto trim = [](std::string s) {
+        size_t b = s.find_first_not_of(" \t\r\n");
+        size_t e = s.find_last_not_of(" \t\r\n");
+        return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+    };
+    std::stringstream ss(body);
+    std::string entry;
+    while (std::getline(ss, entry, ',')) {
+        size_t colon = entry.find(':');
+        if (colon == std::string::npos) continue;
+        if (trim(entry.substr(0, colon)) == key) return trim(entry.substr(colon + 1));
+    }
+    return {};
+}
+
+static int node_queue_depth(const GenContext& ctx, const NodeDecl& n) {
+    std::string v = config_value(n.config_text, "queue");
+    if (!v.empty() && v.find_first_not_of("0123456789") == std::string::npos) {
+        int d = std::stoi(v);
+        if (d > 0) return d;
+    }
+    return ctx.opts.queue_depth;
+}
+
+// `log` levels by severity; `print` is not a level and is never dropped.
+static int log_rank(LogLevel l) {
+    switch (l) {
+        case LogLevel::Debug: return 0;
+        case LogLevel::Info: return 1;
+        case LogLevel::Warn: return 2;
+        case LogLevel::Error: return 3;
+        case LogLevel::Print: break;
+    }
+    return 4;
+}
+
+static const char* runtime_log_level(LogLevel l) {
+    switch (l) {
+        case LogLevel::Debug: return "LogLevel::DEBUG";
+        case LogLevel::Warn: return "LogLevel::WARN";
+        case LogLevel::Error: return "LogLevel::ERROR";
+        default: return "LogLevel::INFO";
+    }
+}
+
+// The node's `{log: <level>}` config, if it has a valid one.
+static bool node_log_config(const NodeDecl& n, LogLevel& out) {
+    static const std::pair<const char*, LogLevel> levels[] = {
+        {"debug", LogLevel::Debug}, {"info", LogLevel::Info}, {"warn", LogLevel::Warn}, {"error", LogLevel::Error}};
+    std::string v = config_value(n.config_text, "log");
+    for (const auto& [name, level] : levels) {
+        if (v == name) {
+            out = level;
+            return true;
         }
-        std::cout << msg << std::endl;
     }
-};
+    return false;
+}
 
-template <typename T>
-class Topic {
-    struct Sub {
-        int id;
-        std::function<void(T)> cb;
+// The lowest `log` level generated for the node.
+static LogLevel node_log_floor(const GenContext& ctx, const NodeDecl& n) {
+    LogLevel l = ctx.opts.min_log_level;
+    node_log_config(n, l);
+    return l;
+}
+
+static void collect_dispatch_tables(GenContext& ctx, const Program& p) {
+    std::unordered_map<std::string, size_t> by_key;
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d)) {
+            for (const auto& t : n->topics) {
+                by_key[n->name + "." + t.name] = ctx.tables.size();
+                ctx.tables.push_back(DispatchTable{n->name, t.name, t.type, {}});
+            }
+        }
+    }
+    auto add = [&](const std::string& owner, const OnListenDecl& l) {
+        std::string src = l.source_node.empty() ? owner : l.source_node;
+        auto it = by_key.find(src + "." + l.topic_name);
+        if (it == by_key.end()) return;
+        auto& tbl = ctx.tables[it->second];
+        ctx.edge_slots[&l] = {it->second, tbl.edges.size()};
+        tbl.edges.push_back(ListenEdge{owner, &l});
     };
-    std::vector<Sub> subscribers;
-    int next_id = 1;
-public:
-    void publish(T val) {
-        for (auto& s : subscribers) {
-            if (s.cb) s.cb(val);
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d)) {
+            for (const auto& l : n->listeners) add(n->name, l);
+        } else if (auto m = std::get_if<ModeDecl>(&d)) {
+            for (const auto& l : m->listeners) add(m->node_name, l);
         }
     }
+}
 
-    // Returns a subscription handle that can be used to unsubscribe.
-    int subscribe(std::function<void(T)> cb) {
-        int id = next_id++;
-        subscribers.push_back(Sub{id, std::move(cb)});
-        return id;
+static std::string table_name(const DispatchTable& t) { return "__rivet_tbl_" + t.src + "_" + t.topic; }
+static std::string edge_thunk_name(const DispatchTable& t, size_t slot) {
+    return "__rivet_edge_" + t.src + "_" + t.topic + "_" + std::to_string(slot);
+}
+static std::string edge_method_name(const DispatchTable& t, size_t slot) {
+    return "__rivet_listen_" + t.src + "_" + t.topic + "_" + std::to_string(slot);
+}
+static std::string edge_param_name(const OnListenDecl& l) {
+    return l.sig.params.empty() ? std::string("val") : l.sig.params[0].name;
+}
+
+// Generated `Src_inst->topic.enable(slot)` for a listener.
+static std::string edge_enable(const GenContext& ctx, const OnListenDecl& l) {
+    auto [ti, slot] = ctx.edge_slots.at(&l);
+    const auto& t = ctx.tables[ti];
+    return t.src + "_inst->" + t.topic + ".enable(" + std::to_string(slot) + ");";
+}
+
+static bool has_rate_policy(const OnListenDecl& l) {
+    return l.every_ns || l.debounce_ns || l.sample_every > 1;
+}
+
+static void collect_listen_gates(GenContext& ctx, const Program& p) {
+    std::unordered_map<std::string, int> mode_index;
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d)) {
+            for (size_t li = 0; li < n->listeners.size(); ++li) {
+                if (has_rate_policy(n->listeners[li]))
+                    ctx.gates[&n->listeners[li]] = {n->name, "__rivet_gate_n" + std::to_string(li)};
+            }
+        } else if (auto m = std::get_if<ModeDecl>(&d)) {
+            int mi = mode_index[m->node_name]++;
+            for (size_t li = 0; li < m->listeners.size(); ++li) {
+                if (has_rate_policy(m->listeners[li]))
+                    ctx.gates[&m->listeners[li]] = {m->node_name, "__rivet_gate_m" + std::to_string(mi) + "_l" +
+                                                                    std::to_string(li)};
+            }
+        }
     }
+}
+
+// `if (!<owner>->gate.admit()) return; ` for gated listeners, "" otherwise.
+static std::string gate_check(const GenContext& ctx, const OnListenDecl& l, const std::string& owner_expr) {
+    auto it = ctx.gates.find(&l);
+    if (it == ctx.gates.end()) return "";
+    return "if (!" + owner_expr + "->" + it->second.member + ".admit()) return; ";
+}
 
-    void unsubscribe(int id) {
-        subscribers.erase(
-            std::remove_if(subscribers.begin(), subscribers.end(),
-                           [&](const Sub& s) { return s.id == id; }),
-            subscribers.end());
+static void collect_shared_topics(GenContext& ctx, const Program& p) {
+    if (!ctx.shm_transport()) return;
+    std::vector<std::string> nodes;
+    for (const auto& d : p.decls)
+        if (auto n = std::get_if<NodeDecl>(&d)) nodes.push_back(n->name);
+    for (const auto& tbl : ctx.tables) {
+        const TopicDecl* decl = nullptr;
+        for (const auto& d : p.decls)
+            if (auto n = std::get_if<NodeDecl>(&d); n && n->name == tbl.src)
+                for (const auto& t : n->topics)
+                    if (t.name == tbl.topic) decl = &t;
+        std::vector<std::string> consumers;
+        auto add = [&](const std::string& node) {
+            if (node != tbl.src && std::find(consumers.begin(), consumers.end(), node) == consumers.end())
+                consumers.push_back(node);
+        };
+        if (decl->latched || decl->history > 0) {
+            for (const auto& n : nodes) add(n);
+        } else {
+            for (const auto& e : tbl.edges) add(e.owner);
+        }
+        if (consumers.empty()) continue;
+        ctx.shared.push_back(SharedTopic{tbl.src, decl, consumers});
+        ctx.shared_decls.insert(decl);
     }
-};
+}
 
-class SystemManager {
-public:
-    static std::string current_mode;
-    static std::vector<std::function<void(std::string)>> on_transition;
-    static void set_mode(const std::string& m) {
-        if (current_mode != m) {
-            std::cout << "[SYS] Transitioning to: " << m << std::endl;
-            current_mode = m;
-            for (auto& cb : on_transition) cb(m);
+static void for_each_stmt(const std::vector<StmtPtr>& body, const std::function<void(const Stmt&)>& f) {
+    for (const auto& sp : body) {
+        f(*sp);
+        if (auto is = std::get_if<IfStmt>(&sp->v)) {
+            for_each_stmt(is->then_body, f);
+            for (const auto& br : is->elifs) for_each_stmt(br.body, f);
+            for_each_stmt(is->else_body, f);
+        } else if (auto rq = std::get_if<RequestStmt>(&sp->v)) {
+            for_each_stmt(rq->on_reply, f);
+            for_each_stmt(rq->on_timeout, f);
         }
     }
-};
-std::string SystemManager::current_mode = "Init";
-std::vector<std::function<void(std::string)>> SystemManager::on_transition;
-)";
+}
+
+// Calls f(node, statement) for every statement in the program.
+static void for_each_node_stmt(const Program& p, const std::function<void(const std::string&, const Stmt&)>& f) {
+    auto scan = [&](const std::string& node, const std::vector<StmtPtr>& body) {
+        for_each_stmt(body, [&](const Stmt& st) { f(node, st); });
+    };
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d)) {
+            for (const auto& r : n->requests) scan(n->name, r.body);
+            for (const auto& l : n->listeners) scan(n->name, l.body);
+            for (const auto& t : n->timers) scan(n->name, t.body);
+            for (const auto& f : n->private_funcs) scan(n->name, f.body);
+        } else if (auto m = std::get_if<ModeDecl>(&d)) {
+            scan(m->node_name, m->body);
+            for (const auto& l : m->listeners) scan(m->node_name, l.body);
+            for (const auto& t : m->timers) scan(m->node_name, t.body);
+        }
+    }
+}
+
+// Calls f(caller, request) for every `request` statement in the program.
+static void for_each_request(const Program& p, const std::function<void(const std::string&, const RequestStmt&)>& f) {
+    for_each_node_stmt(p, [&](const std::string& node, const Stmt& st) {
+        if (auto rq = std::get_if<RequestStmt>(&st.v)) f(node, *rq);
+    });
+}
+
+// (caller, target) for every `request` aimed at another node.
+static std::vector<std::pair<std::string, std::string>> request_edges(const Program& p) {
+    std::vector<std::pair<std::string, std::string>> out;
+    for_each_request(p, [&](const std::string& node, const RequestStmt& rq) {
+        if (rq.target_node == node) return;
+        std::pair<std::string, std::string> e{node, rq.target_node};
+        if (std::find(out.begin(), out.end(), e) == out.end()) out.push_back(e);
+    });
+    return out;
+}
+
+static std::string rpc_stub_name(const std::string& target, const std::string& fn) {
+    return "__rivet_rpc_" + target + "_" + fn;
+}
+static std::string rpc_transition_name(const std::string& target) { return "__rivet_rpc_transition_" + target; }
+
+// The manifest process hosting `node`.
+static const DeployProcess& process_of(const GenContext& ctx, const std::string& node) {
+    for (const auto& proc : ctx.opts.deploy)
+        if (std::find(proc.nodes.begin(), proc.nodes.end(), node) != proc.nodes.end()) return proc;
+    return ctx.opts.deploy[ctx.opts.deploy_process]; // unreachable: the manifest places every node
+}
+
+static void collect_remote_calls(GenContext& ctx, const Program& p) {
+    if (!ctx.deployed()) return;
+    const auto& self = ctx.opts.deploy[ctx.opts.deploy_process];
+    std::vector<RemoteCall> all;
+    std::unordered_map<std::string, int> node_indices;
+    int node_index = 0;
+    for (const auto& d : p.decls) {
+        auto n = std::get_if<NodeDecl>(&d);
+        if (!n) continue;
+        bool local = std::find(self.nodes.begin(), self.nodes.end(), n->name) != self.nodes.end();
+        if (!local) ctx.remote_nodes.insert(n->name);
+        for (size_t fi = 0; fi < n->requests.size(); ++fi)
+            all.push_back(RemoteCall{n->name, &n->requests[fi], node_index, (int)fi});
+        node_indices[n->name] = node_index++;
+    }
+    for_each_node_stmt(p, [&](const std::string& caller, const Stmt& st) {
+        auto tr = std::get_if<TransitionStmt>(&st.v);
+        if (!tr || tr->is_system || tr->target_node.empty()) return;
+        bool caller_local = !ctx.remote_nodes.count(caller), target_local = !ctx.remote_nodes.count(tr->target_node);
+        if (caller_local == target_local) return;
+        auto& out = caller_local ? ctx.remote_transitions : ctx.served_transitions;
+        for (const auto& rt : out)
+            if (rt.target == tr->target_node) return;
+        out.push_back(RemoteTransition{tr->target_node, node_indices.at(tr->target_node)});
+    });
+    std::unordered_set<std::string> sent, served;
+    for_each_request(p, [&](const std::string& caller, const RequestStmt& rq) {
+        bool caller_local = !ctx.remote_nodes.count(caller), target_local = !ctx.remote_nodes.count(rq.target_node);
+        if (caller_local == target_local) return;
+        // validate_deployment has rejected the ones that wait for a reply.
+        auto& seen = caller_local ? sent : served;
+        if (!seen.insert(rq.target_node + "." + rq.func_name).second) return;
+        for (const auto& rc : all) {
+            if (rc.target != rq.target_node || rc.decl->sig.name != rq.func_name) continue;
+            (caller_local ? ctx.remote_calls : ctx.served_calls).push_back(rc);
+        }
+    });
+}
+
+static void collect_recorded_topics(GenContext& ctx, const Program& p) {
+    if (!ctx.recording()) return;
+    for (const auto& d : p.decls) {
+        auto n = std::get_if<NodeDecl>(&d);
+        if (!n) continue;
+        for (const auto& t : n->topics) {
+            if (t.type.base == ValType::Custom) continue; // no codec
+            ctx.recorded_ids[&t] = ctx.recorded.size();
+            ctx.recorded.push_back(RecordedTopic{n->name, &t});
+        }
+    }
+}
+
+static std::string duration_text(int64_t ns) {
+    if (ns % 1000000000 == 0) return std::to_string(ns / 1000000000) + "s";
+    if (ns % 1000000 == 0) return std::to_string(ns / 1000000) + "ms";
+    if (ns % 1000 == 0) return std::to_string(ns / 1000) + "us";
+    return std::to_string(ns) + "ns";
+}
+
+// Marks the parameters of a body whose statements may be left out (logs below
+// the node's level, or all of them for a node in another process), since those
+// may have been the only ones using them.
+static const char* param_attr(const GenContext& ctx) {
+    return !ctx.node_hosted || log_rank(ctx.node_log) > log_rank(LogLevel::Debug) ? "[[maybe_unused]] " : "";
+}
+
+// Interned mode names (ModeId in the runtime). System modes: Init, the
+// built-ins, then the declared ones in order, as SysMode::<name>. Local modes
+// are numbered per node, 0 being Init, in the order their blocks appear.
+static bool is_system_mode(const GenContext& ctx, const ModeDecl* m) {
+    if (!m) return false;
+    if (m->mode_name.text == "Init") return false;
+    if (m->mode_name.is_local_string) return false;
+    if (m->ignores_system) return false;
+    return std::find(ctx.sys_modes.begin(), ctx.sys_modes.end(), m->mode_name.text) != ctx.sys_modes.end();
+}
+static bool is_local_mode(const GenContext& ctx, const ModeDecl* m) {
+    if (!m) return false;
+    if (m->mode_name.text == "Init") return false;
+    if (m->mode_name.is_local_string) return true;
+    if (m->ignores_system) return true;
+    return std::find(ctx.sys_modes.begin(), ctx.sys_modes.end(), m->mode_name.text) == ctx.sys_modes.end();
+}
+
+static void collect_mode_ids(GenContext& ctx, const Program& p) {
+    ctx.sys_modes = {"Init", "Normal", "Shutdown"}; // built in, see validate
+    for (const auto& d : p.decls) {
+        auto sm = std::get_if<SystemModeDecl>(&d);
+        if (sm && std::find(ctx.sys_modes.begin(), ctx.sys_modes.end(), sm->name) == ctx.sys_modes.end())
+            ctx.sys_modes.push_back(sm->name);
+    }
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d)) ctx.local_modes[n->name] = {"Init"};
+    }
+    for (const auto& d : p.decls) {
+        auto m = std::get_if<ModeDecl>(&d);
+        if (!m || !is_local_mode(ctx, m)) continue;
+        auto& names = ctx.local_modes[m->node_name];
+        if (std::find(names.begin(), names.end(), m->mode_name.text) == names.end())
+            names.push_back(m->mode_name.text);
+    }
+}
+
+static size_t local_mode_id(const GenContext& ctx, const std::string& node, const std::string& name) {
+    const auto& names = ctx.local_modes.at(node);
+    return std::find(names.begin(), names.end(), name) - names.begin();
+}
+
+// With dynamic dispatch, the listeners of a node's mode blocks are numbered
+// (block, then listener, in declaration order) as the bits of its ListenSet.
+static std::unordered_map<const OnListenDecl*, size_t> listen_slots(const GenContext& ctx, const std::vector<const ModeDecl*>& node_modes) {
+    std::unordered_map<const OnListenDecl*, size_t> slots;
+    if (ctx.static_dispatch()) return slots;
+    for (const auto* m : node_modes)
+        for (const auto& l : m->listeners) slots.emplace(&l, slots.size());
+    return slots;
+}
+
+static std::vector<const ModeDecl*> node_mode_decls(const Program& p, const std::string& node) {
+    std::vector<const ModeDecl*> modes;
+    for (const auto& d : p.decls) {
+        auto m = std::get_if<ModeDecl>(&d);
+        if (m && m->node_name == node) modes.push_back(m);
+    }
+    return modes;
+}
+
+// `request async ... -> x`: the requests' declarations, for the reply types.
+static void collect_request_decls(GenContext& ctx, const Program& p) {
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d))
+            for (const auto& r : n->requests) ctx.request_decls[n->name + "." + r.sig.name] = &r;
+    }
+}
+
+// `onRequest idempotent`: calls go through the target's Coalescer member.
+static bool coalesced(const GenContext& ctx, const RequestStmt& rq) {
+    auto it = ctx.request_decls.find(rq.target_node + "." + rq.func_name);
+    return it != ctx.request_decls.end() && it->second->idempotent;
+}
+static std::string coalescer(const RequestStmt& rq) {
+    return rq.target_node + "_inst->__rivet_once_" + rq.func_name;
+}
+
+static bool has_coalescing(const Program& p) {
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d))
+            for (const auto& r : n->requests) if (r.idempotent) return true;
+    }
+    return false;
+}
+
+static bool has_futures(const Program& p) {
+    bool found = false;
+    for_each_request(p, [&](const std::string&, const RequestStmt& rq) { found = found || !rq.result.empty(); });
+    return found;
+}
+
+// Bodies with an `await request` or a `wait` compile to coroutines returning
+// Sequence<T> (see the runtime); `return` in them becomes `co_return`.
+static bool has_sequences(const Program& p) {
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d)) {
+            for (const auto& r : n->requests) if (body_suspends(r.body)) return true;
+            for (const auto& f : n->private_funcs) if (body_suspends(f.body)) return true;
+            for (const auto& t : n->timers) if (body_suspends(t.body)) return true;
+        } else if (auto m = std::get_if<ModeDecl>(&d)) {
+            if (body_suspends(m->body)) return true;
+            for (const auto& t : m->timers) if (body_suspends(t.body)) return true;
+        }
+    }
+    return false;
+}
+
+const char* cpp_standard(const Program& p) { return has_sequences(p) ? "c++20" : "c++17"; }
+
+static bool has_timers(const Program& p) {
+    for (const auto& d : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&d); n && !n->timers.empty()) return true;
+        if (auto m = std::get_if<ModeDecl>(&d); m && !m->timers.empty()) return true;
+    }
+    return false;
+}
+
+// Starts an `every` timer whose Id lands in <owner>->__rivet_timer_<suffix>. A
+// tick only runs __rivet_every_<suffix>() while that Id is still current, so a
+// tick already queued when its mode is left is dropped on arrival.
+static void emit_timer_start(const GenContext& ctx, std::ostream& os, const std::string& owner, const std::string& suffix,
+                             const std::string& label, const EveryDecl& t, int depth) {
+    std::string pad(depth * 4, ' ');
+    std::string cap = owner == "this" ? "this" : "";
+    std::string fire = "if (" + owner + "->__rivet_timer_" + suffix + " == id) " + owner + "->__rivet_every_" +
+                       suffix + "();";
+    os << pad << owner << "->__rivet_timer_" << suffix << " = Timers::instance().start(\"" << label
+       << " (line " << t.loc.line << ")\", "
+       << t.period_ns << ", [" << cap << "](Timers::Id id) {\n";
+    if (ctx.async_executor()) {
+        os << pad << "    " << owner << "->post([" << cap << (cap.empty() ? "" : ", ") << "id] { " << fire
+           << " });\n";
+    } else {
+        os << pad << "    " << fire << "\n";
+    }
+    os << pad << "});\n";
+}
 
 static std::string to_cpp_type(const TypeInfo& t) {
     switch(t.base) {
@@ -86,8 +552,124 @@ static std::string to_cpp_type(const TypeInfo& t) {
     }
 }
 
+// Parameter type: strings (and other non-scalars) are taken by const reference.
+static std::string to_cpp_param_type(const TypeInfo& t) {
+    if (t.base == ValType::String) return "const std::string&";
+    return to_cpp_type(t);
+}
+
+// A coroutine outlives its caller's arguments, so its parameters are copies.
+static std::string to_cpp_param_type(const TypeInfo& t, bool suspends) {
+    return suspends ? to_cpp_type(t) : to_cpp_param_type(t);
+}
+static std::string to_cpp_return_type(const TypeInfo& t, bool suspends) {
+    return suspends ? "Sequence<" + to_cpp_type(t) + ">" : to_cpp_type(t);
+}
+
+// Wire codecs (WireWriter / WireReader in the runtime): one per topic and one
+// per request, each stamped with an FNV-1a hash of its declaration.
+static uint64_t schema_hash(const std::string& decl) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : decl) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::string rv_type_name(const TypeInfo& t) {
+    switch (t.base) {
+        case ValType::Int:    return "int";
+        case ValType::Float:  return "float";
+        case ValType::String: return "string";
+        case ValType::Bool:   return "bool";
+        default:              return t.custom_name;
+    }
+}
+
+// Decoded field type: strings are views into the received bytes.
+static std::string wire_view_type(const TypeInfo& t) {
+    if (t.base == ValType::String) return "std::string_view";
+    return to_cpp_type(t);
+}
+
+// What a topic's schema hash covers, e.g. `topic Nav.alt : float`.
+static std::string topic_schema_decl(const std::string& node, const TopicDecl& t) {
+    return "topic " + node + "." + t.name + " : " + rv_type_name(t.type);
+}
+
+uint64_t topic_schema(const std::string& node, const TopicDecl& t) {
+    return schema_hash(topic_schema_decl(node, t));
+}
+
+static std::string topic_codec(const std::string& node, const std::string& topic) {
+    return "TopicWire_" + node + "_" + topic;
+}
+static std::string request_codec(const std::string& node, const std::string& fn) {
+    return "RequestWire_" + node + "_" + fn;
+}
+
+static std::string hex64(uint64_t v) {
+    std::ostringstream ss;
+    ss << "0x" << std::hex << v << "ull";
+    return ss.str();
+}
+
+static void emit_wire_codecs(const Program& p, std::ostream& os) {
+    os << "\n// Wire codecs for every topic and request.\n";
+    std::string all;
+    for (const auto& d : p.decls) {
+        auto n = std::get_if<NodeDecl>(&d);
+        if (!n) continue;
+        for (const auto& t : n->topics) {
+            if (t.type.base == ValType::Custom) continue;
+            std::string decl = topic_schema_decl(n->name, t);
+            all += decl + "\n";
+            os << "struct " << topic_codec(n->name, t.name) << " {\n";
+            os << "    static constexpr uint64_t schema = " << hex64(schema_hash(decl)) << "; // " << decl << "\n";
+            os << "    using View = " << wire_view_type(t.type) << ";\n";
+            os << "    static void encode(WireWriter& w, const " << to_cpp_type(t.type) << "& v) { w.put(v); }\n";
+            os << "    static bool decode(WireReader& r, View& v) {\n";
+            os << "        r.get(v);\n";
+            os << "        return r.ok();\n";
+            os << "    }\n";
+            os << "};\n";
+        }
+        for (const auto& r : n->requests) {
+            const auto& sig = r.sig;
+            bool custom = false;
+            std::string decl = "request " + n->name + "." + sig.name + "(";
+            for (size_t i = 0; i < sig.params.size(); ++i) {
+                custom |= sig.params[i].type.base == ValType::Custom;
+                decl += (i ? ", " : "") + rv_type_name(sig.params[i].type);
+            }
+            decl += ")";
+            if (custom) continue;
+            all += decl + "\n";
+            bool none = sig.params.empty();
+            os << "struct " << request_codec(n->name, sig.name) << " {\n";
+            os << "    static constexpr uint64_t schema = " << hex64(schema_hash(decl)) << "; // " << decl << "\n";
+            os << "    struct View {";
+            for (const auto& prm : sig.params) os << " " << wire_view_type(prm.type) << " " << prm.name << ";";
+            os << (none ? "" : " ") << "};\n";
+            os << "    static void encode(WireWriter&" << (none ? "" : " w");
+            for (const auto& prm : sig.params) os << ", " << to_cpp_param_type(prm.type) << " " << prm.name;
+            os << ") {";
+            for (const auto& prm : sig.params) os << " w.put(" << prm.name << ");";
+            os << (none ? "" : " ") << "}\n";
+            os << "    static bool decode(WireReader& r, View&" << (none ? "" : " v") << ") {\n";
+            for (const auto& prm : sig.params) os << "        r.get(v." << prm.name << ");\n";
+            os << "        return r.ok();\n";
+            os << "    }\n";
+            os << "};\n";
+        }
+    }
+    os << "constexpr uint64_t RIVET_SCHEMA = " << hex64(schema_hash(all)) << "; // all of the above\n";
+}
+
 static void gen_interpolated_string(const std::string& input, std::ostream& os) {
     std::regex re("\\{([^}]+)\\}");
+    std::regex topic_read("^\\s*(\\w+)\\.(\\w+)\\.(value|count|at\\(.*\\))\\s*$");
     std::string s = input;
     if (s.size() >= 2 && s.front() == '"' && s.back() == '"') s = s.substr(1, s.size() - 2);
 
@@ -100,7 +682,14 @@ static void gen_interpolated_string(const std::string& input, std::ostream& os)
         if ((size_t)match.position() > last_pos) {
             os << " << \"" << s.substr(last_pos, match.position() - last_pos) << "\"";
         }
-        os << " << " << match.str(1);
+        std::string inner = match.str(1);
+        std::smatch tv;
+        if (std::regex_match(inner, tv, topic_read)) {
+            std::string field = tv.str(3);
+            if (field == "value" || field == "count") field += "()";
+            inner = tv.str(1) + "_inst->" + tv.str(2) + "." + field;
+        }
+        os << " << " << inner;
         last_pos = match.position() + match.length();
     }
     if (last_pos < s.size()) os << " << \"" << s.substr(last_pos) << "\"";
@@ -186,6 +775,19 @@ static void gen_expr(const ExprPtr& e, std::ostream& os) {
             return;
         }
 
+    if (auto tr = std::get_if<Expr::TopicRead>(&e->v)) {
+        os << tr->node << "_inst->" << tr->topic;
+        switch (tr->kind) {
+            case Expr::TopicRead::Kind::Value: os << ".value()"; break;
+            case Expr::TopicRead::Kind::Count: os << ".count()"; break;
+            case Expr::TopicRead::Kind::At:
+                os << ".at(";
+                gen_expr(tr->index, os);
+                os << ")";
+                break;
+        }
+        return;
+    }
     if (auto un = std::get_if<Expr::Unary>(&e->v)) {
         os << "(";
         if (un->op == UnaryOp::Not) os << "!";
@@ -221,9 +823,77 @@ static void gen_expr(const ExprPtr& e, std::ostream& os) {
     os << "0";
 }
 
-static void gen_stmts(const std::vector<StmtPtr>& stmts, std::ostream& os, int depth) {
+static void gen_stmts(GenContext& ctx, const std::vector<StmtPtr>& stmts, std::ostream& os, int depth) {
+    // Another process runs this node's code; here it only carries its topics.
+    if (!ctx.node_hosted) return;
     auto indent = [&](int d) { for (int i = 0; i < d; ++i) os << "    "; };
 
+    // `request async ... -> x` calls joined by the `on` block of a later one in
+    // this block share a Future, declared at the first of them with both
+    // continuations; each call then fills the slot of its reply.
+    struct FutureGroup {
+        std::string var;
+        const RequestStmt* joiner = nullptr;
+        std::vector<const RequestStmt*> calls; // by slot, in `on` order
+    };
+    std::vector<FutureGroup> groups;
+    std::unordered_map<const RequestStmt*, std::pair<size_t, size_t>> slots; // call -> (group, slot)
+    std::unordered_map<const RequestStmt*, size_t> opens;                  // first call -> group
+    {
+        std::vector<const RequestStmt*> waiting;
+        for (const auto& sp : stmts) {
+            auto rq = sp ? std::get_if<RequestStmt>(&sp->v) : nullptr;
+            if (!rq || !rq->is_async) continue;
+            if (!rq->result.empty()) waiting.push_back(rq);
+            if (rq->awaits.empty()) continue;
+            FutureGroup g{"__rivet_future" + std::to_string(ctx.future_count++), rq, {}};
+            const RequestStmt* first = nullptr;
+            for (const RequestStmt* c : waiting)
+                if (std::find(rq->awaits.begin(), rq->awaits.end(), c->result) != rq->awaits.end() && !first) first = c;
+            for (const auto& name : rq->awaits) {
+                auto it = std::find_if(waiting.begin(), waiting.end(),
+                                       [&](const RequestStmt* c) { return c->result == name; });
+                if (it == waiting.end()) continue; // rejected by validation
+                slots[*it] = {groups.size(), g.calls.size()};
+                g.calls.push_back(*it);
+                waiting.erase(it);
+            }
+            if (first) opens[first] = groups.size();
+            groups.push_back(std::move(g));
+        }
+    }
+    auto reply_type = [&](const RequestStmt* rq) {
+        return to_cpp_type(ctx.request_decls.at(rq->target_node + "." + rq->func_name)->sig.return_type);
+    };
+    auto emit_future = [&](const FutureGroup& g) {
+        const RequestStmt* j = g.joiner;
+        os << "Future<";
+        for (size_t k = 0; k < g.calls.size(); ++k) os << (k ? ", " : "") << reply_type(g.calls[k]);
+        os << "> " << g.var << ";\n";
+        indent(depth);
+        os << g.var << "->then(" << (ctx.async_executor() ? "this, " : "") << "[RIVET_CAPTURE](";
+        for (size_t k = 0; k < g.calls.size(); ++k)
+            os << (k ? ", " : "") << param_attr(ctx) << "const " << reply_type(g.calls[k]) << "& " << g.calls[k]->result;
+        os << ") {\n";
+        bool in_sequence = std::exchange(ctx.in_sequence, false); // the continuations are plain lambdas
+        gen_stmts(ctx, j->on_reply, os, depth + 1);
+        indent(depth);
+        if (j->on_timeout.empty() && log_rank(LogLevel::Warn) < log_rank(ctx.node_log)) {
+            os << "}, [RIVET_CAPTURE](const char*) {\n";
+        } else if (j->on_timeout.empty()) {
+            os << "}, [RIVET_CAPTURE](const char* request) {\n";
+            indent(depth + 1);
+            os << "if (LogLevel::WARN >= this->log_level) LogLine(this->name, LogLevel::WARN) << request << \" timed out\";\n";
+        } else {
+            os << "}, [RIVET_CAPTURE](const char*) {\n";
+            gen_stmts(ctx, j->on_timeout, os, depth + 1);
+        }
+        ctx.in_sequence = in_sequence;
+        indent(depth);
+        os << "});\n";
+        indent(depth);
+    };
+
     for (const auto& sp : stmts) {
         if (!sp) continue;
 
@@ -231,20 +901,20 @@ static void gen_stmts(const std::vector<StmtPtr>& stmts, std::ostream& os, int d
         if (auto ifs = std::get_if<IfStmt>(&sp->v)) {
             indent(depth);
             os << "if ("; gen_expr(ifs->cond, os); os << ") {\n";
-            gen_stmts(ifs->then_body, os, depth + 1);
+            gen_stmts(ctx, ifs->then_body, os, depth + 1);
             indent(depth);
             os << "}";
 
             for (const auto& br : ifs->elifs) {
                 os << " else if ("; gen_expr(br.cond, os); os << ") {\n";
-                gen_stmts(br.body, os, depth + 1);
+                gen_stmts(ctx, br.body, os, depth + 1);
                 indent(depth);
                 os << "}";
             }
 
             if (!ifs->else_body.empty()) {
                 os << " else {\n";
-                gen_stmts(ifs->else_body, os, depth + 1);
+                gen_stmts(ctx, ifs->else_body, os, depth + 1);
                 indent(depth);
                 os << "}";
             }
@@ -252,64 +922,193 @@ static void gen_stmts(const std::vector<StmtPtr>& stmts, std::ostream& os, int d
             continue;
         }
 
+        auto log = std::get_if<LogStmt>(&sp->v);
+        if (log && log->level != LogLevel::Print && log_rank(log->level) < log_rank(ctx.node_log)) continue;
+
         indent(depth);
 
-        if (auto log = std::get_if<LogStmt>(&sp->v)) {
+        if (log) {
+            // Formatted straight into the logging thread's line buffer, and
+            // only once the node's level lets the line through: a disabled
+            // `log` evaluates none of its arguments.
             if (log->level == LogLevel::Print) {
-                os << "std::cout";
-                for (const auto& arg : log->args) {
-                    if (!arg.empty() && arg[0] == '"') gen_interpolated_string(arg, os);
-                    else os << " << " << arg;
-                }
-                os << " << std::endl;\n";
+                os << "LogLine()";
             } else {
-                std::string lvl = "LogLevel::INFO";
-                if (log->level == LogLevel::Warn) lvl = "LogLevel::WARN";
-                if (log->level == LogLevel::Error) lvl = "LogLevel::ERROR";
-                if (log->level == LogLevel::Debug) lvl = "LogLevel::DEBUG";
-                os << "{ std::stringstream _ss; _ss";
-                for (const auto& arg : log->args) {
-                    if (!arg.empty() && arg[0] == '"') gen_interpolated_string(arg, os);
-                    else os << " << " << arg;
-                }
-                os << "; Logger::log(this->name, " << lvl << ", _ss.str()); }\n";
+                const char* lvl = runtime_log_level(log->level);
+                os << "if (" << lvl << " >= this->log_level) LogLine(this->name, " << lvl << ")";
+            }
+            for (const auto& arg : log->args) {
+                if (!arg.empty() && arg[0] == '"') gen_interpolated_string(arg, os);
+                else os << " << " << arg;
             }
+            os << ";\n";
         } else if (auto pub = std::get_if<PublishStmt>(&sp->v)) {
             os << "this->" << pub->topic_handle << ".publish(" << pub->value << ");\n";
         } else if (auto tr = std::get_if<TransitionStmt>(&sp->v)) {
             if (tr->is_system) {
-                os << "SystemManager::set_mode(\"" << tr->target_state << "\");\n";
+                os << "SystemManager::set_mode(SysMode::" << tr->target_state << ");\n";
             } else if (!tr->target_node.empty()) {
-                os << tr->target_node << "_inst->set_state(\"" << tr->target_state << "\");\n";
+                size_t id = local_mode_id(ctx, tr->target_node, tr->target_state);
+                if (ctx.remote_nodes.count(tr->target_node)) {
+                    os << rpc_transition_name(tr->target_node) << "(" << id << "); // \"" << tr->target_state
+                       << "\"\n";
+                } else if (ctx.async_executor()) {
+                    os << "post_call(" << tr->target_node << "_inst, &" << tr->target_node << "::set_state, ModeId("
+                       << id << ")); // \"" << tr->target_state << "\"\n";
+                } else {
+                    os << tr->target_node << "_inst->set_state(" << id << "); // \"" << tr->target_state << "\"\n";
+                }
             } else {
-                os << "this->set_state(\"" << tr->target_state << "\");\n";
+                os << "this->set_state(" << local_mode_id(ctx, ctx.node, tr->target_state) << "); // \""
+                   << tr->target_state << "\"\n";
             }
-        } else if (auto req = std::get_if<RequestStmt>(&sp->v)) {
-            os << req->target_node << "_inst->" << req->func_name << "(";
-            for (size_t i = 0; i < req->args.size(); ++i) os << (i > 0 ? ", " : "") << req->args[i];
+        } else if (auto req = std::get_if<RequestStmt>(&sp->v); req && req->is_async && !req->result.empty()) {
+            auto [gi, slot] = slots.at(req);
+            const FutureGroup& g = groups[gi];
+            if (opens.count(req)) emit_future(g);
+            if (req->timeout_ns) {
+                os << g.var << "->arm(" << slot << ", \"request " << req->target_node << "." << req->func_name
+                   << "\", " << req->timeout_ns << ");\n";
+                indent(depth);
+            }
+            if (coalesced(ctx, *req)) {
+                os << coalescer(*req) << ".call(reply_to<" << slot << ">(" << g.var << ".get())";
+                for (const auto& a : req->args) os << ", " << a;
+                os << ");\n";
+            } else if (ctx.async_executor()) {
+                os << "post_request<" << slot << ">(" << g.var << ".get(), " << req->target_node << "_inst, &"
+                   << req->target_node << "::" << req->func_name;
+                for (const auto& a : req->args) os << ", " << a;
+                os << ");\n";
+            } else {
+                os << "reply_with<" << slot << ">(" << g.var << ".get(), " << req->target_node << "_inst->"
+                   << req->func_name << "(";
+                for (size_t i = 0; i < req->args.size(); ++i) os << (i > 0 ? ", " : "") << req->args[i];
+                os << "));\n";
+            }
+        } else if (auto req = std::get_if<RequestStmt>(&sp->v); req && req->is_await) {
+            if (!req->result.empty()) os << "[[maybe_unused]] auto " << req->result << " = ";
+            os << "co_await ask(this, \"request " << req->target_node << "." << req->func_name << "\", "
+               << req->timeout_ns << ", ";
+            if (coalesced(ctx, *req)) os << coalescer(*req);
+            else os << req->target_node << "_inst, &" << req->target_node << "::" << req->func_name;
+            for (const auto& a : req->args) os << ", " << a;
             os << ");\n";
+        } else if (auto w = std::get_if<WaitStmt>(&sp->v)) {
+            os << "co_await after(this, \"wait " << duration_text(w->ns) << " (line " << w->loc.line << ")\", "
+               << w->ns << ");\n";
+        } else if (auto req = std::get_if<RequestStmt>(&sp->v)) {
+            if (ctx.remote_nodes.count(req->target_node)) {
+                os << rpc_stub_name(req->target_node, req->func_name) << "(";
+                for (size_t i = 0; i < req->args.size(); ++i) os << (i > 0 ? ", " : "") << req->args[i];
+                os << ");\n";
+            } else if (coalesced(ctx, *req)) {
+                os << coalescer(*req) << ".call(nullptr";
+                for (const auto& a : req->args) os << ", " << a;
+                os << ");\n";
+            } else if (ctx.async_executor()) {
+                // Queue the call on the target's executor instead of running it on our stack.
+                os << "post_call(" << req->target_node << "_inst, &" << req->target_node << "::" << req->func_name;
+                for (const auto& a : req->args) os << ", " << a;
+                os << ");\n";
+            } else {
+                os << req->target_node << "_inst->" << req->func_name << "(";
+                for (size_t i = 0; i < req->args.size(); ++i) os << (i > 0 ? ", " : "") << req->args[i];
+                os << ");\n";
+            }
         } else if (auto call = std::get_if<CallStmt>(&sp->v)) {
             os << "this->" << call->callee << "(";
             for (size_t i = 0; i < call->args.size(); ++i) os << (i > 0 ? ", " : "") << call->args[i];
             os << ");\n";
         } else if (auto ret = std::get_if<ReturnStmt>(&sp->v)) {
-            os << "return " << ret->value << ";\n";
+            os << (ctx.in_sequence ? "co_return " : "return ") << ret->value << ";\n";
         }
     }
 }
 
-void generate_cpp(const Program& p, std::ostream& os) {
-    std::unordered_set<std::string> system_modes;
-    for (const auto& d : p.decls) {
-        if (auto sm = std::get_if<SystemModeDecl>(&d)) system_modes.insert(sm->name);
-    }
+void generate_cpp(const Program& p, std::ostream& os, const CppGenOptions& opts) {
+    GenContext ctx;
+    ctx.opts = opts;
+    collect_dispatch_tables(ctx, p);
+    collect_listen_gates(ctx, p);
+    collect_shared_topics(ctx, p);
+    collect_remote_calls(ctx, p);
+    collect_recorded_topics(ctx, p);
+    collect_request_decls(ctx, p);
+    collect_mode_ids(ctx, p);
 
-    os << RIVET_RUNTIME << "\n";
+    RuntimeFeatures features;
+    features.sequences = has_sequences(p);
+    features.coalesce = has_coalescing(p);
+    features.futures = has_futures(p) || features.sequences || features.coalesce;
+    features.timers = has_timers(p) || features.futures; // timeouts run on the wheel
+    emit_runtime(os, ctx.opts, features);
+    os << "\n// System modes, interned.\nnamespace SysMode {\nenum : ModeId {";
+    for (size_t i = 0; i < ctx.sys_modes.size(); ++i) os << (i ? ", " : " ") << ctx.sys_modes[i];
+    os << ", Count };\ninline const char* const names[] = {";
+    for (size_t i = 0; i < ctx.sys_modes.size(); ++i) os << (i ? ", " : "") << "\"" << ctx.sys_modes[i] << "\"";
+    os << "};\n} // namespace SysMode\n";
     for (const auto& decl : p.decls) {
         if (auto n = std::get_if<NodeDecl>(&decl)) {
             os << "class " << n->name << ";\nextern " << n->name << "* " << n->name << "_inst;\n";
         }
     }
+    emit_wire_codecs(p, os);
+    if (ctx.recording()) {
+        os << "\n// The log's topic table (--record).\n";
+        os << "static const LoggedTopic __rivet_topics[] = {\n";
+        for (const auto& rt : ctx.recorded)
+            os << "    {\"" << rt.owner << "." << rt.decl->name << "\", " << topic_codec(rt.owner, rt.decl->name)
+               << "::schema},\n";
+        if (ctx.recorded.empty()) os << "    {\"\", 0},\n"; // no zero-length arrays
+        os << "};\n";
+        os << "constexpr size_t __rivet_topic_count = " << ctx.recorded.size() << ";\n";
+    }
+    if (!ctx.remote_calls.empty() || !ctx.remote_transitions.empty())
+        os << "\n// Requests and transitions to nodes in other processes.\n";
+    for (const auto& rc : ctx.remote_calls) {
+        const auto& sig = rc.decl->sig;
+        const auto& proc = process_of(ctx, rc.target);
+        os << "void " << rpc_stub_name(rc.target, sig.name) << "(";
+        for (size_t i = 0; i < sig.params.size(); ++i)
+            os << (i ? ", " : "") << to_cpp_param_type(sig.params[i].type) << " " << sig.params[i].name;
+        os << ") {\n";
+        os << "    static const RpcTarget to(\"" << ctx.opts.program_name << "\", \"" << proc.name << "\");\n";
+        os << "    static IpcStat& st = IpcStats::get(\"request " << rc.target << "." << sig.name << " -> " << proc.name
+           << "\");\n";
+        std::string codec = request_codec(rc.target, sig.name);
+        os << "    WireWriter w(RpcEndpoint::buffer(), RpcEndpoint::MaxDatagram);\n";
+        os << "    w.varint(" << ((rc.node_index << 16) | rc.fn_index) << ");\n";
+        os << "    w.fixed64(" << codec << "::schema);\n";
+        os << "    " << codec << "::encode(w";
+        for (const auto& prm : sig.params) os << ", " << prm.name;
+        os << ");\n";
+        os << "    RpcEndpoint::instance().send(to, w, st);\n";
+        os << "}\n";
+    }
+    for (const auto& rt : ctx.remote_transitions) {
+        const auto& proc = process_of(ctx, rt.target);
+        os << "void " << rpc_transition_name(rt.target) << "(ModeId m) {\n";
+        os << "    static const RpcTarget to(\"" << ctx.opts.program_name << "\", \"" << proc.name << "\");\n";
+        os << "    static IpcStat& st = IpcStats::get(\"transition " << rt.target << " -> " << proc.name << "\");\n";
+        os << "    WireWriter w(RpcEndpoint::buffer(), RpcEndpoint::MaxDatagram);\n";
+        os << "    w.varint(" << (rt.node_index << 16) << " | RpcSetState);\n";
+        os << "    w.varint(m);\n";
+        os << "    RpcEndpoint::instance().send(to, w, st);\n";
+        os << "}\n";
+    }
+    if (ctx.static_dispatch()) {
+        os << "\n// Static dispatch tables: one slot per onListen edge.\n";
+        for (const auto& tbl : ctx.tables) {
+            if (tbl.edges.empty()) continue;
+            std::string ty = to_cpp_type(tbl.type);
+            for (size_t k = 0; k < tbl.edges.size(); ++k)
+                os << "void " << edge_thunk_name(tbl, k) << "(const Payload<" << ty << ">& val);\n";
+            os << "inline constexpr StaticHandler<" << ty << "> " << table_name(tbl) << "[] = {";
+            for (size_t k = 0; k < tbl.edges.size(); ++k) os << (k ? ", " : " ") << "&" << edge_thunk_name(tbl, k);
+            os << " };\n";
+        }
+    }
     // Pass 1: class declarations (no method bodies). This avoids C++ incomplete-type
     // issues when one node calls into another node declared later.
     for (const auto& decl : p.decls) {
@@ -323,50 +1122,157 @@ void generate_cpp(const Program& p, std::ostream& os) {
                 }
             }
 
-            auto sub_name = [&](int mi, int li) {
-                return std::string("__rivet_sub_m") + std::to_string(mi) + "_l" + std::to_string(li);
+            if (ctx.opts.executor == ExecutorKind::Actor) {
+                os << "\nclass " << n->name << " : public Actor {\npublic:\n";
+                os << "    " << n->name << "() : Actor(" << node_queue_depth(ctx, *n) << ") {}\n";
+            } else if (ctx.opts.executor == ExecutorKind::Pool) {
+                os << "\nclass " << n->name << " : public PooledNode {\npublic:\n";
+                os << "    " << n->name << "() : PooledNode(" << node_queue_depth(ctx, *n) << ") {}\n";
+            } else if (ctx.simulated()) {
+                os << "\nclass " << n->name << " : public SimNode {\npublic:\n";
+                os << "    " << n->name << "() : SimNode(" << node_queue_depth(ctx, *n) << ") {}\n";
+            } else {
+                os << "\nclass " << n->name << " {\npublic:\n";
+            }
+            os << "    std::string name = \"" << n->name << "\";\n";
+            LogLevel configured;
+            if (node_log_config(*n, configured)) os << "    LogLevel log_level = " << runtime_log_level(configured) << ";\n";
+            else os << "    LogLevel log_level = Logger::default_level();\n";
+            os << "    ModeId current_state = 0; //";
+            const auto& local_names = ctx.local_modes.at(n->name);
+            for (size_t i = 0; i < local_names.size(); ++i)
+                os << (i ? ", " : " ") << i << " " << local_names[i];
+            os << "\n";
+            os << "    ModeQueue __rivet_states; // set_state runs to completion\n";
+            for (const auto& t : n->topics) {
+                std::string ty = "Topic<" + to_cpp_type(t.type) + ">";
+                if (ctx.static_dispatch()) {
+                    for (const auto& tbl : ctx.tables) {
+                        if (tbl.src != n->name || tbl.topic != t.name) continue;
+                        ty = "StaticTopic<" + to_cpp_type(t.type) + ", " + std::to_string(tbl.edges.size()) + ", " +
+                             (tbl.edges.empty() ? std::string("nullptr") : table_name(tbl)) + ">";
+                    }
+                }
+                if (ctx.shared_decls.count(&t)) ty = "Shared<" + ty + ">";
+                if (t.history > 0) ty = "History<" + ty + ", " + std::to_string(t.history) + ">";
+                else if (t.latched) ty = "Latched<" + ty + ">";
+                if (auto it = ctx.recorded_ids.find(&t); it != ctx.recorded_ids.end())
+                    ty = "Recorded<" + ty + ", " + topic_codec(n->name, t.name) + ", " + std::to_string(it->second) + ">";
+                os << "    " << ty << " " << t.name << ";\n";
+            }
+
+            // Rate-limited listeners owned by this node (see collect_listen_gates).
+            auto decl_gate = [&](const OnListenDecl& l) {
+                auto it = ctx.gates.find(&l);
+                if (it == ctx.gates.end()) return;
+                os << "    ListenGate " << it->second.member << "{" << l.every_ns << ", " << l.debounce_ns << ", "
+                   << l.sample_every << "};\n";
             };
+            for (const auto& l : n->listeners) decl_gate(l);
+            for (const auto* m : node_modes)
+                for (const auto& l : m->listeners) decl_gate(l);
 
-            os << "\nclass " << n->name << " {\npublic:\n";
-            os << "    std::string name = \"" << n->name << "\";\n";
-            os << "    std::string current_state = \"Init\";\n";
-            for (const auto& t : n->topics) os << "    Topic<" << to_cpp_type(t.type) << "> " << t.name << ";\n";
+            // Mode-scoped listeners (onListen inside mode blocks), one bit each
+            if (size_t k = listen_slots(ctx, node_modes).size()) {
+                os << "    ListenSet<" << k << "> __rivet_listening; //";
+                for (int mi = 0, i = 0; mi < (int)node_modes.size(); ++mi) {
+                    for (const auto& l : node_modes[mi]->listeners) {
+                        os << (i++ ? ", " : " ") << (l.source_node.empty() ? n->name : l.source_node) << "."
+                           << l.topic_name;
+                    }
+                }
+                os << "\n";
+            }
 
-            // Mode-scoped subscription handles (for onListen inside mode blocks)
+            // `every` timers: the running timer's Id and its tick body.
+            auto decl_timer = [&](const std::string& suffix, const EveryDecl& t) {
+                os << "    Timers::Id __rivet_timer_" << suffix << " = 0;\n";
+                os << "    " << (body_suspends(t.body) ? "Sequence<void>" : "void") << " __rivet_every_" << suffix
+                   << "();\n";
+            };
+            for (size_t ti = 0; ti < n->timers.size(); ++ti) decl_timer("n" + std::to_string(ti), n->timers[ti]);
             for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
-                for (int li = 0; li < (int)node_modes[mi]->listeners.size(); ++li) {
-                    os << "    int " << sub_name(mi, li) << " = -1;\n";
-                }
+                for (size_t ti = 0; ti < node_modes[mi]->timers.size(); ++ti)
+                    decl_timer("m" + std::to_string(mi) + "_t" + std::to_string(ti), node_modes[mi]->timers[ti]);
+            }
+
+            // Mode bodies that await or wait run as their own coroutine.
+            for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
+                if (body_suspends(node_modes[mi]->body)) os << "    Sequence<void> __rivet_mode_" << mi << "();\n";
             }
 
             // Requests + functions
-            auto decl_func = [&](const FuncSignature& sig) {
-                os << "    " << to_cpp_type(sig.return_type) << " " << sig.name << "(";
+            auto decl_func = [&](const FuncSignature& sig, const std::vector<StmtPtr>& body) {
+                bool co = body_suspends(body);
+                os << "    " << to_cpp_return_type(sig.return_type, co) << " " << sig.name << "(";
                 for (size_t i = 0; i < sig.params.size(); ++i) {
                     if (i) os << ", ";
-                    os << to_cpp_type(sig.params[i].type) << " " << sig.params[i].name;
+                    os << to_cpp_param_type(sig.params[i].type, co) << " " << sig.params[i].name;
                 }
                 os << ");\n";
             };
-            for (const auto& r : n->requests) decl_func(r.sig);
-            for (const auto& f : n->private_funcs) decl_func(f.sig);
+            for (const auto& r : n->requests) decl_func(r.sig, r.body);
+            for (const auto& f : n->private_funcs) decl_func(f.sig, f.body);
+            for (const auto& r : n->requests) {
+                if (!r.idempotent) continue;
+                bool co = body_suspends(r.body);
+                os << "    Coalescer<" << n->name << ", " << to_cpp_return_type(r.sig.return_type, co);
+                for (const auto& prm : r.sig.params) os << ", " << to_cpp_param_type(prm.type, co);
+                os << "> __rivet_once_" << r.sig.name << "{this, &" << n->name << "::" << r.sig.name << ", \""
+                   << n->name << "." << r.sig.name << "\"};\n";
+            }
+
+            // Statically dispatched listeners with an inline body become methods.
+            if (ctx.static_dispatch()) {
+                for (const auto& tbl : ctx.tables) {
+                    for (size_t k = 0; k < tbl.edges.size(); ++k) {
+                        const auto& e = tbl.edges[k];
+                        if (e.owner != n->name || !e.decl->delegate_to.empty()) continue;
+                        os << "    void " << edge_method_name(tbl, k) << "(const " << to_cpp_type(tbl.type)
+                           << "& " << edge_param_name(*e.decl) << ");\n";
+                    }
+                }
+            }
 
             // Lifecycle / transition hooks
             os << "    void init();\n";
-            os << "    void onSystemChange(std::string sys_mode);\n";
+            os << "    void onSystemChange(ModeId sys_mode);\n";
             os << "    void onLocalChange();\n";
-            os << "    void set_state(const std::string& st);\n";
+            os << "    void set_state(ModeId st);\n";
             os << "    void __rivet_unsub_sys_listeners();\n";
             os << "    void __rivet_unsub_local_listeners();\n";
+            if (!listen_slots(ctx, node_modes).empty()) os << "    void __rivet_listen_modes();\n";
 
             os << "};\n";
             os << n->name << "* " << n->name << "_inst = nullptr;\n";
         }
     }
 
+    if (ctx.static_dispatch()) {
+        for (const auto& tbl : ctx.tables) {
+            for (size_t k = 0; k < tbl.edges.size(); ++k) {
+                const auto& e = tbl.edges[k];
+                std::string target = e.decl->delegate_to.empty() ? edge_method_name(tbl, k) : e.decl->delegate_to;
+                os << "\nvoid " << edge_thunk_name(tbl, k) << "(const Payload<" << to_cpp_type(tbl.type) << ">& val) {\n";
+                std::string gate = gate_check(ctx, *e.decl, e.owner + "_inst");
+                if (!gate.empty()) os << "    " << gate << "\n";
+                if (ctx.async_executor()) {
+                    os << "    " << e.owner << "_inst->post([msg = carry(val)] { " << e.owner << "_inst->" << target
+                       << "(unwrap(msg)); });\n";
+                } else {
+                    os << "    " << e.owner << "_inst->" << target << "(val.get());\n";
+                }
+                os << "}\n";
+            }
+        }
+    }
+
     // Pass 2: method definitions (after all classes exist).
     for (const auto& decl : p.decls) {
         if (auto n = std::get_if<NodeDecl>(&decl)) {
+            ctx.node = n->name;
+            ctx.node_log = node_log_floor(ctx, *n);
+            ctx.node_hosted = !ctx.remote_nodes.count(n->name);
             // Collect mode declarations for this node.
             std::vector<const ModeDecl*> node_modes;
             node_modes.reserve(p.decls.size());
@@ -376,176 +1282,688 @@ void generate_cpp(const Program& p, std::ostream& os) {
                 }
             }
 
-            auto is_system_mode = [&](const ModeDecl* m) -> bool {
-                if (!m) return false;
-                if (m->mode_name.text == "Init") return false;
-                if (m->mode_name.is_local_string) return false;
-                if (m->ignores_system) return false;
-                return system_modes.find(m->mode_name.text) != system_modes.end();
-            };
-            auto is_local_mode = [&](const ModeDecl* m) -> bool {
-                if (!m) return false;
-                if (m->mode_name.text == "Init") return false;
-                if (m->mode_name.is_local_string) return true;
-                if (m->ignores_system) return true;
-                return system_modes.find(m->mode_name.text) == system_modes.end();
+            auto timer_name = [&](int mi, size_t ti) {
+                return "m" + std::to_string(mi) + "_t" + std::to_string(ti);
             };
 
             auto sub_name = [&](int mi, int li) {
                 return std::string("__rivet_sub_m") + std::to_string(mi) + "_l" + std::to_string(li);
             };
 
+            const auto slots = listen_slots(ctx, node_modes);
+            const std::string listening = "this->__rivet_listening";
+
+            // Turns a mode block's listener on. `bulk`: a mode change, whose
+            // table already turned the plain (non-replay) listeners on.
             auto emit_subscribe = [&](const std::string& owner_node,
                                       const OnListenDecl& l,
                                       const std::string& subvar,
-                                      int depth) {
+                                      int depth,
+                                      bool bulk) {
                 auto indent = [&](int d) { for (int i = 0; i < d; ++i) os << "    "; };
                 std::string src = l.source_node.empty() ? owner_node : l.source_node;
 
+                // replay: remember how far the history went before subscribing, then feed
+                // those samples straight to the handler. This already runs on the node's
+                // executor, so replayed samples are handled before any queued live ones.
+                auto emit_replay = [&]() {
+                    indent(depth);
+                    std::string param = l.delegate_to.empty() ? edge_param_name(l) : "val";
+                    os << src << "_inst->" << l.topic_name << ".replay(" << subvar << "_upto, [this](const auto& "
+                       << param << ") {\n";
+                    if (l.delegate_to.empty()) {
+                        gen_stmts(ctx, l.body, os, depth + 1);
+                    } else {
+                        indent(depth + 1);
+                        os << "this->" << l.delegate_to << "(val);\n";
+                    }
+                    indent(depth);
+                    os << "});\n";
+                };
+                if (l.replay) {
+                    indent(depth);
+                    os << "const uint64_t " << subvar << "_upto = " << src << "_inst->" << l.topic_name
+                       << ".published();\n";
+                }
+
+                if (l.replay || !bulk) {
+                    indent(depth);
+                    if (ctx.static_dispatch()) os << edge_enable(ctx, l) << "\n";
+                    else os << listening << ".set(" << slots.at(&l) << ");\n";
+                }
+                if (l.replay) emit_replay();
+            };
+
+            // The subscription behind a mode block's listener, made once at
+            // init and delivering only while its bit is on.
+            auto emit_slot_subscription = [&](const OnListenDecl& l, int depth) {
+                auto indent = [&](int d) { for (int i = 0; i < d; ++i) os << "    "; };
+                std::string src = l.source_node.empty() ? n->name : l.source_node;
                 indent(depth);
-                os << "if (" << subvar << " == -1) " << subvar << " = "
-                   << src << "_inst->" << l.topic_name
-                   << ".subscribe([this](auto val) {\n";
+                os << src << "_inst->" << l.topic_name << ".subscribe([this](const auto& val) {\n";
+                std::string gate = gate_check(ctx, l, "this");
+                if (!gate.empty()) {
+                    indent(depth + 1);
+                    os << gate << "\n";
+                }
 
+                int body_depth = depth + 1;
+                if (ctx.async_executor()) {
+                    indent(depth + 1);
+                    os << "this->post([this, msg = carry(val)] {\n";
+                    indent(depth + 2);
+                    os << "const auto& val = unwrap(msg);\n";
+                    body_depth++;
+                }
                 if (l.delegate_to.empty()) {
-                    gen_stmts(l.body, os, depth + 1);
+                    gen_stmts(ctx, l.body, os, body_depth);
                 } else {
-                    indent(depth + 1);
+                    indent(body_depth);
                     os << "this->" << l.delegate_to << "(val);\n";
                 }
+                if (ctx.async_executor()) {
+                    indent(depth + 1);
+                    os << "});\n";
+                }
 
                 indent(depth);
-                os << "});\n";
+                os << "}, " << listening << ".slot(" << slots.at(&l) << "));\n";
             };
 
             auto gen_method = [&](const FuncSignature& sig, const std::vector<StmtPtr>& body) {
-                os << "\n" << to_cpp_type(sig.return_type) << " " << n->name << "::" << sig.name << "(";
+                bool co = body_suspends(body);
+                os << "\n" << to_cpp_return_type(sig.return_type, co) << " " << n->name << "::" << sig.name << "(";
                 for (size_t i = 0; i < sig.params.size(); ++i) {
                     if (i) os << ", ";
-                    os << to_cpp_type(sig.params[i].type) << " " << sig.params[i].name;
+                    os << param_attr(ctx) << to_cpp_param_type(sig.params[i].type, co) << " " << sig.params[i].name;
                 }
                 os << ") {\n";
-                gen_stmts(body, os, 1);
+                ctx.in_sequence = co;
+                gen_stmts(ctx, body, os, 1);
+                ctx.in_sequence = false;
                 bool has_return = false;
                 for (const auto& st : body) {
                     if (st && std::holds_alternative<ReturnStmt>(st->v)) { has_return = true; break; }
                 }
-                if (sig.return_type.base == ValType::Bool && !has_return) os << "    return true;\n";
+                if (!ctx.node_hosted) has_return = false;
+                if (sig.return_type.base == ValType::Bool && !has_return) os << (co ? "    co_return true;\n" : "    return true;\n");
+                else if (co && !has_return && to_cpp_type(sig.return_type) != "void") os << "    co_return {};\n";
+                else if (!has_return && !ctx.node_hosted) os << (co ? "    co_return;\n" : to_cpp_type(sig.return_type) != "void" ? "    return {};\n" : "");
                 os << "}\n";
             };
             for (const auto& r : n->requests) gen_method(r.sig, r.body);
             for (const auto& f : n->private_funcs) gen_method(f.sig, f.body);
 
+            if (ctx.static_dispatch()) {
+                for (const auto& tbl : ctx.tables) {
+                    for (size_t k = 0; k < tbl.edges.size(); ++k) {
+                        const auto& e = tbl.edges[k];
+                        if (e.owner != n->name || !e.decl->delegate_to.empty()) continue;
+                        os << "\nvoid " << n->name << "::" << edge_method_name(tbl, k) << "(" << param_attr(ctx) << "const "
+                           << to_cpp_type(tbl.type) << "& " << edge_param_name(*e.decl) << ") {\n";
+                        gen_stmts(ctx, e.decl->body, os, 1);
+                        os << "}\n";
+                    }
+                }
+            }
+
+            auto gen_timer_body = [&](const std::string& suffix, const EveryDecl& t) {
+                bool co = body_suspends(t.body);
+                os << "\n" << (co ? "Sequence<void> " : "void ") << n->name << "::__rivet_every_" << suffix << "() {\n";
+                ctx.in_sequence = co;
+                if (!ctx.node_hosted) os << (co ? "    co_return;\n" : "");
+                else if (t.delegate_to.empty()) gen_stmts(ctx, t.body, os, 1);
+                else os << "    this->" << t.delegate_to << "();\n";
+                ctx.in_sequence = false;
+                os << "}\n";
+            };
+            for (size_t ti = 0; ti < n->timers.size(); ++ti) gen_timer_body("n" + std::to_string(ti), n->timers[ti]);
+            for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
+                for (size_t ti = 0; ti < node_modes[mi]->timers.size(); ++ti)
+                    gen_timer_body(timer_name(mi, ti), node_modes[mi]->timers[ti]);
+            }
+
+            // Mode-scoped timers start and stop alongside the mode's listeners.
+            auto emit_timers_start = [&](int mi) {
+                const auto* m = node_modes[mi];
+                for (size_t ti = 0; ti < m->timers.size(); ++ti) {
+                    std::string label = n->name + "[" + m->mode_name.text + "] every " +
+                                        duration_text(m->timers[ti].period_ns);
+                    emit_timer_start(ctx, os, "this", timer_name(mi, ti), label, m->timers[ti], 2);
+                }
+            };
+            auto emit_timers_cancel = [&](int mi) {
+                for (size_t ti = 0; ti < node_modes[mi]->timers.size(); ++ti) {
+                    std::string id = "__rivet_timer_" + timer_name(mi, ti);
+                    os << "    if (" << id << ") { Timers::instance().cancel(" << id << "); " << id << " = 0; }\n";
+                }
+            };
+
+            // A mode body runs inline where the mode is entered, or as a
+            // coroutine started there when it awaits or waits.
+            auto gen_mode_body = [&](int mi) {
+                if (body_suspends(node_modes[mi]->body)) os << "        this->__rivet_mode_" << mi << "();\n";
+                else gen_stmts(ctx, node_modes[mi]->body, os, 2);
+            };
+            for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
+                if (!body_suspends(node_modes[mi]->body)) continue;
+                os << "\nSequence<void> " << n->name << "::__rivet_mode_" << mi << "() {\n";
+                ctx.in_sequence = true;
+                gen_stmts(ctx, node_modes[mi]->body, os, 1);
+                if (!ctx.node_hosted) os << "    co_return;\n";
+                ctx.in_sequence = false;
+                os << "}\n";
+            }
+
+            // Which mode-listener bits each system and local mode turns on, and
+            // which bits a change of either kind may touch. Listeners that
+            // replay are turned on by their block instead, after it has noted
+            // how far the history goes.
+            auto mode_mask = [&](auto&& in_mode) {
+                std::vector<uint64_t> words((slots.size() + 63) / 64);
+                for (const auto* m : node_modes)
+                    for (const auto& l : m->listeners)
+                        if (in_mode(m, l)) words[slots.at(&l) / 64] |= uint64_t(1) << (slots.at(&l) % 64);
+                std::ostringstream lit;
+                lit << "{" << std::hex;
+                for (size_t w = 0; w < words.size(); ++w) lit << (w ? ", " : "") << "0x" << words[w];
+                lit << "}";
+                return lit.str();
+            };
+            bool sys_slots = false, local_slots = false;
+            for (const auto* m : node_modes) {
+                sys_slots = sys_slots || (is_system_mode(ctx, m) && !m->listeners.empty() && !slots.empty());
+                local_slots = local_slots || (is_local_mode(ctx, m) && !m->listeners.empty() && !slots.empty());
+            }
+            const std::string set_type = "ListenSet<" + std::to_string(slots.size()) + ">::Mask";
+            const std::string tables = "__rivet_" + n->name;
+            if (sys_slots) {
+                os << "\nstatic constexpr " << set_type << " " << tables << "_sys_scope = "
+                   << mode_mask([&](const ModeDecl* m, const OnListenDecl&) { return is_system_mode(ctx, m); }) << ";\n";
+                os << "static constexpr " << set_type << " " << tables << "_sys_on[] = {\n";
+                for (const auto& name : ctx.sys_modes) {
+                    os << "    " << mode_mask([&](const ModeDecl* m, const OnListenDecl& l) {
+                        return is_system_mode(ctx, m) && m->mode_name.text == name && !l.replay;
+                    }) << ", // " << name << "\n";
+                }
+                os << "};\n";
+            }
+            if (local_slots) {
+                os << "\nstatic constexpr " << set_type << " " << tables << "_local_scope = "
+                   << mode_mask([&](const ModeDecl* m, const OnListenDecl&) { return is_local_mode(ctx, m); }) << ";\n";
+                os << "static constexpr " << set_type << " " << tables << "_local_on[] = {\n";
+                for (const auto& name : ctx.local_modes.at(n->name)) {
+                    os << "    " << mode_mask([&](const ModeDecl* m, const OnListenDecl& l) {
+                        return is_local_mode(ctx, m) && m->mode_name.text == name && !l.replay;
+                    }) << ", // " << name << "\n";
+                }
+                os << "};\n";
+            }
+
+            // --dispatch=static: the same masks over the topics' edge bits, one
+            // column per (topic, word) the node's mode listeners use.
+            struct EdgeWord {
+                size_t table = 0, word = 0;
+                uint64_t scope = 0;
+            };
+            auto edge_words = [&](bool system) {
+                std::vector<EdgeWord> words;
+                if (!ctx.static_dispatch()) return words;
+                for (const auto* m : node_modes) {
+                    if (!(system ? is_system_mode(ctx, m) : is_local_mode(ctx, m))) continue;
+                    for (const auto& l : m->listeners) {
+                        auto [ti, slot] = ctx.edge_slots.at(&l);
+                        auto it = std::find_if(words.begin(), words.end(), [&, ti = ti, slot = slot](const EdgeWord& w) {
+                            return w.table == ti && w.word == slot / 64;
+                        });
+                        if (it == words.end()) it = words.insert(words.end(), EdgeWord{ti, slot / 64, 0});
+                        it->scope |= uint64_t(1) << (slot % 64);
+                    }
+                }
+                return words;
+            };
+            auto emit_edge_table = [&](const std::string& name, const std::vector<EdgeWord>& words, bool system,
+                                       const std::vector<std::string>& modes) {
+                if (words.empty()) return;
+                os << "\nstatic constexpr uint64_t " << name << "[][" << words.size() << "] = {\n";
+                for (const auto& mode : modes) {
+                    std::vector<uint64_t> on(words.size());
+                    for (const auto* m : node_modes) {
+                        if (!(system ? is_system_mode(ctx, m) : is_local_mode(ctx, m)) || m->mode_name.text != mode) continue;
+                        for (const auto& l : m->listeners) {
+                            if (l.replay) continue;
+                            auto [ti, slot] = ctx.edge_slots.at(&l);
+                            for (size_t k = 0; k < words.size(); ++k)
+                                if (words[k].table == ti && words[k].word == slot / 64) on[k] |= uint64_t(1) << (slot % 64);
+                        }
+                    }
+                    os << "    {" << std::hex;
+                    for (size_t k = 0; k < on.size(); ++k) os << (k ? ", " : "") << "0x" << on[k];
+                    os << std::dec << "}, // " << mode << "\n";
+                }
+                os << "};\n";
+            };
+            // One masked flip per column on a mode change: edges on in both
+            // modes are never touched.
+            auto emit_edge_assign = [&](const std::string& name, const std::vector<EdgeWord>& words,
+                                        const std::string& subject) {
+                for (size_t k = 0; k < words.size(); ++k) {
+                    const auto& t = ctx.tables[words[k].table];
+                    os << "    " << t.src << "_inst->" << t.topic << ".assign(" << words[k].word << ", 0x" << std::hex
+                       << words[k].scope << std::dec << ", " << name << "[" << subject << "][" << k << "]);\n";
+                }
+            };
+            const auto sys_words = edge_words(true), local_words = edge_words(false);
+            emit_edge_table(tables + "_sys_edges", sys_words, true, ctx.sys_modes);
+            emit_edge_table(tables + "_local_edges", local_words, false, ctx.local_modes.at(n->name));
+
             // Unsubscribe helpers
             os << "\nvoid " << n->name << "::__rivet_unsub_sys_listeners() {\n";
             for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
                 const auto* m = node_modes[mi];
-                if (!is_system_mode(m)) continue;
-                for (int li = 0; li < (int)m->listeners.size(); ++li) {
-                    const auto& l = m->listeners[li];
-                    std::string src = l.source_node.empty() ? n->name : l.source_node;
-                    std::string sub = sub_name(mi, li);
-                    os << "    if (" << sub << " != -1) { "
-                       << src << "_inst->" << l.topic_name << ".unsubscribe(" << sub << "); "
-                       << sub << " = -1; }\n";
-                }
+                if (!is_system_mode(ctx, m)) continue;
+                emit_timers_cancel(mi);
             }
             os << "}\n";
 
             os << "\nvoid " << n->name << "::__rivet_unsub_local_listeners() {\n";
             for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
                 const auto* m = node_modes[mi];
-                if (!is_local_mode(m)) continue;
-                for (int li = 0; li < (int)m->listeners.size(); ++li) {
-                    const auto& l = m->listeners[li];
-                    std::string src = l.source_node.empty() ? n->name : l.source_node;
-                    std::string sub = sub_name(mi, li);
-                    os << "    if (" << sub << " != -1) { "
-                       << src << "_inst->" << l.topic_name << ".unsubscribe(" << sub << "); "
-                       << sub << " = -1; }\n";
-                }
+                if (!is_local_mode(ctx, m)) continue;
+                emit_timers_cancel(mi);
             }
             os << "}\n";
 
-            // init
+            // Called by main() before any node's init: a node may be moved to
+            // a mode by another's init before its own has run.
+            if (!slots.empty()) {
+                os << "\nvoid " << n->name << "::__rivet_listen_modes() {\n";
+                for (const auto* m : node_modes)
+                    for (const auto& l : m->listeners) emit_slot_subscription(l, 1);
+                os << "}\n";
+            }
+
+            // init. Nothing to clear first: the node starts with no mode timers
+            // or listeners, and those another node's init has already started
+            // by moving the system into a mode must be left running.
             os << "\nvoid " << n->name << "::init() {\n";
-            os << "    this->__rivet_unsub_sys_listeners();\n";
-            os << "    this->__rivet_unsub_local_listeners();\n";
             for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
                 const auto* m = node_modes[mi];
                 if (m->mode_name.text != "Init") continue;
                 for (int li = 0; li < (int)m->listeners.size(); ++li) {
-                    emit_subscribe(n->name, m->listeners[li], sub_name(mi, li), 2);
+                    emit_subscribe(n->name, m->listeners[li], sub_name(mi, li), 2, false);
                 }
-                gen_stmts(m->body, os, 2);
+                emit_timers_start(mi);
+                gen_mode_body(mi);
             }
             os << "}\n";
 
             // system change
-            os << "\nvoid " << n->name << "::onSystemChange(std::string sys_mode) {\n";
+            // One case per mode id, holding that mode's blocks in order; dense
+            // ids let the switch compile to a jump table.
+            auto emit_mode_switch = [&](const std::string& subject, bool system) {
+                std::vector<std::string> cases;
+                for (const auto* m : node_modes) {
+                    if (!(system ? is_system_mode(ctx, m) : is_local_mode(ctx, m))) continue;
+                    if (std::find(cases.begin(), cases.end(), m->mode_name.text) == cases.end())
+                        cases.push_back(m->mode_name.text);
+                }
+                if (cases.empty()) {
+                    os << "    (void)" << subject << ";\n";
+                    return;
+                }
+                os << "    switch (" << subject << ") {\n";
+                for (const auto& name : cases) {
+                    if (system) os << "    case SysMode::" << name << ": {\n";
+                    else os << "    case " << local_mode_id(ctx, n->name, name) << ": { // \"" << name << "\"\n";
+                    for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
+                        const auto* m = node_modes[mi];
+                        if (m->mode_name.text != name || !(system ? is_system_mode(ctx, m) : is_local_mode(ctx, m))) continue;
+                        for (int li = 0; li < (int)m->listeners.size(); ++li) {
+                            emit_subscribe(n->name, m->listeners[li], sub_name(mi, li), 2, true);
+                        }
+                        emit_timers_start(mi);
+                        gen_mode_body(mi);
+                    }
+                    os << "        break;\n    }\n";
+                }
+                os << "    default:\n        break;\n    }\n";
+            };
+
+            os << "\nvoid " << n->name << "::onSystemChange(ModeId sys_mode) {\n";
             if (n->ignores_system) {
                 os << "    (void)sys_mode;\n";
                 os << "    return;\n";
             } else {
                 os << "    this->__rivet_unsub_sys_listeners();\n";
-                for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
-                    const auto* m = node_modes[mi];
-                    if (!is_system_mode(m)) continue;
-                    os << "    if (sys_mode == \"" << m->mode_name.text << "\") {\n";
-                    for (int li = 0; li < (int)m->listeners.size(); ++li) {
-                        emit_subscribe(n->name, m->listeners[li], sub_name(mi, li), 2);
-                    }
-                    gen_stmts(m->body, os, 2);
-                    os << "    }\n";
-                }
+                if (sys_slots)
+                    os << "    " << listening << ".assign(" << tables << "_sys_scope, " << tables << "_sys_on[sys_mode]);\n";
+                emit_edge_assign(tables + "_sys_edges", sys_words, "sys_mode");
+                emit_mode_switch("sys_mode", true);
             }
             os << "}\n";
 
             // local change
             os << "\nvoid " << n->name << "::onLocalChange() {\n";
             os << "    this->__rivet_unsub_local_listeners();\n";
-            for (int mi = 0; mi < (int)node_modes.size(); ++mi) {
-                const auto* m = node_modes[mi];
-                if (!is_local_mode(m)) continue;
-                os << "    if (this->current_state == \"" << m->mode_name.text << "\") {\n";
-                for (int li = 0; li < (int)m->listeners.size(); ++li) {
-                    emit_subscribe(n->name, m->listeners[li], sub_name(mi, li), 2);
-                }
-                gen_stmts(m->body, os, 2);
-                os << "    }\n";
-            }
+            if (local_slots)
+                os << "    " << listening << ".assign(" << tables << "_local_scope, " << tables
+                   << "_local_on[this->current_state]);\n";
+            emit_edge_assign(tables + "_local_edges", local_words, "this->current_state");
+            emit_mode_switch("this->current_state", false);
             os << "}\n";
 
             // set_state
-            os << "\nvoid " << n->name << "::set_state(const std::string& st) {\n";
-            os << "    this->current_state = st;\n";
-            os << "    this->onLocalChange();\n";
+            os << "\nvoid " << n->name << "::set_state(ModeId st) {\n";
+            os << "    if (!this->__rivet_states.request(st)) return;\n";
+            os << "    do {\n";
+            os << "        this->current_state = st;\n";
+            os << "        this->onLocalChange();\n";
+            os << "    } while (this->__rivet_states.next(st));\n";
             os << "}\n";
         }
     }
+    if (ctx.deployed()) {
+        // Requests arriving from other processes: (node << 16 | request) as a
+        // varint, the request's schema hash, then its arguments. A transition
+        // is (node << 16 | RpcSetState) and the mode id; the system mode's
+        // messages start at RpcSystemMode.
+        os << "\nvoid __rivet_rpc_dispatch(WireReader& in) {\n";
+        os << "    const uint64_t id = in.varint();\n";
+        os << "    if (id >= RpcSystemMode) return SystemModeLink::receive(id - RpcSystemMode, in);\n";
+        os << "    switch (id) {\n";
+        for (const auto& rt : ctx.served_transitions) {
+            os << "    case " << (rt.node_index << 16) << " | RpcSetState: {\n";
+            os << "        const uint64_t m = in.varint();\n";
+            os << "        if (!in.done() || m >= " << ctx.local_modes[rt.target].size() << ")\n";
+            os << "            return RpcEndpoint::instance().reject(\"transition " << rt.target << "\");\n";
+            if (ctx.async_executor())
+                os << "        post_call(" << rt.target << "_inst, &" << rt.target << "::set_state, ModeId(m));\n";
+            else
+                os << "        " << rt.target << "_inst->set_state(ModeId(m));\n";
+            os << "        return;\n    }\n";
+        }
+        for (const auto& rc : ctx.served_calls) {
+            const auto& sig = rc.decl->sig;
+            std::string codec = request_codec(rc.target, sig.name);
+            os << "    case " << ((rc.node_index << 16) | rc.fn_index) << ": {\n";
+            os << "        " << codec << "::View a;\n";
+            os << "        if (in.fixed64() != " << codec << "::schema || !" << codec << "::decode(in, a) || !in.done())\n";
+            os << "            return RpcEndpoint::instance().reject(\"" << rc.target << "." << sig.name << "\");\n";
+            std::string args;
+            for (size_t i = 0; i < sig.params.size(); ++i) {
+                std::string a = "a." + sig.params[i].name;
+                if (sig.params[i].type.base == ValType::String) a = "std::string(" + a + ")";
+                args += (i ? ", " : "") + a;
+            }
+            if (rc.decl->idempotent)
+                os << "        " << rc.target << "_inst->__rivet_once_" << sig.name << ".call(nullptr"
+                   << (args.empty() ? "" : ", " + args) << ");\n";
+            else if (ctx.async_executor())
+                os << "        post_call(" << rc.target << "_inst, &" << rc.target << "::" << sig.name
+                   << (args.empty() ? "" : ", " + args) << ");\n";
+            else
+                os << "        " << rc.target << "_inst->" << sig.name << "(" << args << ");\n";
+            os << "        return;\n    }\n";
+        }
+        os << "    default:\n        return RpcEndpoint::instance().reject(\"an unknown request\");\n    }\n}\n";
+    }
+    if (ctx.recording()) {
+        // Replayed samples: decoded and published straight to the listeners.
+        os << "\nbool __rivet_inject(uint32_t topic, WireReader& in) {\n";
+        os << "    switch (topic) {\n";
+        for (size_t i = 0; i < ctx.recorded.size(); ++i) {
+            const auto& rt = ctx.recorded[i];
+            std::string codec = topic_codec(rt.owner, rt.decl->name);
+            std::string v = rt.decl->type.base == ValType::String ? "std::string(v)" : "v";
+            os << "    case " << i << ": {\n";
+            os << "        " << codec << "::View v;\n";
+            os << "        if (!" << codec << "::decode(in, v) || !in.done()) return false;\n";
+            os << "        " << rt.owner << "_inst->" << rt.decl->name << ".inject(" << v << ");\n";
+            os << "        return true;\n    }\n";
+        }
+        os << "    default:\n        return false;\n    }\n}\n";
+    }
     os << "\nint main() {\n";
+    // First, so SIGINT/SIGTERM are blocked before any executor thread starts.
+    os << "    EventLoop& loop = EventLoop::instance();\n";
+    if (ctx.deployed()) {
+        const auto& self = ctx.opts.deploy[ctx.opts.deploy_process];
+        if (!self.cpus.empty()) {
+            os << "    pin_to_cpus({";
+            for (size_t i = 0; i < self.cpus.size(); ++i) os << (i ? ", " : "") << self.cpus[i];
+            os << "});\n";
+        }
+        os << "    LogLine() << \"[DEPLOY] process " << self.name << ":";
+        for (const auto& n : self.nodes) os << " " << n;
+        os << "\";\n";
+    }
     for (const auto& decl : p.decls)
         if (auto n = std::get_if<NodeDecl>(&decl)) os << "    " << n->name << "_inst = new " << n->name << "();\n";
-    for (const auto& decl : p.decls) {
-        if (auto n = std::get_if<NodeDecl>(&decl)) {
-            if (!n->ignores_system) {
-                os << "    SystemManager::on_transition.push_back([](std::string m) { "
-                   << n->name << "_inst->onSystemChange(m); });\n";
+    if (ctx.recording()) {
+        // Before any init(): while replaying, the nodes' own publishes are dropped.
+        os << "    if (const char* path = std::getenv(\"RIVET_REPLAY\")) {\n";
+        os << "        if (!Replayer::instance().open(path, __rivet_topics, __rivet_topic_count, __rivet_inject)) return 1;\n";
+        os << "    } else if (const char* path = std::getenv(\"RIVET_RECORD\")) {\n";
+        os << "        if (!Recorder::instance().open(path, __rivet_topics, __rivet_topic_count)) return 1;\n";
+        os << "    }\n";
+    }
+    // With --transport=shm only the nodes this process hosts are started;
+    // `host` prefixes their start-up statements.
+    auto host = [&](const std::string& node) { return ctx.shm_transport() ? "if (host_" + node + ") " : std::string(); };
+    if (ctx.shm_transport()) {
+        for (const auto& decl : p.decls) {
+            auto n = std::get_if<NodeDecl>(&decl);
+            if (!n) continue;
+            if (ctx.deployed())
+                os << "    constexpr bool host_" << n->name << " = " << (ctx.remote_nodes.count(n->name) ? "false" : "true")
+                   << ";\n";
+            else
+                os << "    const bool host_" << n->name << " = Deployment::hosts(\"" << n->name << "\");\n";
+        }
+        os << "    ShmTransport& shm = ShmTransport::instance();\n";
+        os << "    shm.set_prefix(\"" << ctx.opts.program_name << "\");\n";
+        for (const auto& st : ctx.shared) {
+            std::string any_remote, any_local;
+            for (const auto& c : st.consumers) {
+                any_remote += (any_remote.empty() ? "" : " || ") + ("!host_" + c);
+                any_local += (any_local.empty() ? "" : " || ") + ("host_" + c);
             }
+            std::string ty = to_cpp_type(st.decl->type);
+            std::string topic = st.owner + "." + st.decl->name;
+            std::string inst = st.owner + "_inst->" + st.decl->name;
+            os << "    if (host_" << st.owner << " && (" << any_remote << ")) " << inst << ".export_to(shm.writer<" << ty
+               << ">(\"" << topic << "\", \"" << st.decl->path << "\"));\n";
+            os << "    if (!host_" << st.owner << " && (" << any_local << ")) shm.import<" << ty << ">(\"" << topic
+               << "\", \"" << st.decl->path << "\", " << (st.decl->latched || st.decl->history > 0 ? "true" : "false")
+               << ", [](const " << ty << "& v) { " << inst << ".publish(v); });\n";
+        }
+        if (ctx.deployed())
+            os << "    RpcEndpoint::instance().serve(RpcTarget(\"" << ctx.opts.program_name << "\", \""
+               << ctx.opts.deploy[ctx.opts.deploy_process].name << "\"), __rivet_rpc_dispatch);\n";
+        if (ctx.deployed() && ctx.opts.deploy.size() > 1) {
+            // The manifest's first process decides the system mode.
+            const auto& leader = ctx.opts.deploy.front();
+            if (ctx.opts.deploy_process == 0) {
+                os << "    SystemModeLink::lead({";
+                for (size_t i = 1; i < ctx.opts.deploy.size(); ++i)
+                    os << (i > 1 ? ", " : "") << "RpcTarget(\"" << ctx.opts.program_name << "\", \"" << ctx.opts.deploy[i].name
+                       << "\")";
+                os << "});\n";
+            } else {
+                os << "    SystemModeLink::follow(RpcTarget(\"" << ctx.opts.program_name << "\", \"" << leader.name << "\"), "
+                   << ctx.opts.deploy_process - 1 << ");\n";
+            }
+        }
+        // Without a manifest only topics are bridged; a request still calls
+        // the stand-in in this process.
+        for (const auto& [from, to] : ctx.deployed() ? decltype(request_edges(p)){} : request_edges(p)) {
+            os << "    if (host_" << from << " && !host_" << to << ") LogLine() << \"[SHM] warning: " << from
+               << " sends requests to " << to << ", which runs in another process; they stay in this one\";\n";
         }
     }
+    // Each node hears only about the system modes it has blocks for.
+    os << "    SystemManager::declare(SysMode::names, SysMode::Count);\n";
+    for (const auto& decl : p.decls) {
+        auto n = std::get_if<NodeDecl>(&decl);
+        if (!n || n->ignores_system) continue;
+        std::vector<std::string> handled;
+        for (const auto& d2 : p.decls) {
+            auto m = std::get_if<ModeDecl>(&d2);
+            if (!m || m->node_name != n->name || !is_system_mode(ctx, m)) continue;
+            if (std::find(handled.begin(), handled.end(), m->mode_name.text) == handled.end())
+                handled.push_back(m->mode_name.text);
+        }
+        if (handled.empty()) continue;
+        os << "    " << host(n->name) << "SystemManager::on(\"" << n->name << "\", {";
+        for (size_t i = 0; i < handled.size(); ++i) os << (i ? ", " : "") << "SysMode::" << handled[i];
+        os << "}, [](ModeId m) { " << n->name << "_inst->onSystemChange(m); }";
+        if (ctx.async_executor()) os << ",\n        [](std::function<void()> t) { " << n->name << "_inst->post(std::move(t)); }";
+        os << ");\n";
+    }
     for (const auto& decl : p.decls) {
         if (auto n = std::get_if<NodeDecl>(&decl)) {
+            ctx.node = n->name;
+            ctx.node_log = node_log_floor(ctx, *n);
+            ctx.node_hosted = !ctx.remote_nodes.count(n->name);
             for (const auto& l : n->listeners) {
-                os << "    " << (l.source_node.empty()?n->name:l.source_node) << "_inst->" << l.topic_name << ".subscribe([=](auto val) {\n";
-                if (l.delegate_to.empty()) gen_stmts(l.body, os, 2);
+                if (ctx.static_dispatch()) {
+                    os << "    " << host(n->name) << edge_enable(ctx, l) << "\n";
+                    continue;
+                }
+                os << "    " << host(n->name) << (l.source_node.empty()?n->name:l.source_node) << "_inst->" << l.topic_name << ".subscribe([=](const auto& val) {\n";
+                std::string gate = gate_check(ctx, l, n->name + "_inst");
+                if (!gate.empty()) os << "        " << gate << "\n";
+                if (ctx.async_executor()) {
+                    os << "        " << n->name << "_inst->post([msg = carry(val)] {\n";
+                    os << "            const auto& val = unwrap(msg);\n";
+                    if (l.delegate_to.empty()) gen_stmts(ctx, l.body, os, 3);
+                    else os << "            " << n->name << "_inst->" << l.delegate_to << "(val);\n";
+                    os << "        });\n";
+                } else if (l.delegate_to.empty()) gen_stmts(ctx, l.body, os, 2);
                 else os << "        " << n->name << "_inst->" << l.delegate_to << "(val);\n";
                 os << "    });\n";
             }
         }
     }
-    for (const auto& decl : p.decls)
-        if (auto n = std::get_if<NodeDecl>(&decl)) os << "    " << n->name << "_inst->init();\n";
-    os << "    std::cout << \"--- Rivet System Started ---\" << std::endl;\n";
-    os << "    while(true) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }\n    return 0;\n}\n";
+    // Mode-block listeners after the node-level ones, so a sample reaches the
+    // node-level listeners first.
+    for (const auto& decl : p.decls) {
+        auto n = std::get_if<NodeDecl>(&decl);
+        if (n && !listen_slots(ctx, node_mode_decls(p, n->name)).empty())
+            os << "    " << host(n->name) << n->name << "_inst->__rivet_listen_modes();\n";
+    }
+    if (ctx.opts.executor == ExecutorKind::Actor) {
+        for (const auto& decl : p.decls)
+            if (auto n = std::get_if<NodeDecl>(&decl)) os << "    " << host(n->name) << n->name << "_inst->start();\n";
+    }
+    if (ctx.opts.executor == ExecutorKind::Pool) {
+        os << "    Pool::instance().start(pool_worker_count());\n";
+        os << "    LogLine() << \"[POOL] \" << Pool::instance().worker_count() << \" workers\";\n";
+        os << "    const bool pool_stats = std::getenv(\"RIVET_POOL_STATS\") != nullptr;\n";
+    }
+    for (const auto& decl : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&decl)) {
+            if (ctx.async_executor()) os << "    " << host(n->name) << "post_call(" << n->name << "_inst, &" << n->name << "::init);\n";
+            else os << "    " << host(n->name) << n->name << "_inst->init();\n";
+        }
+    }
+    for (const auto& decl : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&decl)) {
+            if (n->timers.empty()) continue;
+            int depth = 1;
+            if (ctx.shm_transport()) {
+                os << "    if (host_" << n->name << ") {\n";
+                depth = 2;
+            }
+            for (size_t ti = 0; ti < n->timers.size(); ++ti) {
+                emit_timer_start(ctx, os, n->name + "_inst", "n" + std::to_string(ti),
+                                 n->name + " every " + duration_text(n->timers[ti].period_ns), n->timers[ti], depth);
+            }
+            if (ctx.shm_transport()) os << "    }\n";
+        }
+    }
+    if (features.timers) {
+        if (!ctx.simulated()) os << "    const bool timer_stats = std::getenv(\"RIVET_TIMER_STATS\") != nullptr;\n";
+        // The loop turns the timer wheel; it must spill, never wait, on a full mailbox.
+        if (ctx.async_executor()) os << "    Mailbox::executor_thread = true;\n";
+        os << "    Timers::instance().set_waker([] { EventLoop::instance().wake(); });\n";
+        os << "    loop.add_source([] { return Timers::instance().advance(); });\n";
+    }
+    if (features.coalesce) os << "    const bool request_stats = std::getenv(\"RIVET_REQUEST_STATS\") != nullptr;\n";
+    if (ctx.recording()) {
+        os << "    if (Recorder::mode == Recorder::Mode::Replay)\n";
+        os << "        loop.add_source([] { return Replayer::instance().advance(); });\n";
+    }
+    if (ctx.simulated()) {
+        // Last, so events posted by the other sources run in the same turn.
+        // No housekeeping tick: it would keep the virtual clock running forever.
+        os << "    loop.add_source([] { return Sim::instance().advance(); });\n";
+        os << "    LogLine() << \"--- Rivet System Started ---\";\n";
+        os << "    loop.run();\n";
+        os << "    LogLine() << \"[SIM] \" << Sim::instance().events() << \" events in \" << Clock::now_ns() / 1000000\n";
+        os << "              << \" ms of virtual time, shutting down\";\n";
+        os << "    SystemManager::set_mode(SysMode::Shutdown);\n";
+        os << "    if (!Sim::instance().drain(shutdown_timeout()))\n";
+        os << "        LogLine() << \"[SIM] events still queued after \" << shutdown_timeout().count() << \" ms\";\n";
+        if (ctx.recording()) {
+            os << "    if (Recorder::mode == Recorder::Mode::Record) Recorder::instance().close();\n";
+            os << "    if (Recorder::mode == Recorder::Mode::Replay) Replayer::instance().report(LogLine().stream());\n";
+        }
+        // No periodic tick in virtual time: report once, at the end.
+        if (features.coalesce) os << "    if (request_stats) CoalesceStats::dump(LogLine().stream());\n";
+        os << "    Rcu::collect();\n";
+        os << "    LogLine() << \"--- Rivet System Stopped ---\";\n";
+        os << "    Logger::instance().stop();\n";
+        os << "    return 0;\n}\n";
+        return;
+    }
+    os << "    const bool loop_stats = std::getenv(\"RIVET_LOOP_STATS\") != nullptr;\n";
+    os << "    unsigned long tick = 0;\n";
+    os << "    loop.every(100000000, [&] {\n";
+    os << "        ++tick;\n";
+    os << "        Rcu::collect();\n";
+    if (ctx.opts.executor == ExecutorKind::Pool) {
+        os << "        if (pool_stats && tick % 10 == 0) Pool::instance().dump_stats(LogLine().stream());\n";
+    }
+    if (features.timers) {
+        os << "        if (timer_stats && tick % 10 == 0) Timers::instance().dump_stats(LogLine().stream());\n";
+    }
+    if (features.coalesce) os << "        if (request_stats && tick % 10 == 0) CoalesceStats::dump(LogLine().stream());\n";
+    os << "        if (loop_stats && tick % 10 == 0) loop.dump_stats(LogLine().stream());\n";
+    if (ctx.shm_transport()) os << "        if (IpcStats::timing() && tick % 10 == 0) IpcStats::dump(LogLine().stream());\n";
+    os << "    });\n";
+    if (ctx.shm_transport()) os << "    shm.start(" << (ctx.async_executor() ? "false" : "true") << ");\n";
+    os << "    LogLine() << \"--- Rivet System Started ---\";\n";
+    os << "    const int sig = loop.run();\n";
+
+    // Orderly shutdown: timers stopped turning with the loop, so once the
+    // Shutdown reactions have been queued nothing new enters the mailboxes and
+    // they can be drained before the executors are joined.
+    os << "    LogLine() << \"[SYS] \" << signal_name(sig) << \", shutting down\";\n";
+    if (ctx.shm_transport()) os << "    shm.stop();\n";
+    // Each process shuts down on its own signal, without the others.
+    if (ctx.deployed()) os << "    SystemModeLink::detach();\n";
+    os << "    SystemManager::set_mode(SysMode::Shutdown);\n";
+    if (ctx.async_executor()) {
+        std::string base = ctx.opts.executor == ExecutorKind::Actor ? "Actor" : "PooledNode";
+        os << "    std::vector<" << base << "*> hosted;\n";
+        for (const auto& decl : p.decls)
+            if (auto n = std::get_if<NodeDecl>(&decl)) os << "    " << host(n->name) << "hosted.push_back(" << n->name << "_inst);\n";
+        os << "    if (!drain(hosted, shutdown_timeout()))\n";
+        os << "        LogLine() << \"[SYS] mailboxes still busy after \" << shutdown_timeout().count() << \" ms\";\n";
+    }
+    if (ctx.opts.executor == ExecutorKind::Actor) {
+        for (const auto& decl : p.decls)
+            if (auto n = std::get_if<NodeDecl>(&decl)) os << "    " << n->name << "_inst->stop();\n";
+    }
+    if (ctx.opts.executor == ExecutorKind::Pool) os << "    Pool::instance().stop();\n";
+    if (ctx.recording()) {
+        os << "    if (Recorder::mode == Recorder::Mode::Record) Recorder::instance().close();\n";
+        os << "    if (Recorder::mode == Recorder::Mode::Replay) Replayer::instance().report(LogLine().stream());\n";
+    }
+    os << "    Rcu::collect();\n";
+    os << "    LogLine() << \"--- Rivet System Stopped ---\";\n";
+    os << "    Logger::instance().stop();\n";
+    os << "    return 0;\n}\n";
 }
\ No newline at end of file
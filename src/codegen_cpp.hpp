@@ -1,6 +1,54 @@
 #pragma once
 #include "ast.hpp"
+#include "deploy.hpp"
 #include <ostream>
 
+// How generated node handlers are scheduled.
+enum class ExecutorKind {
+    Inline, // handlers run synchronously on the publisher's / caller's stack
+    Actor,  // every node owns a mailbox and a thread
+    Pool,   // every node owns a mailbox; a fixed work-stealing pool runs them
+    Sim,    // `--sim`: one thread, one event queue, virtual time
+};
+
+// How topics reach their listeners.
+enum class DispatchKind {
+    Dynamic, // std::function subscriber lists, swapped under RCU
+    Static,  // per-topic tables of direct calls fixed at generation time
+};
+
+// How topics cross process boundaries.
+enum class TransportKind {
+    Local, // one process; topics never leave it
+    Shm,   // topic paths map to shared-memory rings; RIVET_NODES picks a process's nodes
+};
+
+struct CppGenOptions {
+    ExecutorKind executor = ExecutorKind::Inline;
+    // Default mailbox capacity per node; a node's `{queue: N}` config overrides it.
+    int queue_depth = 1024;
+    DispatchKind dispatch = DispatchKind::Dynamic;
+    TransportKind transport = TransportKind::Local;
+    // Namespaces shared-memory segments and sockets; main() sets it to the script's stem.
+    std::string program_name = "rivet";
+    // `--deploy`: the manifest's processes and the one being generated. Its
+    // nodes are fixed at compile time; topics to other processes go over
+    // shared memory and requests to them through generated socket stubs.
+    std::vector<DeployProcess> deploy;
+    int deploy_process = -1;
+    // `--record`: every topic can be logged (RIVET_RECORD) and replayed (RIVET_REPLAY).
+    bool record = false;
+    // `--min-log-level`: `log` statements below it are not generated. A node's
+    // `{log: <level>}` config replaces it for that node. `print` is always kept.
+    LogLevel min_log_level = LogLevel::Debug;
+};
+
+// The schema hash of a topic's wire codec (`TopicWire_<node>_<topic>::schema`).
+uint64_t topic_schema(const std::string& node, const TopicDecl& t);
+
+// The -std= the generated code needs: c++20 when a body awaits or waits (it
+// becomes a coroutine), c++17 otherwise.
+const char* cpp_standard(const Program& p);
+
 // Generates a complete, single-file C++ application from the Rivet program.
-void generate_cpp(const Program& p, std::ostream& os);
\ No newline at end of file
+void generate_cpp(const Program& p, std::ostream& os, const CppGenOptions& opts = {});
@@ -0,0 +1,579 @@
+#include "columns.hpp"
+#include "codegen_cpp.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#if defined(_WIN32)
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Both formats are written in host byte order, as the runtime writes the raw log.
+
+// ---- Raw log (RIVET_RECORD), as laid out by the runtime's Recorder ----
+
+struct RawHeader {
+    char magic[8]; // "RIVETLOG"
+    uint32_t version;
+    uint32_t topics;
+    uint64_t data_offset;
+    uint64_t capacity;
+    uint64_t used;
+    int64_t started_ns;
+};
+
+struct RawRecord {
+    uint32_t size;
+    uint32_t topic;
+    int64_t time_ns;
+    uint64_t seq;
+};
+
+// ---- Columnar log ----
+//
+//   ColHeader
+//   column 0's blocks, column 1's blocks, ...
+//   per column: its index (one IndexEntry per block), then its name
+//   ColumnDir[columns] at directory_offset
+
+struct ColHeader {
+    char magic[8]; // "RIVETCOL"
+    uint32_t version;
+    uint32_t columns;
+    int64_t started_ns;
+    uint64_t directory_offset;
+};
+
+struct ColumnDir {
+    uint64_t schema;
+    uint32_t type; // ValType
+    uint32_t name_len;
+    uint64_t name_offset;
+    uint64_t index_offset;
+    uint64_t samples;
+    uint32_t blocks;
+    uint32_t reserved;
+    uint64_t bytes; // all of the column's blocks
+    int64_t first_ns;
+    int64_t last_ns;
+};
+
+struct IndexEntry {
+    int64_t first_ns;
+    uint64_t offset;
+};
+
+// Followed by `time_bytes` of timestamps, then `value_bytes` of values. min
+// and max hold int64s for int columns and double bits for float columns.
+struct BlockHeader {
+    int64_t first_ns;
+    int64_t last_ns;
+    uint64_t min;
+    uint64_t max;
+    uint32_t count;
+    uint32_t time_bytes;
+    uint32_t value_bytes;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(RawHeader) == 48 && sizeof(RawRecord) == 24, "raw log layout");
+static_assert(sizeof(ColHeader) == 32 && sizeof(ColumnDir) == 72 && sizeof(BlockHeader) == 48, "column layout");
+
+static constexpr uint32_t BlockSamples = 1024;
+
+static const char* type_name(ValType t) {
+    switch (t) {
+        case ValType::Int:    return "int";
+        case ValType::Float:  return "float";
+        case ValType::String: return "string";
+        case ValType::Bool:   return "bool";
+        default:              return "?";
+    }
+}
+
+// A whole file mapped read-only; only the pages a reader touches are loaded.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#if defined(_WIN32)
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error("Failed to open file: " + path);
+        copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        base = reinterpret_cast<const uint8_t*>(copy.data());
+        len = copy.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) ::close(fd);
+            throw std::runtime_error("Failed to open file: " + path);
+        }
+        len = (size_t)st.st_size;
+        void* m = len ? mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        ::close(fd);
+        if (m == MAP_FAILED) throw std::runtime_error("Failed to map file: " + path);
+        base = static_cast<const uint8_t*>(m);
+#endif
+    }
+    ~MappedFile() {
+#if !defined(_WIN32)
+        if (base) munmap(const_cast<uint8_t*>(base), len);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    size_t size() const { return len; }
+
+    // A `T` at `offset`, or nullptr if it would run past the end.
+    template <typename T>
+    const T* at(uint64_t offset, size_t count = 1) const {
+        if (offset > len || (len - offset) / sizeof(T) < count) return nullptr;
+        return reinterpret_cast<const T*>(base + offset);
+    }
+    const uint8_t* bytes(uint64_t offset, uint64_t n) const {
+        if (offset > len || len - offset < n) return nullptr;
+        return base + offset;
+    }
+
+private:
+    const uint8_t* base = nullptr;
+    size_t len = 0;
+#if defined(_WIN32)
+    std::vector<char> copy;
+#endif
+};
+
+static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static int64_t unzigzag(uint64_t z) { return (int64_t)(z >> 1) ^ -(int64_t)(z & 1); }
+
+static void put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += (char)(uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)(uint8_t)v;
+}
+
+// Bounds-checked reads over a payload or block body.
+class ByteReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool good = true;
+
+public:
+    ByteReader(const uint8_t* data, size_t n) : p(data), end(data + n) {}
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p == end) break;
+            uint8_t b = *p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        good = false;
+        return 0;
+    }
+    uint8_t byte() {
+        if (p == end) {
+            good = false;
+            return 0;
+        }
+        return *p++;
+    }
+    uint64_t fixed64() {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= (uint64_t)byte() << (8 * i);
+        return v;
+    }
+    std::string text() {
+        uint64_t n = varint();
+        if ((uint64_t)(end - p) < n) {
+            good = false;
+            return {};
+        }
+        std::string s(reinterpret_cast<const char*>(p), (size_t)n);
+        p += n;
+        return s;
+    }
+    bool ok() const { return good; }
+    bool done() const { return good && p == end; }
+};
+
+// One decoded sample. Ints and bools use `i`, floats `f`, strings `s`.
+struct Sample {
+    int64_t t = 0;
+    int64_t i = 0;
+    double f = 0;
+    std::string s;
+};
+
+// Decodes a raw record's payload (the topic's wire encoding).
+static bool decode_wire(ValType type, const uint8_t* data, size_t n, Sample& out) {
+    ByteReader r(data, n);
+    switch (type) {
+        case ValType::Int:    out.i = unzigzag(r.varint()); break;
+        case ValType::Bool:   out.i = r.byte() != 0; break;
+        case ValType::String: out.s = r.text(); break;
+        case ValType::Float: {
+            uint64_t bits = r.fixed64();
+            std::memcpy(&out.f, &bits, sizeof bits);
+            break;
+        }
+        default: return false;
+    }
+    return r.done();
+}
+
+// Collects one topic's samples, then sorts them by time and encodes them a
+// block at a time, so blocks never overlap and the index can be binary-searched.
+class ColumnBuilder {
+public:
+    std::string name;
+    uint64_t schema = 0;
+    ValType type = ValType::Int;
+    std::string data; // encoded blocks, offsets relative to the column's start
+    std::vector<IndexEntry> index;
+    uint64_t samples = 0;
+    uint64_t raw_bytes = 0; // what these samples took in the raw log
+    int64_t first_ns = 0, last_ns = 0;
+
+    void add(Sample s) { all.push_back(std::move(s)); }
+
+    void finish() {
+        // Publishers on different threads can claim log space slightly out of
+        // time order, and a late sample may belong several blocks back.
+        std::stable_sort(all.begin(), all.end(), [](const Sample& a, const Sample& b) { return a.t < b.t; });
+        for (size_t k = 0; k < all.size(); k += BlockSamples)
+            encode_block(std::span<const Sample>(all).subspan(k, std::min<size_t>(BlockSamples, all.size() - k)));
+        all.clear();
+        all.shrink_to_fit();
+    }
+
+private:
+    std::vector<Sample> all;
+
+    void encode_block(std::span<const Sample> block) {
+        BlockHeader h{};
+        h.first_ns = block.front().t;
+        h.last_ns = block.back().t;
+        h.count = (uint32_t)block.size();
+
+        std::string times;
+        int64_t prev_t = h.first_ns, prev_delta = 0;
+        for (size_t k = 1; k < block.size(); ++k) {
+            int64_t delta = block[k].t - prev_t;
+            put_varint(times, zigzag(delta - prev_delta));
+            prev_t = block[k].t;
+            prev_delta = delta;
+        }
+
+        std::string values;
+        if (type == ValType::Int) {
+            int64_t prev = 0, lo = block[0].i, hi = block[0].i;
+            for (const auto& s : block) {
+                put_varint(values, zigzag(s.i - prev));
+                prev = s.i;
+                lo = std::min(lo, s.i);
+                hi = std::max(hi, s.i);
+            }
+            h.min = (uint64_t)lo;
+            h.max = (uint64_t)hi;
+        } else if (type == ValType::Float) {
+            // XOR with the previous value: slowly changing signals leave the
+            // high bits zero (short varint) and round values leave the low bits
+            // zero (shifted out, count in the leading byte).
+            uint64_t prev = 0;
+            double lo = block[0].f, hi = block[0].f;
+            for (const auto& s : block) {
+                uint64_t bits;
+                std::memcpy(&bits, &s.f, sizeof bits);
+                uint64_t x = bits ^ prev;
+                prev = bits;
+                if (!x) {
+                    values += (char)64;
+                } else {
+                    int tz = std::countr_zero(x);
+                    values += (char)tz;
+                    put_varint(values, x >> tz);
+                }
+                lo = std::min(lo, s.f);
+                hi = std::max(hi, s.f);
+            }
+            std::memcpy(&h.min, &lo, sizeof lo);
+            std::memcpy(&h.max, &hi, sizeof hi);
+        } else if (type == ValType::Bool) {
+            for (const auto& s : block) values += (char)(s.i ? 1 : 0);
+        } else {
+            for (const auto& s : block) {
+                put_varint(values, s.s.size());
+                values += s.s;
+            }
+        }
+        h.time_bytes = (uint32_t)times.size();
+        h.value_bytes = (uint32_t)values.size();
+
+        if (index.empty()) first_ns = h.first_ns;
+        last_ns = h.last_ns;
+        index.push_back(IndexEntry{h.first_ns, (uint64_t)data.size()});
+        data.append(reinterpret_cast<const char*>(&h), sizeof h);
+        data += times;
+        data += values;
+        while (data.size() % 8) data += '\0'; // keep the next header aligned
+        samples += block.size();
+    }
+};
+
+template <typename T>
+static void write_pod(std::ostream& out, const T& v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof v);
+}
+
+void convert_to_columns(const std::string& raw_path, const std::string& out_path, const Program& p,
+                        std::ostream& report) {
+    MappedFile raw(raw_path);
+    const RawHeader* h = raw.at<RawHeader>(0);
+    if (!h || std::memcmp(h->magic, "RIVETLOG", 8) != 0 || h->version != 1)
+        throw std::runtime_error(raw_path + " is not a Rivet log");
+    const uint64_t* table = raw.at<uint64_t>(sizeof(RawHeader), h->topics);
+    if (!table || h->data_offset > raw.size()) throw std::runtime_error(raw_path + ": truncated topic table");
+
+    // Columns in the program's declaration order; raw topics map onto them by schema.
+    std::vector<ColumnBuilder> cols;
+    std::unordered_map<uint64_t, size_t> by_schema;
+    for (const auto& d : p.decls) {
+        auto n = std::get_if<NodeDecl>(&d);
+        if (!n) continue;
+        for (const auto& t : n->topics) {
+            if (t.type.base == ValType::Custom) continue;
+            ColumnBuilder c;
+            c.name = n->name + "." + t.name;
+            c.schema = topic_schema(n->name, t);
+            c.type = t.type.base;
+            by_schema[c.schema] = cols.size();
+            cols.push_back(std::move(c));
+        }
+    }
+    std::vector<int> col_of(h->topics, -1);
+    for (uint32_t i = 0; i < h->topics; ++i)
+        if (auto it = by_schema.find(table[i]); it != by_schema.end()) col_of[i] = (int)it->second;
+
+    // A log the recorder never closed ends at its first empty record.
+    uint64_t end = raw.size() - h->data_offset;
+    if (h->used) end = std::min(end, h->used);
+    uint64_t skipped = 0, malformed = 0;
+    for (uint64_t pos = 0; pos + sizeof(RawRecord) <= end;) {
+        const RawRecord* rec = raw.at<RawRecord>(h->data_offset + pos);
+        if (rec->size < sizeof(RawRecord) || pos + rec->size > end) break;
+        const uint64_t stride = (rec->size + 7) & ~uint64_t(7);
+        pos += stride;
+        int c = rec->topic < col_of.size() ? col_of[rec->topic] : -1;
+        if (c < 0) {
+            ++skipped;
+            continue;
+        }
+        Sample s;
+        s.t = rec->time_ns;
+        const uint8_t* payload = raw.bytes(h->data_offset + pos - stride + sizeof(RawRecord), rec->size - sizeof(RawRecord));
+        if (!decode_wire(cols[c].type, payload, rec->size - sizeof(RawRecord), s)) {
+            ++malformed;
+            continue;
+        }
+        cols[c].raw_bytes += stride;
+        cols[c].add(std::move(s));
+    }
+    for (auto& c : cols) c.finish();
+
+    std::ofstream out(out_path, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("Failed to create file: " + out_path);
+    ColHeader ch{};
+    std::memcpy(ch.magic, "RIVETCOL", 8);
+    ch.version = 1;
+    ch.columns = (uint32_t)cols.size();
+    ch.started_ns = h->started_ns;
+    write_pod(out, ch);
+    uint64_t offset = sizeof ch;
+    std::vector<ColumnDir> dir(cols.size());
+    for (size_t k = 0; k < cols.size(); ++k) {
+        out.write(cols[k].data.data(), (std::streamsize)cols[k].data.size());
+        for (auto& e : cols[k].index) e.offset += offset;
+        dir[k].bytes = cols[k].data.size();
+        offset += cols[k].data.size();
+    }
+    for (size_t k = 0; k < cols.size(); ++k) {
+        const auto& c = cols[k];
+        ColumnDir& d = dir[k];
+        d.schema = c.schema;
+        d.type = (uint32_t)c.type;
+        d.samples = c.samples;
+        d.blocks = (uint32_t)c.index.size();
+        d.first_ns = c.first_ns;
+        d.last_ns = c.last_ns;
+        d.index_offset = offset;
+        out.write(reinterpret_cast<const char*>(c.index.data()), (std::streamsize)(c.index.size() * sizeof(IndexEntry)));
+        offset += c.index.size() * sizeof(IndexEntry);
+        d.name_offset = offset;
+        d.name_len = (uint32_t)c.name.size();
+        out << c.name;
+        offset += c.name.size();
+        while (offset % 8) {
+            out.put('\0');
+            ++offset;
+        }
+    }
+    ch.directory_offset = offset;
+    out.write(reinterpret_cast<const char*>(dir.data()), (std::streamsize)(dir.size() * sizeof(ColumnDir)));
+    out.seekp(0);
+    write_pod(out, ch);
+    if (!out) throw std::runtime_error("Failed to write file: " + out_path);
+
+    uint64_t raw_total = 0, col_total = 0;
+    for (const auto& c : cols) {
+        if (!c.samples) continue;
+        uint64_t col_bytes = c.data.size() + c.index.size() * sizeof(IndexEntry);
+        report << c.name << ": " << c.samples << " samples, " << c.raw_bytes << " -> " << col_bytes << " bytes\n";
+        raw_total += c.raw_bytes;
+        col_total += col_bytes;
+    }
+    report << "Columns: " << raw_total << " -> " << col_total << " bytes";
+    if (col_total) report << " (" << std::fixed << std::setprecision(1) << (double)raw_total / (double)col_total << "x)";
+    report << "\n";
+    if (skipped) report << skipped << " samples of topics this program does not declare were skipped\n";
+    if (malformed) report << malformed << " samples failed to decode\n";
+}
+
+// An opened columnar log: the header and directory, checked against the file size.
+class ColumnFile {
+public:
+    explicit ColumnFile(const std::string& path) : file(path), path(path) {
+        hdr = file.at<ColHeader>(0);
+        if (!hdr || std::memcmp(hdr->magic, "RIVETCOL", 8) != 0 || hdr->version != 1)
+            throw std::runtime_error(path + " is not a columnar Rivet log");
+        dir = file.at<ColumnDir>(hdr->directory_offset, hdr->columns);
+        if (!dir) throw std::runtime_error(path + ": truncated column directory");
+    }
+
+    const ColHeader& header() const { return *hdr; }
+    uint32_t count() const { return hdr->columns; }
+    const ColumnDir& column(uint32_t k) const { return dir[k]; }
+
+    std::string name(const ColumnDir& d) const {
+        const uint8_t* p = file.bytes(d.name_offset, d.name_len);
+        if (!p) throw std::runtime_error(path + ": truncated column name");
+        return std::string(reinterpret_cast<const char*>(p), d.name_len);
+    }
+
+    const IndexEntry* index(const ColumnDir& d) const {
+        const IndexEntry* idx = file.at<IndexEntry>(d.index_offset, d.blocks);
+        if (!idx && d.blocks) throw std::runtime_error(path + ": truncated block index");
+        return idx;
+    }
+
+    // Decodes one block into `out`.
+    void read_block(const ColumnDir& d, uint64_t offset, std::vector<Sample>& out) const {
+        const BlockHeader* b = file.at<BlockHeader>(offset);
+        const uint8_t* body = b ? file.bytes(offset + sizeof *b, (uint64_t)b->time_bytes + b->value_bytes) : nullptr;
+        if (!body) throw std::runtime_error(path + ": truncated block");
+        out.assign(b->count, Sample{});
+        ByteReader times(body, b->time_bytes);
+        ByteReader values(body + b->time_bytes, b->value_bytes);
+        int64_t t = b->first_ns, delta = 0;
+        uint64_t prev = 0;
+        for (uint32_t k = 0; k < b->count; ++k) {
+            Sample& s = out[k];
+            if (k) {
+                delta += unzigzag(times.varint());
+                t += delta;
+            }
+            s.t = t;
+            switch ((ValType)d.type) {
+                case ValType::Int:
+                    prev += (uint64_t)unzigzag(values.varint());
+                    s.i = (int64_t)prev;
+                    break;
+                case ValType::Float: {
+                    int tz = values.byte();
+                    if (tz < 64) prev ^= values.varint() << tz;
+                    std::memcpy(&s.f, &prev, sizeof prev);
+                    break;
+                }
+                case ValType::Bool: s.i = values.byte(); break;
+                default: s.s = values.text(); break;
+            }
+        }
+        if (!times.done() || !values.done()) throw std::runtime_error(path + ": corrupt block");
+    }
+
+private:
+    MappedFile file;
+    std::string path;
+    const ColHeader* hdr = nullptr;
+    const ColumnDir* dir = nullptr;
+};
+
+static void print_value(std::ostream& os, ValType type, const Sample& s) {
+    switch (type) {
+        case ValType::Int:   os << s.i; break;
+        case ValType::Float: os << s.f; break;
+        case ValType::Bool:  os << (s.i ? "true" : "false"); break;
+        default: {
+            os << '"';
+            for (char c : s.s) os << (c == '"' ? "\"\"" : std::string(1, c));
+            os << '"';
+        }
+    }
+}
+
+void describe_columns(const std::string& path, std::ostream& os) {
+    ColumnFile f(path);
+    const int64_t start = f.header().started_ns;
+    for (uint32_t k = 0; k < f.count(); ++k) {
+        const ColumnDir& d = f.column(k);
+        os << f.name(d) << " : " << type_name((ValType)d.type) << ": " << d.samples << " samples in " << d.blocks
+           << " blocks, " << d.bytes << " bytes";
+        if (d.samples) os << ", " << (d.first_ns - start) << ".." << (d.last_ns - start) << " ns";
+        os << "\n";
+    }
+}
+
+void extract_column(const std::string& path, const std::string& topic, int64_t from_ns, int64_t to_ns,
+                    std::ostream& os) {
+    ColumnFile f(path);
+    const ColumnDir* d = nullptr;
+    for (uint32_t k = 0; k < f.count() && !d; ++k)
+        if (f.name(f.column(k)) == topic) d = &f.column(k);
+    if (!d) throw std::runtime_error(path + " has no column '" + topic + "'");
+
+    const ValType type = (ValType)d->type;
+    const int64_t start = f.header().started_ns;
+    const int64_t from = start + from_ns, to = to_ns == INT64_MAX ? INT64_MAX : start + to_ns;
+    const IndexEntry* idx = f.index(*d);
+    // The last block starting at or before `from` may still hold samples from it on.
+    size_t k = std::upper_bound(idx, idx + d->blocks, from, [](int64_t t, const IndexEntry& e) { return t < e.first_ns; }) - idx;
+    if (k > 0) --k;
+    os << std::setprecision(std::numeric_limits<double>::max_digits10); // floats round-trip
+    os << "time_ns," << topic << "\n";
+    std::vector<Sample> samples;
+    for (; k < d->blocks && idx[k].first_ns < to; ++k) {
+        f.read_block(*d, idx[k].offset, samples);
+        for (const auto& s : samples) {
+            if (s.t < from || s.t >= to) continue;
+            os << (s.t - start) << ",";
+            print_value(os, type, s);
+            os << "\n";
+        }
+    }
+}
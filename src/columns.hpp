@@ -0,0 +1,27 @@
+#pragma once
+#include "ast.hpp"
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Columnar form of a `--record` log. Every topic becomes its own column of
+// fixed-size blocks; each block starts with its time range, sample count and
+// min/max, and each column has a sparse index of block start times, so a seek
+// or a one-topic extract maps the file and reads only the blocks it needs.
+// Timestamps are stored as delta-of-delta varints, ints as delta varints and
+// floats as the XOR with the previous value.
+
+// Converts the raw log at `raw_path` into a columnar log at `out_path`. The
+// program supplies the topics' names and types; samples of topics it does not
+// declare (by schema hash) are skipped. Prints a per-column size report.
+// Throws std::runtime_error on unreadable or malformed input.
+void convert_to_columns(const std::string& raw_path, const std::string& out_path, const Program& p,
+                        std::ostream& report);
+
+// Lists the columns of a columnar log.
+void describe_columns(const std::string& path, std::ostream& os);
+
+// Prints `time_ns,value` for the samples of `topic` ("Node.topic") recorded in
+// [from_ns, to_ns), both offsets from the start of the recording.
+void extract_column(const std::string& path, const std::string& topic, int64_t from_ns, int64_t to_ns,
+                    std::ostream& os);
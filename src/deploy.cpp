@@ -0,0 +1,81 @@
+#include "deploy.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+static std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    size_t e = s.find_last_not_of(" \t\r");
+    return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+}
+
+static bool is_ident(const std::string& s) {
+    if (s.empty() || !(std::isalpha((unsigned char)s[0]) || s[0] == '_')) return false;
+    return std::all_of(s.begin(), s.end(), [](char c) { return std::isalnum((unsigned char)c) || c == '_' || c == '-'; });
+}
+
+std::vector<DeployProcess> load_deploy_manifest(const std::string& path, const Program& p) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Failed to open deployment manifest: " + path);
+
+    std::vector<DeployProcess> procs;
+    std::unordered_map<std::string, int> placed; // node -> manifest line
+    auto fail = [&](int line, const std::string& msg) {
+        throw std::runtime_error(path + ":" + std::to_string(line) + ": " + msg);
+    };
+
+    std::string raw;
+    for (int line = 1; std::getline(in, raw); ++line) {
+        std::string text = trim(raw.substr(0, raw.find('#')));
+        if (text.empty()) continue;
+        bool indented = raw[0] == ' ' || raw[0] == '\t';
+        if (!indented) {
+            std::istringstream ss(text);
+            std::string kw, name, opt;
+            ss >> kw >> name;
+            if (kw != "process" || !is_ident(name)) fail(line, "expected 'process <name> [cpus=N,M,...]'");
+            for (const auto& other : procs)
+                if (other.name == name) fail(line, "process '" + name + "' is declared twice");
+            DeployProcess proc;
+            proc.name = name;
+            while (ss >> opt) {
+                if (opt.rfind("cpus=", 0) != 0) fail(line, "unknown process option '" + opt + "'");
+                std::stringstream list(opt.substr(5));
+                std::string cpu;
+                while (std::getline(list, cpu, ',')) {
+                    if (cpu.empty() || cpu.find_first_not_of("0123456789") != std::string::npos)
+                        fail(line, "bad CPU number '" + cpu + "'");
+                    proc.cpus.push_back(std::stoi(cpu));
+                }
+            }
+            procs.push_back(std::move(proc));
+            continue;
+        }
+        if (procs.empty()) fail(line, "node list before any 'process' line");
+        std::replace(text.begin(), text.end(), ',', ' ');
+        std::istringstream ss(text);
+        std::string node;
+        while (ss >> node) {
+            bool known = false;
+            for (const auto& d : p.decls)
+                if (auto n = std::get_if<NodeDecl>(&d); n && n->name == node) known = true;
+            if (!known) fail(line, "unknown node '" + node + "'");
+            if (auto it = placed.find(node); it != placed.end())
+                fail(line, "node '" + node + "' is already placed on line " + std::to_string(it->second));
+            placed[node] = line;
+            procs.back().nodes.push_back(node);
+        }
+    }
+
+    if (procs.empty()) throw std::runtime_error(path + ": no processes declared");
+    for (const auto& proc : procs)
+        if (proc.nodes.empty()) throw std::runtime_error(path + ": process '" + proc.name + "' hosts no nodes");
+    for (const auto& d : p.decls)
+        if (auto n = std::get_if<NodeDecl>(&d); n && !placed.count(n->name))
+            throw std::runtime_error(path + ": node '" + n->name + "' is not placed in any process");
+    return procs;
+}
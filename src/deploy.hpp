@@ -0,0 +1,24 @@
+#pragma once
+#include "ast.hpp"
+#include <string>
+#include <vector>
+
+// One executable of a `--deploy` split: the nodes it hosts and the CPUs its
+// threads are pinned to.
+struct DeployProcess {
+    std::string name;
+    std::vector<std::string> nodes;
+    std::vector<int> cpus; // empty = not pinned
+};
+
+// Reads a deployment manifest:
+//
+//   # perception runs on its own cores
+//   process perception cpus=0,1
+//     Sensor, Fusion
+//   process control cpus=2
+//     Planner
+//
+// Every node of the program must be placed in exactly one process. Throws
+// std::runtime_error naming the manifest line on any problem.
+std::vector<DeployProcess> load_deploy_manifest(const std::string& path, const Program& p);
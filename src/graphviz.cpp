@@ -41,6 +41,8 @@ static void scan_stmt_for_edges(const StmtPtr& sp,
     if (auto req = std::get_if<RequestStmt>(&sp->v)) {
         os << "    " << current_node_name << " -> " << req->target_node
            << " [style=dashed, label=\"" << req->func_name << "\"];\n";
+        scan_stmts_for_edges(req->on_reply, current_node_name, os);
+        scan_stmts_for_edges(req->on_timeout, current_node_name, os);
         return;
     }
     if (auto ifs = std::get_if<IfStmt>(&sp->v)) {
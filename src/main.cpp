@@ -6,12 +6,16 @@
 #include "validate.hpp"
 #include "graphviz.hpp"
 #include "codegen_cpp.hpp"
+#include "deploy.hpp"
+#include "columns.hpp"
 
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <cstdlib>
 #include <cstring>
+#include <cstdint>
 
 static std::string read_file(const std::string& path) {
     std::ifstream file(path, std::ios::in | std::ios::binary);
@@ -21,9 +25,27 @@ static std::string read_file(const std::string& path) {
     return ss.str();
 }
 
+// `--from=` / `--to=` offsets: an integer with an ns, us, ms or s suffix.
+static bool parse_offset(const char* text, int64_t& out) {
+    char* end = nullptr;
+    long long v = std::strtoll(text, &end, 10);
+    if (end == text || v < 0) return false;
+    std::string unit = end;
+    int64_t scale = 0;
+    if (unit == "ns") scale = 1;
+    else if (unit == "us") scale = 1000;
+    else if (unit == "ms") scale = 1000000;
+    else if (unit == "s") scale = 1000000000;
+    if (!scale) return false;
+    out = (int64_t)v * scale;
+    return true;
+}
+
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::cerr << "Usage: rivet <file.rv> [--graph | --show | --cpp]\n";
+        std::cerr << "Usage: rivet <file.rv> [--graph | --show | --cpp] [--executor=inline|actor|pool] [--queue-depth=N] [--dispatch=dynamic|static] [--transport=local|shm] [--deploy <manifest>] [--record] [--sim] [--min-log-level=debug|info|warn|error]\n"
+                  << "       rivet <file.rv> --columns <raw.log>\n"
+                  << "       rivet <file.rv> --extract <log.col> [Node.topic] [--from=<t>] [--to=<t>]\n";
         return 1;
     }
 
@@ -32,13 +54,69 @@ int main(int argc, char** argv) {
     bool raw_dot_mode = false;
     bool auto_show_mode = false;
     bool cpp_mode = false;
+    CppGenOptions cpp_opts;
+    std::string manifest;
+    std::string raw_log, column_log, extract_topic;
+    int64_t from_ns = 0, to_ns = INT64_MAX;
 
     for (int i = 2; i < argc; ++i) {
         if (std::strcmp(argv[i], "--graph") == 0) raw_dot_mode = true;
         else if (std::strcmp(argv[i], "--show") == 0) auto_show_mode = true;
         else if (std::strcmp(argv[i], "--cpp") == 0) cpp_mode = true;
+        else if (std::strcmp(argv[i], "--executor=inline") == 0) cpp_opts.executor = ExecutorKind::Inline;
+        else if (std::strcmp(argv[i], "--executor=actor") == 0) cpp_opts.executor = ExecutorKind::Actor;
+        else if (std::strcmp(argv[i], "--executor=pool") == 0) cpp_opts.executor = ExecutorKind::Pool;
+        else if (std::strcmp(argv[i], "--dispatch=dynamic") == 0) cpp_opts.dispatch = DispatchKind::Dynamic;
+        else if (std::strcmp(argv[i], "--dispatch=static") == 0) cpp_opts.dispatch = DispatchKind::Static;
+        else if (std::strcmp(argv[i], "--transport=local") == 0) cpp_opts.transport = TransportKind::Local;
+        else if (std::strcmp(argv[i], "--transport=shm") == 0) cpp_opts.transport = TransportKind::Shm;
+        else if (std::strcmp(argv[i], "--record") == 0) cpp_opts.record = true;
+        else if (std::strcmp(argv[i], "--sim") == 0) cpp_opts.executor = ExecutorKind::Sim;
+        else if (std::strcmp(argv[i], "--deploy") == 0 && i + 1 < argc) manifest = argv[++i];
+        else if (std::strncmp(argv[i], "--deploy=", 9) == 0) manifest = argv[i] + 9;
+        else if (std::strcmp(argv[i], "--columns") == 0 && i + 1 < argc) raw_log = argv[++i];
+        else if (std::strcmp(argv[i], "--extract") == 0 && i + 1 < argc) {
+            column_log = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') extract_topic = argv[++i];
+        }
+        else if (std::strncmp(argv[i], "--from=", 7) == 0 || std::strncmp(argv[i], "--to=", 5) == 0) {
+            bool from = argv[i][2] == 'f';
+            const char* v = std::strchr(argv[i], '=') + 1;
+            if (!parse_offset(v, from ? from_ns : to_ns)) {
+                std::cerr << "Invalid " << (from ? "--from" : "--to") << " value: " << v << "\n";
+                return 1;
+            }
+        }
+        else if (std::strncmp(argv[i], "--min-log-level=", 16) == 0) {
+            std::string v = argv[i] + 16;
+            if (v == "debug") cpp_opts.min_log_level = LogLevel::Debug;
+            else if (v == "info") cpp_opts.min_log_level = LogLevel::Info;
+            else if (v == "warn") cpp_opts.min_log_level = LogLevel::Warn;
+            else if (v == "error") cpp_opts.min_log_level = LogLevel::Error;
+            else {
+                std::cerr << "Invalid --min-log-level value: " << v << "\n";
+                return 1;
+            }
+        }
+        else if (std::strncmp(argv[i], "--queue-depth=", 14) == 0) {
+            int d = std::atoi(argv[i] + 14);
+            if (d <= 0) {
+                std::cerr << "Invalid --queue-depth value: " << (argv[i] + 14) << "\n";
+                return 1;
+            }
+            cpp_opts.queue_depth = d;
+        }
+    }
+
+    if (cpp_opts.executor == ExecutorKind::Sim && (cpp_opts.transport == TransportKind::Shm || !manifest.empty())) {
+        std::cerr << "--sim runs the whole program in one process; it cannot be combined with --transport=shm or --deploy\n";
+        return 1;
     }
 
+    std::string stem = filename.substr(filename.find_last_of("/\\") + 1);
+    if (stem.size() > 3 && stem.compare(stem.size() - 3, 3, ".rv") == 0) stem.resize(stem.size() - 3);
+    if (!stem.empty()) cpp_opts.program_name = stem;
+
     try {
         Source src(filename, read_file(filename));
         DiagnosticEngine diag(src);
@@ -57,14 +135,38 @@ int main(int argc, char** argv) {
         if (!validate_program(p, diag)) {
             return 2;
         }
+        if (cpp_mode && !manifest.empty()) {
+            cpp_opts.deploy = load_deploy_manifest(manifest, p);
+            if (!validate_deployment(p, cpp_opts.deploy, diag)) return 2;
+        }
 
         // 3. Output
-        if (cpp_mode) {
+        if (!raw_log.empty()) {
+            std::string out_name = raw_log + ".col";
+            convert_to_columns(raw_log, out_name, p, std::cout);
+            std::cout << "Wrote columns: " << out_name << "\n";
+        }
+        else if (!column_log.empty()) {
+            if (extract_topic.empty()) describe_columns(column_log, std::cout);
+            else extract_column(column_log, extract_topic, from_ns, to_ns, std::cout);
+        }
+        else if (cpp_mode && !manifest.empty()) {
+            cpp_opts.transport = TransportKind::Shm;
+            for (size_t i = 0; i < cpp_opts.deploy.size(); ++i) {
+                cpp_opts.deploy_process = (int)i;
+                std::string out_name = filename + "." + cpp_opts.deploy[i].name + ".cpp";
+                std::ofstream out(out_name);
+                generate_cpp(p, out, cpp_opts);
+                std::cout << "Generated C++: " << out_name << "\n";
+            }
+            std::cout << "Compile each with: g++ <file> -o <process> -std=" << cpp_standard(p) << " -pthread\n";
+        }
+        else if (cpp_mode) {
             std::string out_name = filename + ".cpp";
             std::ofstream out(out_name);
-            generate_cpp(p, out);
+            generate_cpp(p, out, cpp_opts);
             std::cout << "Generated C++: " << out_name << "\n";
-            std::cout << "Compile with: g++ " << out_name << " -o app -std=c++17\n";
+            std::cout << "Compile with: g++ " << out_name << " -o app -std=" << cpp_standard(p) << " -pthread\n";
         }
         else if (raw_dot_mode) {
             generate_dot(p, std::cout);
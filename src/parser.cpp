@@ -73,6 +73,28 @@ ModeName Parser::parse_mode_name(const char* msg) {
     return m;
 }
 
+// <int><unit> with unit one of ns, us, ms, s (e.g. `20ms`); returns nanoseconds.
+int64_t Parser::parse_duration_ns(const char* msg) {
+    if (cur_.kind != TokenKind::Int) {
+        diag_.error(cur_.loc, msg);
+        return 0;
+    }
+    int64_t n = std::stoll(std::string(cur_.lexeme));
+    advance();
+    std::string unit = cur_.kind == TokenKind::Ident ? std::string(cur_.lexeme) : std::string();
+    int64_t scale = 0;
+    if (unit == "ns") scale = 1;
+    else if (unit == "us") scale = 1000;
+    else if (unit == "ms") scale = 1000000;
+    else if (unit == "s") scale = 1000000000;
+    if (!scale) {
+        diag_.error(cur_.loc, "Expected time unit (ns, us, ms or s)");
+        return 0;
+    }
+    advance();
+    return n * scale;
+}
+
 std::string Parser::parse_brace_blob() {
     if (!match(TokenKind::LBrace)) return {};
     std::string out = "{";
@@ -228,6 +250,32 @@ ExprPtr Parser::parse_primary() {
             return e;
         }
 
+        // Topic read: Node.topic.value | Node.topic.count | Node.topic.at(i)
+        if (match(TokenKind::Dot)) {
+            Expr::TopicRead tr;
+            tr.node = std::move(name);
+            tr.topic = parse_ident_text("Expected topic name after '.'");
+            expect(TokenKind::Dot, "Expected '.value', '.count' or '.at(i)' after topic name");
+            std::string field = cur_.kind == TokenKind::Ident ? std::string(cur_.lexeme) : std::string();
+            if (field == "value") {
+                advance();
+            } else if (field == "count") {
+                advance();
+                tr.kind = Expr::TopicRead::Kind::Count;
+            } else if (field == "at") {
+                advance();
+                tr.kind = Expr::TopicRead::Kind::At;
+                expect(TokenKind::LParen, "Expected '('");
+                tr.index = parse_expr(0);
+                expect(TokenKind::RParen, "Expected ')'");
+            } else {
+                diag_.error(cur_.loc, "Expected 'value', 'count' or 'at(i)'");
+            }
+            auto e = std::make_shared<Expr>();
+            e->loc = loc; e->v = std::move(tr);
+            return e;
+        }
+
         Expr::Ident id{std::move(name)};
         auto e = std::make_shared<Expr>();
         e->loc = loc; e->v = std::move(id);
@@ -346,6 +394,23 @@ TopicDecl Parser::parse_topic_decl() {
     t.path = parse_string_literal("Expected topic path string");
     expect(TokenKind::Colon, "Expected ':'");
     t.type = parse_type();
+    while (cur_.kind == TokenKind::Ident) {
+        if (cur_.lexeme == "latched") {
+            advance();
+            t.latched = true;
+        } else if (cur_.lexeme == "history") {
+            advance();
+            if (cur_.kind == TokenKind::Int) {
+                t.history = std::stoi(std::string(cur_.lexeme));
+                advance();
+            } else {
+                diag_.error(cur_.loc, "Expected history depth");
+            }
+        } else {
+            diag_.error(cur_.loc, "Unknown topic qualifier '" + std::string(cur_.lexeme) + "'");
+            advance();
+        }
+    }
     skip_newlines();
     return t;
 }
@@ -399,6 +464,10 @@ OnRequestDecl Parser::parse_on_request_decl() {
     }
 
     decl.sig.name = parse_ident_text("Expected function name");
+    if (decl.sig.name == "idempotent" && cur_.kind == TokenKind::Ident) {
+        decl.idempotent = true;
+        decl.sig.name = parse_ident_text("Expected function name");
+    }
     decl.sig.params = parse_decl_params();
     decl.sig.return_type = parse_optional_return_type();
     decl.body = parse_indented_block_stmts();
@@ -420,6 +489,33 @@ OnListenDecl Parser::parse_on_listen_decl() {
         decl.topic_name = first;
     }
 
+    while (cur_.kind == TokenKind::Ident) {
+        if (cur_.lexeme == "replay") {
+            advance();
+            decl.replay = true;
+        } else if (cur_.lexeme == "every") {
+            advance();
+            decl.every_ns = parse_duration_ns("Expected period after 'every'");
+        } else if (cur_.lexeme == "debounce") {
+            advance();
+            decl.debounce_ns = parse_duration_ns("Expected quiet time after 'debounce'");
+        } else if (cur_.lexeme == "sample") {
+            advance();
+            if (cur_.kind == TokenKind::Int && cur_.lexeme == "1") advance();
+            else diag_.error(cur_.loc, "Expected '1/N' after 'sample'");
+            expect(TokenKind::Slash, "Expected '1/N' after 'sample'");
+            if (cur_.kind == TokenKind::Int) {
+                decl.sample_every = std::stoi(std::string(cur_.lexeme));
+                if (decl.sample_every < 1) diag_.error(cur_.loc, "Sample divisor must be at least 1");
+                advance();
+            } else {
+                diag_.error(cur_.loc, "Expected '1/N' after 'sample'");
+            }
+        } else {
+            break;
+        }
+    }
+
     if (match(TokenKind::KwDo)) {
         decl.delegate_to = parse_ident_text("Expected function");
         expect(TokenKind::LParen, "Expected '()'");
@@ -435,6 +531,31 @@ OnListenDecl Parser::parse_on_listen_decl() {
     return decl;
 }
 
+// `every` is contextual: only an identifier at the start of a node/mode member.
+bool Parser::at_every() const {
+    return cur_.kind == TokenKind::Ident && cur_.lexeme == "every";
+}
+
+EveryDecl Parser::parse_every_decl() {
+    Token start = cur_;
+    advance(); // 'every'
+    EveryDecl decl;
+    decl.loc = start.loc;
+    decl.period_ns = parse_duration_ns("Expected period after 'every'");
+
+    if (match(TokenKind::KwDo)) {
+        decl.delegate_to = parse_ident_text("Expected function");
+        expect(TokenKind::LParen, "Expected '()'");
+        expect(TokenKind::RParen, "Expected ')'");
+        skip_newlines();
+        return decl;
+    }
+
+    decl.body = parse_indented_block_stmts();
+    skip_newlines();
+    return decl;
+}
+
 NodeDecl Parser::parse_node_decl() {
     Token startTok = cur_;
     expect(TokenKind::KwNode, "Expected 'node'");
@@ -461,6 +582,7 @@ NodeDecl Parser::parse_node_decl() {
             while (cur_.kind != TokenKind::Eof && cur_.kind != TokenKind::Dedent) {
                 if (cur_.kind == TokenKind::KwOnRequest) n.requests.push_back(parse_on_request_decl());
                 else if (cur_.kind == TokenKind::KwOnListen) n.listeners.push_back(parse_on_listen_decl());
+                else if (at_every()) n.timers.push_back(parse_every_decl());
                 else if (cur_.kind == TokenKind::KwFunc) n.private_funcs.push_back(parse_func_decl());
                 else if (cur_.kind == TokenKind::KwTopic) n.topics.push_back(parse_topic_decl());
                 else if (match(TokenKind::Newline)) continue;
@@ -540,17 +662,74 @@ std::optional<StmtPtr> Parser::parse_stmt() {
         log.args = parse_print_args();
         return wrap_stmt(std::move(log));
     }
+    if (cur_.kind == TokenKind::Ident && cur_.lexeme == "wait") {
+        WaitStmt w;
+        w.loc = cur_.loc;
+        advance();
+        w.ns = parse_duration_ns("Expected a duration after 'wait'");
+        return wrap_stmt(std::move(w));
+    }
+    bool awaited = false;
+    if (cur_.kind == TokenKind::Ident && cur_.lexeme == "await") {
+        awaited = true;
+        advance();
+        if (cur_.kind != TokenKind::KwRequest) {
+            diag_.error(cur_.loc, "Expected 'request' after 'await'");
+            return std::nullopt;
+        }
+    }
     if (cur_.kind == TokenKind::KwRequest) {
         RequestStmt req;
         req.loc = cur_.loc;
+        req.is_await = awaited;
         advance();
         if (match(TokenKind::KwSilent)) req.is_silent = true;
         req.target_node = parse_ident_text("Expected node");
+        if (req.target_node == "async" && cur_.kind == TokenKind::Ident) {
+            req.is_async = true;
+            req.target_node = parse_ident_text("Expected node");
+        }
         expect(TokenKind::Dot, "Expected '.'");
         req.func_name = parse_ident_text("Expected func");
         req.args = parse_call_args();
+        if (!req.is_async && !req.is_await) return wrap_stmt(std::move(req));
+
+        if (match(TokenKind::Arrow)) req.result = parse_ident_text("Expected a name for the reply after '->'");
+        if (cur_.kind == TokenKind::Ident && cur_.lexeme == "timeout") {
+            advance();
+            req.timeout_ns = parse_duration_ns("Expected a duration after 'timeout'");
+        }
+        if (req.is_await) {
+            if (req.is_async) diag_.error(req.loc, "'await request' cannot also be 'async'");
+            return wrap_stmt(std::move(req));
+        }
+
+        // The `on` blocks that join this request (and earlier ones) sit on the
+        // lines right after it.
+        skip_newlines();
+        if (cur_.kind == TokenKind::Ident && cur_.lexeme == "on") {
+            advance();
+            do {
+                req.awaits.push_back(parse_ident_text("Expected the name of a reply after 'on'"));
+            } while (match(TokenKind::Comma));
+            expect(TokenKind::Colon, "Expected ':' after the replies to wait for");
+            req.on_reply = parse_indented_block_stmts();
+            while (match(TokenKind::Newline)) {}
+            if (cur_.kind == TokenKind::Ident && cur_.lexeme == "on") {
+                advance();
+                if (cur_.kind != TokenKind::Ident || cur_.lexeme != "timeout")
+                    diag_.error(cur_.loc, "Expected 'on timeout:' after the reply block");
+                advance();
+                expect(TokenKind::Colon, "Expected ':' after 'on timeout'");
+                req.on_timeout = parse_indented_block_stmts();
+            }
+        }
         return wrap_stmt(std::move(req));
     }
+    if (cur_.kind == TokenKind::Ident && cur_.lexeme == "on") {
+        diag_.error(cur_.loc, "'on' must follow a 'request async'");
+        return std::nullopt;
+    }
     if (cur_.kind == TokenKind::KwReturn) {
         ReturnStmt ret;
         ret.loc = cur_.loc;
@@ -652,7 +831,10 @@ ModeDecl Parser::parse_mode_decl() {
         while (cur_.kind != TokenKind::Eof && cur_.kind != TokenKind::Dedent) {
             if (cur_.kind == TokenKind::KwOnListen) {
                 m.listeners.push_back(parse_on_listen_decl());
-            } 
+            }
+            else if (at_every()) {
+                m.timers.push_back(parse_every_decl());
+            }
             else if (auto s = parse_stmt()) {
                 m.body.push_back(*s);
                 while (match(TokenKind::Newline)) {}
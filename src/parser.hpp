@@ -19,6 +19,7 @@ private:
     std::string parse_ident_text(const char* msg);
     std::string parse_string_literal(const char* msg);
     std::string parse_brace_blob();
+    int64_t parse_duration_ns(const char* msg);
 
     ModeName parse_mode_name(const char* msg);
     TypeInfo parse_type();
@@ -45,12 +46,14 @@ private:
     FuncDecl parse_func_decl();
     OnRequestDecl parse_on_request_decl();
     OnListenDecl parse_on_listen_decl();
+    EveryDecl parse_every_decl();
+    bool at_every() const;
     NodeDecl parse_node_decl();
     ModeDecl parse_mode_decl();
 
     // Statement Parser
     std::optional<StmtPtr> parse_stmt();
-    StmtPtr make_stmt(SourceLoc loc, std::variant<CallStmt, RequestStmt, PublishStmt, ReturnStmt, TransitionStmt, LogStmt, IfStmt>&& v);
+    StmtPtr make_stmt(SourceLoc loc, std::variant<CallStmt, RequestStmt, PublishStmt, ReturnStmt, TransitionStmt, LogStmt, IfStmt, WaitStmt>&& v);
 
     // If / elif / else
     StmtPtr parse_if_stmt();
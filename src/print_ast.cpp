@@ -69,6 +69,19 @@ static void print_expr(const ExprPtr& e, std::ostream& os) {
         os << ")";
         return;
     }
+    if (auto tr = std::get_if<Expr::TopicRead>(&e->v)) {
+        os << tr->node << "." << tr->topic;
+        switch (tr->kind) {
+            case Expr::TopicRead::Kind::Value: os << ".value"; break;
+            case Expr::TopicRead::Kind::Count: os << ".count"; break;
+            case Expr::TopicRead::Kind::At:
+                os << ".at(";
+                print_expr(tr->index, os);
+                os << ")";
+                break;
+        }
+        return;
+    }
     if (auto un = std::get_if<Expr::Unary>(&e->v)) {
         if (un->op == UnaryOp::Not) os << "not ";
         else os << "-";
@@ -85,6 +98,13 @@ static void print_expr(const ExprPtr& e, std::ostream& os) {
     }
 }
 
+static void print_duration(int64_t ns, std::ostream& os) {
+    if (ns % 1000000000 == 0) os << ns / 1000000000 << "s";
+    else if (ns % 1000000 == 0) os << ns / 1000000 << "ms";
+    else if (ns % 1000 == 0) os << ns / 1000 << "us";
+    else os << ns << "ns";
+}
+
 static void print_stmt(const StmtPtr& sp, std::ostream& os, int depth);
 
 static void print_stmts(const std::vector<StmtPtr>& stmts, std::ostream& os, int depth) {
@@ -148,14 +168,38 @@ static void print_stmt(const StmtPtr& sp, std::ostream& os, int depth) {
     }
 
     if (auto req = std::get_if<RequestStmt>(&sp->v)) {
+        if (req->is_await) os << "await ";
         os << "request ";
         if (req->is_silent) os << "silent ";
+        if (req->is_async) os << "async ";
         os << req->target_node << "." << req->func_name << "(";
         for (size_t i = 0; i < req->args.size(); ++i) {
             if (i > 0) os << ", ";
             os << req->args[i];
         }
-        os << ")\n";
+        os << ")";
+        if (!req->result.empty()) os << " -> " << req->result;
+        if (req->timeout_ns) { os << " timeout "; print_duration(req->timeout_ns, os); }
+        os << "\n";
+        if (!req->awaits.empty()) {
+            indent(os, depth);
+            os << "on ";
+            for (size_t i = 0; i < req->awaits.size(); ++i) os << (i ? ", " : "") << req->awaits[i];
+            os << ":\n";
+            print_stmts(req->on_reply, os, depth + 1);
+        }
+        if (!req->on_timeout.empty()) {
+            indent(os, depth);
+            os << "on timeout:\n";
+            print_stmts(req->on_timeout, os, depth + 1);
+        }
+        return;
+    }
+
+    if (auto w = std::get_if<WaitStmt>(&sp->v)) {
+        os << "wait ";
+        print_duration(w->ns, os);
+        os << "\n";
         return;
     }
 
@@ -182,6 +226,10 @@ static void print_listener(const OnListenDecl& lis, std::ostream& os, int depth)
     os << "onListen ";
     if (!lis.source_node.empty()) os << lis.source_node << ".";
     os << lis.topic_name << " ";
+    if (lis.replay) os << "replay ";
+    if (lis.every_ns) { os << "every "; print_duration(lis.every_ns, os); os << " "; }
+    if (lis.debounce_ns) { os << "debounce "; print_duration(lis.debounce_ns, os); os << " "; }
+    if (lis.sample_every) os << "sample 1/" << lis.sample_every << " ";
 
     if (!lis.delegate_to.empty()) {
         os << "do " << lis.delegate_to << "()\n";
@@ -193,6 +241,18 @@ static void print_listener(const OnListenDecl& lis, std::ostream& os, int depth)
     }
 }
 
+static void print_timer(const EveryDecl& t, std::ostream& os, int depth) {
+    indent(os, depth);
+    os << "every ";
+    print_duration(t.period_ns, os);
+    if (!t.delegate_to.empty()) {
+        os << " do " << t.delegate_to << "()\n";
+    } else {
+        os << "\n";
+        print_stmts(t.body, os, depth + 1);
+    }
+}
+
 static void print_modename(const ModeName& mn, std::ostream& os) {
     if (mn.is_local_string) os << "\"" << mn.text << "\"";
     else os << mn.text;
@@ -216,6 +276,8 @@ void print_ast(const Program& p, std::ostream& os) {
                 indent(os, 1);
                 os << "topic " << t.name << " = \"" << t.path << "\" : ";
                 print_type(t.type, os);
+                if (t.latched) os << " latched";
+                if (t.history) os << " history " << t.history;
                 os << "\n";
             }
 
@@ -225,6 +287,7 @@ void print_ast(const Program& p, std::ostream& os) {
                 if (!r.delegate_to.empty()) {
                     os << "do " << r.delegate_to << "()\n";
                 } else {
+                    if (r.idempotent) os << "idempotent ";
                     os << r.sig.name;
                     print_params(r.sig.params, os);
                     os << " -> ";
@@ -235,6 +298,7 @@ void print_ast(const Program& p, std::ostream& os) {
             }
 
             for (const auto& l : x.listeners) print_listener(l, os, 1);
+            for (const auto& t : x.timers) print_timer(t, os, 1);
 
             for (const auto& f : x.private_funcs) {
                 indent(os, 1);
@@ -254,6 +318,7 @@ void print_ast(const Program& p, std::ostream& os) {
             print_stmts(x.body, os, 1);
 
             for (const auto& l : x.listeners) print_listener(l, os, 1);
+            for (const auto& t : x.timers) print_timer(t, os, 1);
         } else if constexpr (std::is_same_v<T, FuncDecl>) {
             os << "func " << x.sig.name << "\n";
         }
@@ -0,0 +1,3961 @@
+#include "runtime_cpp.hpp"
+
+static const char* RIVET_RUNTIME = R"(
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <utility>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <array>
+#include <cstdlib>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+// In order of severity: a node logs a line when its level is at or above
+// the node's `log_level`.
+enum class LogLevel { DEBUG, INFO, WARN, ERROR };
+
+#if defined(_WIN32)
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Where the log writer sends its batches of whole lines. A sink is only ever
+// called from the writer thread (or, once the writer has stopped, from
+// whoever logs); it may modify `parts`.
+class LogSink {
+public:
+    virtual ~LogSink() = default;
+    virtual void write(iovec* parts, int count) = 0;
+
+protected:
+    static void write_all(int fd, iovec* v, int n) {
+#if defined(_WIN32)
+        for (int i = 0; i < n; ++i) std::fwrite(v[i].iov_base, 1, v[i].iov_len, fd == 1 ? stdout : stderr);
+#else
+        while (n > 0) {
+            ssize_t w = ::writev(fd, v, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return; // nowhere left to report it
+            }
+            while (n > 0 && (size_t)w >= v->iov_len) {
+                w -= (ssize_t)v->iov_len;
+                ++v;
+                --n;
+            }
+            if (n > 0) {
+                v->iov_base = static_cast<char*>(v->iov_base) + w;
+                v->iov_len -= (size_t)w;
+            }
+        }
+#endif
+    }
+};
+
+class StdoutSink : public LogSink {
+public:
+    void write(iovec* parts, int count) override { write_all(1, parts, count); }
+};
+
+#if !defined(_WIN32)
+// Appends to `path`; once it would grow past `max_bytes` it is renamed to
+// path.1 (path.1 to path.2, and so on, keeping `keep` old files) and a new
+// one is started.
+class RotatingFileSink : public LogSink {
+public:
+    RotatingFileSink(std::string path, uint64_t max_bytes, int keep)
+        : path(std::move(path)), max_bytes(max_bytes), keep(keep) {
+        open();
+    }
+    ~RotatingFileSink() override {
+        if (fd >= 0) ::close(fd);
+    }
+
+    void write(iovec* parts, int count) override {
+        uint64_t bytes = 0;
+        for (int i = 0; i < count; ++i) bytes += parts[i].iov_len;
+        if (size > 0 && size + bytes > max_bytes) rotate();
+        if (fd < 0) return;
+        write_all(fd, parts, count);
+        size += bytes;
+    }
+
+private:
+    std::string path;
+    uint64_t max_bytes;
+    int keep;
+    int fd = -1;
+    uint64_t size = 0;
+
+    void open() {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        struct stat st;
+        size = fd >= 0 && ::fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    }
+    void rotate() {
+        if (fd >= 0) ::close(fd);
+        for (int i = keep - 1; i >= 1; --i)
+            std::rename((path + "." + std::to_string(i)).c_str(), (path + "." + std::to_string(i + 1)).c_str());
+        if (keep > 0) std::rename(path.c_str(), (path + ".1").c_str());
+        else std::remove(path.c_str());
+        open();
+    }
+};
+#endif
+
+// `log` and `print` lines are formatted by the thread that logs them, in a
+// buffer of its own, and copied into that thread's ring; one writer thread
+// drains every ring and hands what it found to the sink as a single writev.
+// Logging takes no lock and never waits for the terminal. Lines from one
+// thread come out in order; lines from different threads interleave whole.
+//   RIVET_LOG_FILE=<path>      rotating file instead of stdout
+//   RIVET_LOG_FILE_MB=<n>      size at which it rotates (default 16)
+//   RIVET_LOG_FILE_KEEP=<n>    rotated files kept (default 3)
+//   RIVET_LOG_RING_KB=<n>      per-thread ring (default 64)
+//   RIVET_LOG_OVERFLOW=block|drop|count
+//       what a full ring does: wait for the writer (default), drop the line,
+//       or drop it and have the writer report how many were dropped (and
+//       how many were longer than the ring and cut to fit).
+class Logger {
+public:
+    enum class Overflow { Block, Drop, Count };
+
+    // A reusable line buffer. Reading it back does not copy.
+    class Text : private std::stringbuf, public std::ostream {
+    public:
+        Text() : std::ostream(static_cast<std::stringbuf*>(this)) {}
+        std::string_view view() const { return {pbase(), size_t(pptr() - pbase())}; }
+        void reset() {
+            clear();
+            flags(std::ios_base::dec | std::ios_base::skipws);
+            precision(6);
+            seekp(0);
+        }
+    };
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    // The calling thread's next free line buffer, empty; release() hands it
+    // back. Nested (a value being formatted logs), each gets its own.
+    Text& acquire() {
+        Local& l = local();
+        if (l.depth == l.texts.size()) l.texts.emplace_back(new Text());
+        Text& t = *l.texts[l.depth++];
+        t.reset();
+        return t;
+    }
+    void release() { --local().depth; }
+
+    // Queues `t` as one line (a newline is added unless it ends in one).
+    void commit(Text& t) {
+        if (t.view().empty() || t.view().back() != '\n') t.put('\n');
+        std::string_view line = t.view();
+        if (!running.load(std::memory_order_acquire)) {
+            write_direct(line);
+            return;
+        }
+        Ring& r = *local().ring;
+        // A line longer than the ring keeps its head, [Node] [LEVEL] included.
+        static constexpr std::string_view cut = " [truncated]\n";
+        std::string_view end;
+        if (line.size() > r.cap) {
+            line = line.substr(0, r.cap - cut.size());
+            end = cut;
+            truncated.fetch_add(1, std::memory_order_relaxed);
+        }
+        for (;;) {
+            const uint64_t h = r.head.load(std::memory_order_relaxed);
+            if (r.cap - (h - r.tail.load(std::memory_order_acquire)) >= line.size() + end.size()) {
+                put(r, h, line);
+                put(r, h + line.size(), end);
+                r.head.store(h + line.size() + end.size(), std::memory_order_seq_cst);
+                wake();
+                return;
+            }
+            if (overflow != Overflow::Block) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            wake();
+            std::this_thread::yield();
+        }
+    }
+
+    // Returns once everything logged before the call has reached the sink.
+    void flush() {
+        std::vector<std::pair<Ring*, uint64_t>> upto;
+        for (Ring* r = rings.load(std::memory_order_acquire); r; r = r->next)
+            upto.emplace_back(r, r->head.load(std::memory_order_acquire));
+        for (auto& [r, h] : upto) drain(*r, h);
+    }
+
+    // Drains the rings and stops the writer; later lines are written in place.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (!running.load()) return;
+            stopping = true;
+        }
+        cv.notify_one();
+        writer.join();
+        running.store(false, std::memory_order_release);
+    }
+
+    // Lines from here on go to `s`.
+    void set_sink(std::unique_ptr<LogSink> s) {
+        std::lock_guard<std::mutex> lock(sink_mu);
+        sink = std::move(s);
+    }
+
+    uint64_t dropped_lines() const { return dropped.load(std::memory_order_relaxed); }
+    uint64_t truncated_lines() const { return truncated.load(std::memory_order_relaxed); }
+
+    // The `log_level` of nodes without a `{log: ...}` config: RIVET_LOG_LEVEL,
+    // or every level that was compiled in.
+    static LogLevel default_level() {
+        static const LogLevel level = [] {
+            const char* v = std::getenv("RIVET_LOG_LEVEL");
+            if (!v) return LogLevel::DEBUG;
+            if (std::strcmp(v, "info") == 0) return LogLevel::INFO;
+            if (std::strcmp(v, "warn") == 0) return LogLevel::WARN;
+            if (std::strcmp(v, "error") == 0) return LogLevel::ERROR;
+            return LogLevel::DEBUG;
+        }();
+        return level;
+    }
+
+private:
+    // Single producer (its thread), single consumer (the writer). head and
+    // tail count bytes ever written and read; a line may wrap.
+    struct Ring {
+        explicit Ring(size_t cap) : cap(cap), data(new char[cap]) {}
+        const size_t cap;
+        std::unique_ptr<char[]> data;
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        Ring* next = nullptr;
+    };
+    // A thread that exits waits for its ring to empty, so what it logged
+    // comes out before anything logged after it has been joined.
+    struct Local {
+        Ring* ring = nullptr;
+        std::vector<std::unique_ptr<Text>> texts;
+        size_t depth = 0;
+        ~Local() {
+            if (ring) Logger::instance().drain(*ring, ring->head.load(std::memory_order_relaxed));
+        }
+    };
+
+    std::atomic<Ring*> rings{nullptr}; // every thread's, never freed before the logger
+    size_t ring_bytes = 64 * 1024;
+    Overflow overflow = Overflow::Block;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> truncated{0}; // lines cut to fit their ring
+    std::mutex sink_mu;
+    std::unique_ptr<LogSink> sink;
+    std::atomic<bool> running{false};
+    std::atomic<bool> sleeping{false};
+    bool stopping = false;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::thread writer;
+
+    Logger() {
+        if (const char* kb = std::getenv("RIVET_LOG_RING_KB")) ring_bytes = std::max(1L, std::atol(kb)) * 1024;
+        if (const char* o = std::getenv("RIVET_LOG_OVERFLOW")) {
+            if (std::strcmp(o, "drop") == 0) overflow = Overflow::Drop;
+            else if (std::strcmp(o, "count") == 0) overflow = Overflow::Count;
+        }
+#if !defined(_WIN32)
+        if (const char* path = std::getenv("RIVET_LOG_FILE")) {
+            const char* mb = std::getenv("RIVET_LOG_FILE_MB");
+            const char* keep = std::getenv("RIVET_LOG_FILE_KEEP");
+            sink.reset(new RotatingFileSink(path, (uint64_t)std::max(1L, mb ? std::atol(mb) : 16L) << 20,
+                                            keep ? std::max(0, std::atoi(keep)) : 3));
+        }
+#endif
+        if (!sink) sink.reset(new StdoutSink());
+        running.store(true);
+#if defined(_WIN32)
+        writer = std::thread([this] { run(); });
+#else
+        // The writer may start before the event loop claims SIGINT/SIGTERM;
+        // it must never be the thread they are delivered to.
+        sigset_t all, saved;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &saved);
+        writer = std::thread([this] { run(); });
+        pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+#endif
+    }
+    ~Logger() {
+        stop();
+        for (Ring* r = rings.load(); r;) {
+            Ring* next = r->next;
+            delete r;
+            r = next;
+        }
+    }
+
+    Local& local() {
+        static thread_local Local l;
+        if (!l.ring) {
+            l.ring = new Ring(ring_bytes);
+            l.ring->next = rings.load(std::memory_order_relaxed);
+            while (!rings.compare_exchange_weak(l.ring->next, l.ring, std::memory_order_release)) {}
+        }
+        return l;
+    }
+
+    void drain(Ring& r, uint64_t upto) {
+        while (running.load(std::memory_order_acquire) && r.tail.load(std::memory_order_acquire) < upto) {
+            wake();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    // Copies `text` into the ring from byte `at` on, wrapping at the end.
+    static void put(Ring& r, uint64_t at, std::string_view text) {
+        const size_t from = at % r.cap, first = std::min(text.size(), r.cap - from);
+        std::memcpy(&r.data[from], text.data(), first);
+        std::memcpy(&r.data[0], text.data() + first, text.size() - first);
+    }
+
+    void wake() {
+        if (sleeping.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mu);
+            cv.notify_one();
+        }
+    }
+
+    void write_direct(std::string_view line) {
+        iovec v{const_cast<char*>(line.data()), line.size()};
+        std::lock_guard<std::mutex> lock(sink_mu);
+        sink->write(&v, 1);
+    }
+
+    bool pending() const {
+        for (Ring* r = rings.load(std::memory_order_acquire); r; r = r->next)
+            if (r->head.load(std::memory_order_seq_cst) != r->tail.load(std::memory_order_relaxed)) return true;
+        return false;
+    }
+
+    void run() {
+        std::vector<iovec> parts;
+        std::vector<std::pair<Ring*, uint64_t>> taken;
+        uint64_t reported = 0, reported_cut = 0;
+        for (;;) {
+            parts.clear();
+            taken.clear();
+            for (Ring* r = rings.load(std::memory_order_acquire); r; r = r->next) {
+                const uint64_t t = r->tail.load(std::memory_order_relaxed);
+                const uint64_t h = r->head.load(std::memory_order_acquire);
+                if (h == t) continue;
+                const size_t at = t % r->cap, first = std::min<uint64_t>(h - t, r->cap - at);
+                parts.push_back(iovec{&r->data[at], first});
+                if (h - t > first) parts.push_back(iovec{&r->data[0], size_t(h - t - first)});
+                taken.emplace_back(r, h);
+            }
+            std::string notice;
+            if (overflow == Overflow::Count && dropped.load(std::memory_order_relaxed) != reported) {
+                const uint64_t now = dropped.load(std::memory_order_relaxed);
+                notice = "[LOG] " + std::to_string(now - reported) + " lines dropped, ring full: raise RIVET_LOG_RING_KB\n";
+                reported = now;
+            }
+            if (overflow == Overflow::Count && truncated.load(std::memory_order_relaxed) != reported_cut) {
+                const uint64_t now = truncated.load(std::memory_order_relaxed);
+                notice += "[LOG] " + std::to_string(now - reported_cut) +
+                          " lines truncated, longer than the ring: raise RIVET_LOG_RING_KB\n";
+                reported_cut = now;
+            }
+            if (!notice.empty()) parts.push_back(iovec{&notice[0], notice.size()});
+            if (!parts.empty()) {
+                {
+                    std::lock_guard<std::mutex> lock(sink_mu);
+                    sink->write(parts.data(), (int)parts.size());
+                }
+                for (auto& [r, h] : taken) r->tail.store(h, std::memory_order_release);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mu);
+            if (stopping && !pending()) return;
+            sleeping.store(true, std::memory_order_seq_cst);
+            if (!pending()) cv.wait_for(lock, std::chrono::milliseconds(100));
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+};
+
+// One line through the logger: `LogLine(name, LogLevel::WARN) << ...;` for a
+// node's `log`, `LogLine() << ...;` for anything else. The line is queued
+// when the statement ends.
+class LogLine {
+public:
+    LogLine() : t(Logger::instance().acquire()) {}
+    LogLine(const std::string& node, LogLevel level) : LogLine() {
+        t << "[" << node << "] ";
+        switch (level) {
+            case LogLevel::INFO:  t << "[INFO] "; break;
+            case LogLevel::WARN:  t << "\033[33m[WARN]\033[0m "; break;
+            case LogLevel::ERROR: t << "\033[31m[ERROR]\033[0m "; break;
+            case LogLevel::DEBUG: t << "\033[36m[DEBUG]\033[0m "; break;
+        }
+    }
+    ~LogLine() {
+        Logger::instance().commit(t);
+        Logger::instance().release();
+    }
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    template <typename V>
+    LogLine& operator<<(const V& v) {
+        t << v;
+        return *this;
+    }
+    // For functions that print to a std::ostream.
+    std::ostream& stream() { return t; }
+
+private:
+    Logger::Text& t;
+};
+
+// Grace-period tracking for copy-on-write snapshots. Readers bump the counter of
+// the epoch parity they observed; writers swap in a new snapshot and retire the
+// old one, which is reclaimed once both parities have drained past it. Nothing
+// here blocks, so a handler may subscribe to the topic that is calling it.
+class Rcu {
+    // The reader counts are spread over cache lines by thread, so publishers
+    // on different threads (to any topics) do not write the same line.
+    struct alignas(64) Shard {
+        std::atomic<long> readers[2];
+    };
+    static constexpr size_t Shards = 32;
+    static inline Shard shards[Shards];
+    static inline std::atomic<size_t> next_shard{0};
+
+    static Shard& local_shard() {
+        static thread_local Shard& s = shards[next_shard.fetch_add(1, std::memory_order_relaxed) % Shards];
+        return s;
+    }
+
+public:
+    class ReadGuard {
+        Shard& shard;
+        unsigned parity;
+    public:
+        ReadGuard() : shard(local_shard()), parity(epoch.load() & 1u) { shard.readers[parity].fetch_add(1); }
+        ~ReadGuard() { shard.readers[parity].fetch_sub(1); }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    };
+
+    template <typename U>
+    static void retire(const U* p) {
+        std::lock_guard<std::mutex> lock(mu);
+        retired.push_back(Retired{epoch.load(), [p] { delete p; }});
+        collect_locked();
+    }
+
+    // Reclaims whatever has passed its grace period. Called from writers and
+    // periodically from the main loop.
+    static void collect() {
+        std::lock_guard<std::mutex> lock(mu);
+        collect_locked();
+    }
+
+private:
+    struct Retired {
+        unsigned epoch;
+        std::function<void()> reclaim;
+    };
+
+    static inline std::atomic<unsigned> epoch{0};
+    static inline std::mutex mu;
+    static inline std::vector<Retired> retired;
+
+    // A guard increments and decrements the same shard, so no shard goes
+    // below zero and a zero sum means no reader of `parity` was in before
+    // its shard was read.
+    static long readers(unsigned parity) {
+        long n = 0;
+        for (const auto& s : shards) n += s.readers[parity].load();
+        return n;
+    }
+
+    static void collect_locked() {
+        // Advance while the parity that is not being entered has drained.
+        for (int i = 0; i < 2; ++i) {
+            unsigned e = epoch.load();
+            if (readers((e + 1) & 1u) != 0) break;
+            epoch.store(e + 1);
+        }
+        unsigned now = epoch.load();
+        auto keep = std::partition(retired.begin(), retired.end(),
+                                   [&](const Retired& r) { return now - r.epoch < 2; });
+        for (auto it = keep; it != retired.end(); ++it) it->reclaim();
+        retired.erase(keep, retired.end());
+    }
+};
+
+// Monotonic time for everything the runtime schedules or rate-limits. Under
+// --sim it is virtual: it starts at 0 and only the event loop moves it.
+struct Clock {
+#if defined(RIVET_SIM)
+    static inline int64_t virtual_ns = 0;
+    static int64_t now_ns() { return virtual_ns; }
+#else
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+#endif
+};
+
+// Per-listener `every` / `debounce` / `sample` policy. It is checked on the
+// publishing side, before a handler is called or queued, so dropped samples
+// cost a couple of atomic operations and never touch the listener's mailbox.
+// Stateless apart from timestamps and a counter: no timer per subscription.
+class ListenGate {
+    static constexpr int64_t Never = std::numeric_limits<int64_t>::min() / 2;
+    const int64_t every_ns;
+    const int64_t debounce_ns;
+    const uint64_t sample_every;
+    std::atomic<uint64_t> seen{0};
+    std::atomic<int64_t> last_seen{Never};
+    std::atomic<int64_t> last_pass{Never};
+
+public:
+    ListenGate(int64_t every, int64_t debounce, int sample)
+        : every_ns(every), debounce_ns(debounce), sample_every(sample > 1 ? (uint64_t)sample : 1) {}
+
+    bool admit() {
+        // sample 1/N: keep the 1st, (N+1)th, ... sample.
+        if (sample_every > 1 && seen.fetch_add(1, std::memory_order_relaxed) % sample_every != 0) return false;
+        if (!every_ns && !debounce_ns) return true;
+        int64_t now = Clock::now_ns();
+        // debounce: leading edge, i.e. pass a sample only after a quiet gap.
+        if (debounce_ns && now - last_seen.exchange(now, std::memory_order_relaxed) < debounce_ns) return false;
+        // every: at most one sample per period; the CAS settles racing publishers.
+        if (every_ns) {
+            int64_t prev = last_pass.load(std::memory_order_relaxed);
+            if (now - prev < every_ns) return false;
+            if (!last_pass.compare_exchange_strong(prev, now, std::memory_order_relaxed)) return false;
+        }
+        return true;
+    }
+};
+
+// What a subscriber receives: a reference to the value being published. A
+// handler that runs on another thread calls share() instead, which copies the
+// value into an immutable buffer once per publish and hands every later caller
+// the same buffer.
+template <typename T>
+class Payload {
+    const T& ref;
+    mutable std::shared_ptr<const T> shared;
+
+public:
+    explicit Payload(const T& v) : ref(v) {}
+    Payload(const Payload&) = delete;
+    Payload& operator=(const Payload&) = delete;
+
+    const T& get() const { return ref; }
+    operator const T&() const { return ref; }
+
+    std::shared_ptr<const T> share() const {
+        if (!shared) shared = std::make_shared<const T>(ref);
+        return shared;
+    }
+};
+
+// carry() picks what a queued handler captures: scalars by value, anything
+// else as the shared buffer. unwrap() turns either back into `const T&`.
+template <typename T>
+auto carry(const Payload<T>& p) {
+    if constexpr (std::is_arithmetic_v<T>) return p.get();
+    else return p.share();
+}
+template <typename T>
+const T& unwrap(const T& v) { return v; }
+template <typename T>
+const T& unwrap(const std::shared_ptr<const T>& p) { return *p; }
+
+// One bit of a ListenSet: a subscription that only delivers while it is set.
+struct ListenSlot {
+    const std::atomic<uint64_t>* word = nullptr; // null: always on
+    uint64_t bit = 0;
+
+    bool on() const { return !word || (word->load(std::memory_order_acquire) & bit); }
+};
+
+// The listeners declared in a node's mode blocks, one bit each. The compiler
+// subscribes every one of them once, at init, and precomputes for each mode
+// the bits it turns on; a mode change then stores the new bits a word at a
+// time, so it allocates nothing and touches no subscriber lists. Only the
+// node's own executor changes the bits.
+template <size_t N>
+class ListenSet {
+public:
+    static constexpr size_t Words = (N + 63) / 64;
+    using Mask = std::array<uint64_t, Words>;
+
+    ListenSlot slot(size_t i) const { return ListenSlot{&bits[i / 64], uint64_t(1) << (i % 64)}; }
+
+    // Clears the bits of `scope`, then sets those of `on`.
+    void assign(const Mask& scope, const Mask& on) {
+        for (size_t w = 0; w < Words; ++w)
+            bits[w].store((bits[w].load(std::memory_order_relaxed) & ~scope[w]) | on[w], std::memory_order_release);
+    }
+    void set(size_t i) { bits[i / 64].fetch_or(uint64_t(1) << (i % 64), std::memory_order_release); }
+
+private:
+    std::array<std::atomic<uint64_t>, Words> bits{};
+};
+
+template <typename T>
+class Topic {
+    struct Sub {
+        int id;
+        std::function<void(const Payload<T>&)> cb;
+        ListenSlot slot;
+    };
+    using Snapshot = std::vector<Sub>;
+
+    // Publishers only ever read the current snapshot; subscribe/unsubscribe
+    // copy it, swap the pointer and hand the old one to Rcu.
+    std::atomic<const Snapshot*> subscribers{new Snapshot()};
+    std::mutex write_mu;
+    int next_id = 1;
+
+    void swap_in(Snapshot* next) {
+        const Snapshot* old = subscribers.exchange(next);
+        Rcu::retire(old);
+    }
+
+public:
+    using value_type = T;
+
+    Topic() = default;
+    ~Topic() { delete subscribers.load(); }
+    Topic(const Topic&) = delete;
+    Topic& operator=(const Topic&) = delete;
+
+    void publish(const T& val) {
+        Rcu::ReadGuard guard;
+        const Snapshot* snap = subscribers.load();
+        Payload<T> msg(val);
+        for (const auto& s : *snap) {
+            if (s.cb && s.slot.on()) s.cb(msg);
+        }
+    }
+
+    // Returns a subscription handle that can be used to unsubscribe. With a
+    // slot, samples are only delivered while the slot is on.
+    int subscribe(std::function<void(const Payload<T>&)> cb, ListenSlot slot = {}) {
+        std::lock_guard<std::mutex> lock(write_mu);
+        auto* next = new Snapshot(*subscribers.load());
+        int id = next_id++;
+        next->push_back(Sub{id, std::move(cb), slot});
+        swap_in(next);
+        return id;
+    }
+
+    void unsubscribe(int id) {
+        std::lock_guard<std::mutex> lock(write_mu);
+        auto* next = new Snapshot(*subscribers.load());
+        next->erase(
+            std::remove_if(next->begin(), next->end(),
+                           [&](const Sub& s) { return s.id == id; }),
+            next->end());
+        swap_in(next);
+    }
+};
+
+// Last-value slot for `latched` topics. Plain values sit behind a seqlock: the
+// publisher never waits for readers, and a reader retries only if a publish
+// overlapped its copy. The words are relaxed atomics so the racing copy is
+// well defined.
+template <typename T>
+class Seqlock {
+    static constexpr size_t Words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> data[Words] = {};
+
+public:
+    void store(const T& v) {
+        uint64_t buf[Words] = {};
+        std::memcpy(buf, &v, sizeof(T));
+        // Odd sequence = write in progress; publishers of one topic take turns.
+        uint64_t s = seq.load(std::memory_order_relaxed);
+        while ((s & 1) || !seq.compare_exchange_weak(s, s + 1, std::memory_order_relaxed)) {
+            s = seq.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t w = 0; w < Words; ++w) data[w].store(buf[w], std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        uint64_t buf[Words];
+        for (;;) {
+            uint64_t s = seq.load(std::memory_order_acquire);
+            if (s & 1) continue;
+            for (size_t w = 0; w < Words; ++w) buf[w] = data[w].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s) break;
+        }
+        T v;
+        std::memcpy(&v, buf, sizeof(T));
+        return v;
+    }
+};
+
+// Values that cannot be copied bytewise (strings) are swapped in whole and the
+// old copy handed to Rcu, so readers still never hold up the publisher.
+template <typename T>
+class RcuBox {
+    std::atomic<const T*> cur{new T()};
+    std::mutex write_mu;
+
+public:
+    RcuBox() = default;
+    ~RcuBox() { delete cur.load(); }
+    RcuBox(const RcuBox&) = delete;
+    RcuBox& operator=(const RcuBox&) = delete;
+
+    void store(const T& v) {
+        std::lock_guard<std::mutex> lock(write_mu);
+        Rcu::retire(cur.exchange(new T(v)));
+    }
+
+    T load() const {
+        Rcu::ReadGuard guard;
+        return *cur.load();
+    }
+};
+
+template <typename T>
+using Latch = std::conditional_t<std::is_trivially_copyable_v<T>, Seqlock<T>, RcuBox<T>>;
+
+// A topic that also remembers what it last published. Until the first publish
+// value() is the type's zero value.
+template <typename TopicT>
+class Latched : public TopicT {
+    using T = typename TopicT::value_type;
+    Latch<T> latest;
+
+public:
+    void publish(const T& val) {
+        latest.store(val);
+        TopicT::publish(val);
+    }
+    T value() const { return latest.load(); }
+};
+
+// Fixed ring of the last N samples for `history N` topics; all storage is
+// inline, so publishing never allocates. Each slot is its own seqlock, so a
+// reader racing the publisher gets a whole sample (possibly a newer one if the
+// ring wrapped under it), never a torn one.
+template <typename T, size_t N>
+class HistoryRing {
+    static_assert(N > 0, "history depth must be positive");
+    std::atomic<uint64_t> claimed{0};
+    std::atomic<uint64_t> committed{0};
+    Seqlock<T> slots[N];
+
+public:
+    void push(const T& v) {
+        uint64_t seq = claimed.fetch_add(1, std::memory_order_relaxed);
+        slots[seq % N].store(v);
+        // Publish in claim order so `committed` never exposes an unwritten slot.
+        while (committed.load(std::memory_order_acquire) != seq) std::this_thread::yield();
+        committed.store(seq + 1, std::memory_order_release);
+    }
+
+    // Samples published so far (not capped at N).
+    uint64_t published() const { return committed.load(std::memory_order_acquire); }
+    size_t count() const { return (size_t)std::min<uint64_t>(published(), N); }
+
+    // at(0) is the newest sample; out-of-range reads give the zero value.
+    T at(int64_t i) const {
+        uint64_t n = published();
+        if (i < 0 || (uint64_t)i >= std::min<uint64_t>(n, N)) return T{};
+        return slots[(n - 1 - (uint64_t)i) % N].load();
+    }
+
+    // Calls f(sample) oldest first for the buffered samples published before
+    // sequence number `upto`.
+    template <typename F>
+    void replay(uint64_t upto, F&& f) const {
+        uint64_t from = upto > N ? upto - N : 0;
+        for (uint64_t s = from; s < upto; ++s) f(slots[s % N].load());
+    }
+};
+
+template <typename TopicT, size_t N>
+class History : public TopicT {
+    using T = typename TopicT::value_type;
+    HistoryRing<T, N> ring;
+
+public:
+    void publish(const T& val) {
+        ring.push(val);
+        TopicT::publish(val);
+    }
+    T value() const { return ring.at(0); }
+    size_t count() const { return ring.count(); }
+    T at(int64_t i) const { return ring.at(i); }
+    uint64_t published() const { return ring.published(); }
+    template <typename F>
+    void replay(uint64_t upto, F&& f) const { ring.replay(upto, std::forward<F>(f)); }
+};
+
+// Mode names are interned by the compiler: system modes into the SysMode ids
+// of the generated program (0 is Init), each node's local modes into ids of
+// its own. A node registers for the system modes it has blocks for and is
+// only called on transitions into or out of one of them, so a transition
+// costs the same however many modes and uninterested nodes there are.
+using ModeId = uint16_t;
+
+// Mode changes run to completion: a change asked for while another is being
+// applied (a reaction transitioning again, or another thread) is queued and
+// applied after it, in a loop, so reactions never nest and the stack stays
+// flat however long the chain. A change that repeats the one queued just
+// before it is dropped.
+class ModeQueue {
+public:
+    // True if the caller is to apply `m` now, then keep applying next() until
+    // it returns false. Otherwise `m` is queued (or dropped) for whoever is
+    // applying.
+    bool request(ModeId m) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (busy) {
+            if (pending.empty() || pending.back() != m) pending.push_back(m);
+            return false;
+        }
+        busy = true;
+        return true;
+    }
+    bool next(ModeId& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (pending.empty()) {
+            busy = false;
+            return false;
+        }
+        m = pending.front();
+        pending.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mu;
+    bool busy = false;
+    std::deque<ModeId> pending;
+};
+
+// A transition fans out: each interested node's reaction is queued on that
+// node's executor (its actor thread, or the pool's workers), so the reactions
+// run in parallel, each node's still in order with its other work. Nodes run
+// in-line react in place, one after another. The transition is complete when
+// the last reaction returns: that one applies the next queued transition, so
+// no transition starts before every node has reacted to the one before it.
+// RIVET_TRANSITION_STATS=1 prints each transition's latency, from the
+// `transition system` until the last reaction, and every node's reaction time.
+class SystemManager {
+public:
+    using Reaction = void (*)(ModeId);
+    using Post = void (*)(std::function<void()>); // queues on the node's executor
+
+    static inline ModeId current_mode = 0;
+
+    // Called by main() before anything registers.
+    static void declare(const char* const* mode_names, size_t count) {
+        names = mode_names;
+        by_mode.assign(count, {});
+    }
+    // `react` runs, with the new mode, for every transition into or out of
+    // one of `modes`; through `post` if given, in place if not.
+    static void on(const char* node, std::initializer_list<ModeId> modes, Reaction react, Post post = nullptr) {
+        nodes.push_back(Node{node, react, post, std::vector<bool>(by_mode.size()), 0});
+        for (ModeId m : modes) {
+            nodes.back().modes[m] = true;
+            by_mode[m].push_back(nodes.size() - 1);
+        }
+    }
+    static const char* name(ModeId m) { return names[m]; }
+    static size_t count() { return by_mode.size(); }
+
+    static void set_mode(ModeId m) {
+        if (auto f = forward.load(std::memory_order_acquire)) return f(m);
+        apply(m);
+    }
+    // Makes the transition here even when another process decides the mode.
+    static void apply(ModeId m) {
+        if (!queue.request(m)) return;
+        run_from(m);
+    }
+
+    // --deploy: `forward` sends a set_mode() to the process that decides the
+    // system mode instead of making it here; `announce` sees each transition
+    // this process makes, in order, as it starts.
+    static inline std::atomic<Reaction> forward{nullptr};
+    static inline std::atomic<Reaction> announce{nullptr};
+
+private:
+    struct Node {
+        const char* name;
+        Reaction react;
+        Post post;
+        std::vector<bool> modes;
+        int64_t took_ns; // of its last reaction; read once the barrier is passed
+    };
+
+    // Applies `m` and whatever is queued after it, until a transition has
+    // reactions still running elsewhere; the last of those carries on.
+    static void run_from(ModeId m) {
+        do {
+            if (!start(m)) return;
+        } while (queue.next(m));
+    }
+
+    // True if the transition completed before returning.
+    static bool start(ModeId m) {
+        if (current_mode == m) return true;
+        LogLine() << "[SYS] Transitioning to: " << names[m];
+        const ModeId from = current_mode;
+        current_mode = m;
+        if (auto a = announce.load(std::memory_order_acquire)) a(m);
+        // Entering nodes first, then the ones only leaving, each in
+        // registration order.
+        reacting.clear();
+        for (size_t n : by_mode[m]) reacting.push_back(n);
+        for (size_t n : by_mode[from])
+            if (!nodes[n].modes[m]) reacting.push_back(n);
+        started_ns = Clock::now_ns();
+        pending.store(reacting.size() + 1, std::memory_order_relaxed); // +1: held until all are queued
+        for (size_t n : reacting) {
+            if (nodes[n].post) nodes[n].post([n, m] { react(n, m); });
+            else react(n, m);
+        }
+        return arrive();
+    }
+
+    static void react(size_t n, ModeId m) {
+        const int64_t t0 = Clock::now_ns();
+        nodes[n].react(m);
+        nodes[n].took_ns = Clock::now_ns() - t0;
+        if (!arrive()) return;
+        // Last one out: the transition is complete here.
+        if (queue.next(m)) run_from(m);
+    }
+
+    // The barrier. True for whoever brings it to zero.
+    static bool arrive() {
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return false;
+        static const bool stats = std::getenv("RIVET_TRANSITION_STATS") != nullptr;
+        if (stats) {
+            LogLine line;
+            line << "[SYS] " << names[current_mode] << " complete in " << (Clock::now_ns() - started_ns) / 1000 << "us";
+            for (size_t i = 0; i < reacting.size(); ++i)
+                line << (i ? ", " : ": ") << nodes[reacting[i]].name << " " << nodes[reacting[i]].took_ns / 1000 << "us";
+        }
+        return true;
+    }
+
+    static inline const char* const* names = nullptr;
+    static inline std::vector<Node> nodes;
+    static inline std::vector<std::vector<size_t>> by_mode; // mode -> nodes
+    static inline ModeQueue queue;
+    // The transition in flight; only its starter and its last reaction touch these.
+    static inline std::vector<size_t> reacting;
+    static inline int64_t started_ns = 0;
+    static inline std::atomic<size_t> pending{0};
+};
+)";
+
+static const char* RIVET_RUNTIME_WIRE = R"(
+#include <string_view>
+
+// The binary form of topic samples and request arguments, for anything that
+// leaves the process. Fields follow each other in declaration order with no
+// tags: ints are zigzag varints, floats 8 little-endian bytes, bools one byte
+// and strings a varint length followed by the bytes. Every topic and request
+// gets a generated codec carrying a schema hash of its declaration, so both
+// ends can tell whether they were built from the same one.
+class WireWriter {
+    uint8_t* begin;
+    uint8_t* p;
+    uint8_t* end;
+    bool fits = true;
+
+    bool room(size_t n) {
+        if ((size_t)(end - p) >= n) return true;
+        fits = false;
+        p = end;
+        return false;
+    }
+
+public:
+    WireWriter(uint8_t* buf, size_t cap) : begin(buf), p(buf), end(buf + cap) {}
+
+    void varint(uint64_t v) {
+        if (!room(v < 0x80 ? 1 : (size_t)(70 - __builtin_clzll(v)) / 7)) return;
+        while (v >= 0x80) {
+            *p++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (uint8_t)v;
+    }
+    void fixed64(uint64_t v) {
+        if (!room(8)) return;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::memcpy(p, &v, 8);
+        p += 8;
+#else
+        for (int i = 0; i < 8; ++i) *p++ = (uint8_t)(v >> (8 * i));
+#endif
+    }
+    void put(int v) { varint(((uint64_t)(int64_t)v << 1) ^ (uint64_t)((int64_t)v >> 63)); }
+    void put(double v) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof bits);
+        fixed64(bits);
+    }
+    void put(bool v) {
+        if (room(1)) *p++ = v ? 1 : 0;
+    }
+    void put(std::string_view v) {
+        varint(v.size());
+        if (!room(v.size())) return;
+        std::memcpy(p, v.data(), v.size());
+        p += v.size();
+    }
+
+    // False once something did not fit; the contents are then unusable.
+    bool ok() const { return fits; }
+    const uint8_t* data() const { return begin; }
+    size_t size() const { return (size_t)(p - begin); }
+};
+
+// Reads what WireWriter wrote. Strings come back as views into the input, so
+// decoding never allocates; they are valid as long as the input is.
+class WireReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool good = true;
+
+    bool need(size_t n) {
+        if ((size_t)(end - p) >= n) return true;
+        good = false;
+        p = end;
+        return false;
+    }
+
+public:
+    WireReader(const uint8_t* data, size_t n) : p(data), end(data + n) {}
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (!need(1)) return 0;
+            uint8_t b = *p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        good = false;
+        return 0;
+    }
+    uint64_t fixed64() {
+        if (!need(8)) return 0;
+        uint64_t v = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::memcpy(&v, p, 8);
+        p += 8;
+#else
+        for (int i = 0; i < 8; ++i) v |= (uint64_t)*p++ << (8 * i);
+#endif
+        return v;
+    }
+    void get(int& v) {
+        uint64_t z = varint();
+        v = (int)(int64_t)((z >> 1) ^ (~(z & 1) + 1));
+    }
+    void get(double& v) {
+        uint64_t bits = fixed64();
+        std::memcpy(&v, &bits, sizeof v);
+    }
+    void get(bool& v) {
+        v = need(1) && *p++ != 0;
+    }
+    void get(std::string_view& v) {
+        uint64_t n = varint();
+        if (!need(n)) {
+            v = {};
+            return;
+        }
+        v = std::string_view(reinterpret_cast<const char*>(p), n);
+        p += n;
+    }
+
+    bool ok() const { return good; }
+    // Everything read, nothing malformed.
+    bool done() const { return good && p == end; }
+};
+)";
+
+static const char* RIVET_RUNTIME_MAILBOX = R"(
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <tuple>
+
+// Bounded multi-producer / single-consumer ring (after Vyukov's bounded queue).
+// Each cell carries a sequence number so producers claim slots with one CAS and
+// the consumer never writes a shared index. The two positions live on separate
+// cache lines so producers and the consumer do not false-share.
+template <typename T>
+class MpscQueue {
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) size_t dequeue_pos = 0;
+
+public:
+    explicit MpscQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        cells.reset(new Cell[n]);
+        mask = n - 1;
+        for (size_t i = 0; i < n; ++i) cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    bool try_push(T&& v) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = std::move(v);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer side only.
+    bool try_pop(T& out) {
+        Cell& c = cells[dequeue_pos & mask];
+        size_t seq = c.seq.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(dequeue_pos + 1) < 0) return false;
+        out = std::move(c.value);
+        c.value = T();
+        c.seq.store(dequeue_pos + mask + 1, std::memory_order_release);
+        dequeue_pos++;
+        return true;
+    }
+
+    bool empty() const {
+        const Cell& c = cells[dequeue_pos & mask];
+        return (intptr_t)c.seq.load(std::memory_order_seq_cst) - (intptr_t)(dequeue_pos + 1) < 0;
+    }
+};
+
+using Task = std::function<void()>;
+
+// A node's inbox: the bounded ring plus a spill list. A thread that runs
+// handlers (actor thread, pool worker) must never wait for room -- two nodes
+// posting to each other's full inboxes would deadlock -- so its overflow is
+// spilled and counted instead. Any other thread gets `false` back and waits.
+class Mailbox {
+    MpscQueue<Task> ring;
+    std::mutex spill_mu;
+    std::deque<Task> spill;
+    std::atomic<size_t> spilled{0};
+    std::atomic<uint64_t> spill_total{0};
+
+public:
+    static inline thread_local bool executor_thread = false;
+
+    explicit Mailbox(size_t depth) : ring(depth) {}
+
+    bool push(Task& t) {
+        // While anything is spilled, keep appending there so a producer's
+        // messages stay in order.
+        if (spilled.load() == 0 && ring.try_push(std::move(t))) return true;
+        if (!executor_thread) return false;
+        std::lock_guard<std::mutex> lock(spill_mu);
+        spill.push_back(std::move(t));
+        spilled.fetch_add(1);
+        spill_total.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side only.
+    bool try_pop(Task& out) {
+        if (ring.try_pop(out)) return true;
+        if (spilled.load() == 0) return false;
+        std::lock_guard<std::mutex> lock(spill_mu);
+        if (spill.empty()) return false;
+        out = std::move(spill.front());
+        spill.pop_front();
+        spilled.fetch_sub(1);
+        return true;
+    }
+
+    bool empty() const { return ring.empty() && spilled.load() == 0; }
+    size_t capacity() const { return ring.capacity(); }
+    uint64_t spills() const { return spill_total.load(std::memory_order_relaxed); }
+};
+
+// Waits until no node has mail or a handler in flight, or until `limit`
+// passes. Handlers post to one another, so a pass over the nodes only counts if
+// no handler finished during it: a node that looked idle early in the pass may
+// have been posted to by one that finished later. Nothing else may post while
+// this runs (the caller stops timers and other sources first).
+template <typename N>
+bool drain(const std::vector<N*>& nodes, std::chrono::nanoseconds limit) {
+    const int64_t end = Clock::now_ns() + (int64_t)limit.count();
+    for (;;) {
+        uint64_t before = 0, after = 0;
+        bool idle = true;
+        for (N* n : nodes) before += n->handled_count();
+        for (N* n : nodes) idle = idle && n->idle();
+        for (N* n : nodes) after += n->handled_count();
+        if (idle && before == after) return true;
+        if (Clock::now_ns() >= end) return false;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+// Queues `(node->*fn)(args...)` on the node's executor. Arguments are decayed and
+// captured by value, so the call can run on another thread later.
+template <typename N, typename R, typename... P, typename... A>
+void post_call(N* node, R (N::*fn)(P...), A&&... args) {
+    node->post([node, fn, tup = std::make_tuple(std::decay_t<A>(std::forward<A>(args))...)]() mutable {
+        std::apply([&](auto&... a) { (node->*fn)(a...); }, tup);
+    });
+}
+)";
+
+static const char* RIVET_RUNTIME_ACTOR = R"(
+// One mailbox and one thread per node. Handlers posted to an actor run in
+// order, on its thread, one at a time.
+class Actor {
+    Mailbox mailbox;
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::atomic<bool> parked{false};
+    std::mutex park_mu;
+    std::condition_variable park_cv;
+    std::atomic<uint64_t> posted{0};
+    std::atomic<uint64_t> handled{0}; // written by the actor thread only
+
+    void run() {
+        Mailbox::executor_thread = true;
+        Task t;
+        for (;;) {
+            if (mailbox.try_pop(t)) {
+                t();
+                t = nullptr;
+                handled.store(handled.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+                continue;
+            }
+            if (!running.load()) return; // stopped and drained
+            bool got = false;
+            for (int spin = 0; spin < 64 && !got; ++spin) {
+                std::this_thread::yield();
+                got = !mailbox.empty();
+            }
+            if (got) continue;
+            std::unique_lock<std::mutex> lock(park_mu);
+            parked.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!mailbox.empty() || !running.load()) { parked.store(false); continue; }
+            park_cv.wait(lock, [&] { return !parked.load(); });
+        }
+    }
+
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.exchange(false)) {
+            std::lock_guard<std::mutex> lock(park_mu);
+            park_cv.notify_one();
+        }
+    }
+
+public:
+    explicit Actor(size_t queue_depth) : mailbox(queue_depth) {}
+    ~Actor() { stop(); }
+    Actor(const Actor&) = delete;
+    Actor& operator=(const Actor&) = delete;
+
+    bool on_actor_thread() const { return worker.get_id() == std::this_thread::get_id(); }
+
+    void post(Task t) {
+        posted.fetch_add(1, std::memory_order_relaxed);
+        while (!mailbox.push(t)) {
+            wake();
+            std::this_thread::yield();
+        }
+        wake();
+    }
+
+    uint64_t mailbox_spills() const { return mailbox.spills(); }
+    uint64_t handled_count() const { return handled.load(std::memory_order_acquire); }
+    bool idle() const { return posted.load() == handled_count(); }
+
+    void start() {
+        running.store(true);
+        worker = std::thread([this] { run(); });
+    }
+
+    // Lets the mailbox drain, then joins the thread.
+    void stop() {
+        if (!worker.joinable()) return;
+        running.store(false);
+        wake();
+        if (on_actor_thread()) worker.detach();
+        else worker.join();
+    }
+};
+)";
+
+static const char* RIVET_RUNTIME_POOL = R"(
+#include <cstdlib>
+#include <random>
+
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient Work-Stealing
+// for Weak Memory Models"). The owning worker pushes and pops at the bottom;
+// thieves take from the top. Outgrown arrays are kept until the deque dies
+// because a thief may still be reading them.
+template <typename T>
+class WorkStealingDeque {
+    struct Array {
+        int64_t cap;
+        std::unique_ptr<std::atomic<T>[]> buf;
+        explicit Array(int64_t c) : cap(c), buf(new std::atomic<T>[c]) {}
+        // Acquire/release on the slots (free on x86) so a node handed from one
+        // worker to another carries its mailbox state with it.
+        T get(int64_t i) const { return buf[i & (cap - 1)].load(std::memory_order_acquire); }
+        void put(int64_t i, T v) { buf[i & (cap - 1)].store(v, std::memory_order_release); }
+    };
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Array*> array;
+    std::vector<std::unique_ptr<Array>> arrays; // owner only
+
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256) {
+        arrays.emplace_back(new Array(capacity));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    bool empty() const {
+        return bottom.load(std::memory_order_seq_cst) <= top.load(std::memory_order_seq_cst);
+    }
+
+    void push(T x) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t > a->cap - 1) {
+            auto* bigger = new Array(a->cap * 2);
+            for (int64_t i = t; i < b; ++i) bigger->put(i, a->get(i));
+            arrays.emplace_back(bigger);
+            array.store(bigger, std::memory_order_release);
+            a = bigger;
+        }
+        a->put(b, x);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    T pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return T();
+        }
+        T x = a->get(b);
+        if (t == b) {
+            // Last element: race the thieves for it.
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                x = T();
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    T steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return T();
+        Array* a = array.load(std::memory_order_acquire);
+        T x = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return T();
+        return x;
+    }
+};
+
+class PooledNode;
+
+// Fixed set of workers, one per core by default (RIVET_WORKERS overrides).
+// The unit of work is a node with pending mail; a node is queued on at most one
+// deque at a time, which is what keeps its handlers serialized.
+class Pool {
+public:
+    struct WorkerStats {
+        std::atomic<uint64_t> slices{0};
+        std::atomic<uint64_t> tasks{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> failed_steals{0};
+    };
+
+    static Pool& instance() {
+        static Pool pool;
+        return pool;
+    }
+
+    void start(size_t n) {
+        if (n == 0) n = 1;
+        for (size_t i = 0; i < n; ++i) workers.emplace_back(new Worker());
+        for (size_t i = 0; i < n; ++i) workers[i]->thread = std::thread([this, i] { run(i); });
+    }
+
+    void stop() {
+        stopping.store(true);
+        wake_all();
+        for (auto& w : workers) if (w->thread.joinable()) w->thread.join();
+    }
+
+    size_t worker_count() const { return workers.size(); }
+    const WorkerStats& stats(size_t i) const { return workers[i]->stats; }
+
+    void dump_stats(std::ostream& out) const {
+        uint64_t total_tasks = 0, total_steals = 0;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            const auto& s = workers[i]->stats;
+            out << "[POOL] worker " << i << ": slices=" << s.slices.load() << " tasks=" << s.tasks.load()
+                << " steals=" << s.steals.load() << " failed_steals=" << s.failed_steals.load() << "\n";
+            total_tasks += s.tasks.load();
+            total_steals += s.steals.load();
+        }
+        out << "[POOL] " << workers.size() << " workers, " << total_tasks << " tasks, "
+            << total_steals << " steals, " << injected.load() << " injected" << std::endl;
+    }
+
+    inline void schedule(PooledNode* n);
+
+private:
+    struct Worker {
+        WorkStealingDeque<PooledNode*> deque;
+        WorkerStats stats;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex inject_mu;
+    std::vector<PooledNode*> inject; // from threads that are not workers
+    std::atomic<uint64_t> injected{0};
+    std::atomic<bool> stopping{false};
+
+    std::mutex sleep_mu;
+    std::condition_variable sleep_cv;
+    std::atomic<uint64_t> work_epoch{0};
+    std::atomic<int> sleepers{0};
+
+    static inline thread_local int current_worker = -1;
+
+    void wake_one() {
+        work_epoch.fetch_add(1);
+        if (sleepers.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleep_mu);
+            sleep_cv.notify_one();
+        }
+    }
+    void wake_all() {
+        work_epoch.fetch_add(1);
+        std::lock_guard<std::mutex> lock(sleep_mu);
+        sleep_cv.notify_all();
+    }
+
+    PooledNode* take_injected() {
+        std::lock_guard<std::mutex> lock(inject_mu);
+        if (inject.empty()) return nullptr;
+        PooledNode* n = inject.front();
+        inject.erase(inject.begin());
+        return n;
+    }
+
+    PooledNode* find_work(size_t self, std::minstd_rand& rng) {
+        if (PooledNode* n = workers[self]->deque.pop()) return n;
+        if (PooledNode* n = take_injected()) return n;
+        size_t count = workers.size();
+        for (size_t k = 0; k < count; ++k) {
+            size_t victim = (rng() + k) % count;
+            if (victim == self) continue;
+            if (workers[victim]->deque.empty()) continue;
+            if (PooledNode* n = workers[victim]->deque.steal()) {
+                workers[self]->stats.steals.fetch_add(1, std::memory_order_relaxed);
+                return n;
+            }
+            workers[self]->stats.failed_steals.fetch_add(1, std::memory_order_relaxed);
+        }
+        return nullptr;
+    }
+
+    inline void run(size_t self);
+};
+
+// A node whose handlers are scheduled on the shared Pool. `pending` counts
+// posted-but-unfinished handlers: the producer that lifts it from zero queues
+// the node, and the worker that brings it back to zero gives it up, so at most
+// one worker ever holds a node.
+class PooledNode {
+    friend class Pool;
+    Mailbox mailbox;
+    std::atomic<int64_t> pending{0};
+    std::atomic<uint64_t> handled{0}; // written by whichever worker holds the node
+    static constexpr int kSliceBudget = 64;
+
+    // Runs up to kSliceBudget handlers and returns how many ran. Requeues the
+    // node if more mail arrived in the meantime.
+    int run_slice() {
+        Task t;
+        int n = 0;
+        while (n < kSliceBudget && mailbox.try_pop(t)) { t(); t = nullptr; n++; }
+        handled.store(handled.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        if (pending.fetch_sub(n) - n > 0) Pool::instance().schedule(this);
+        return n;
+    }
+
+public:
+    explicit PooledNode(size_t queue_depth) : mailbox(queue_depth) {}
+    PooledNode(const PooledNode&) = delete;
+    PooledNode& operator=(const PooledNode&) = delete;
+
+    uint64_t mailbox_spills() const { return mailbox.spills(); }
+    uint64_t handled_count() const { return handled.load(std::memory_order_acquire); }
+    bool idle() const { return pending.load() == 0; }
+
+    void post(Task t) {
+        while (!mailbox.push(t)) std::this_thread::yield();
+        if (pending.fetch_add(1) == 0) Pool::instance().schedule(this);
+    }
+};
+
+void Pool::schedule(PooledNode* n) {
+    if (current_worker >= 0) {
+        workers[current_worker]->deque.push(n);
+    } else {
+        std::lock_guard<std::mutex> lock(inject_mu);
+        inject.push_back(n);
+        injected.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake_one();
+}
+
+void Pool::run(size_t self) {
+    current_worker = (int)self;
+    Mailbox::executor_thread = true;
+    std::minstd_rand rng((unsigned)self * 7919u + 1u);
+    auto& st = workers[self]->stats;
+    while (!stopping.load()) {
+        uint64_t epoch = work_epoch.load();
+        if (PooledNode* n = find_work(self, rng)) {
+            st.slices.fetch_add(1, std::memory_order_relaxed);
+            st.tasks.fetch_add(n->run_slice(), std::memory_order_relaxed);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mu);
+        sleepers.fetch_add(1);
+        sleep_cv.wait(lock, [&] { return work_epoch.load() != epoch || stopping.load(); });
+        sleepers.fetch_sub(1);
+    }
+}
+
+// RIVET_WORKERS=<n> overrides the default of one worker per hardware thread.
+inline size_t pool_worker_count() {
+    if (const char* env = std::getenv("RIVET_WORKERS")) {
+        long n = std::atol(env);
+        if (n > 0) return (size_t)n;
+    }
+    size_t hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+)";
+
+static const char* RIVET_RUNTIME_STATIC = R"(
+// --dispatch=static: a topic's listeners are fixed when the program is
+// generated, so each topic owns a constexpr table of plain function pointers
+// and a bitmask saying which entries are live. Mode changes flip bits instead
+// of rebuilding subscriber lists, and publish() expands into one direct,
+// inlinable call per table entry.
+template <typename T>
+using StaticHandler = void (*)(const Payload<T>&);
+
+template <typename T, size_t N, const StaticHandler<T>* Table>
+class StaticTopic {
+    static constexpr size_t Words = N ? (N + 63) / 64 : 1;
+    std::atomic<uint64_t> enabled[Words] = {};
+
+    template <size_t... I>
+    void dispatch(const Payload<T>& msg, std::index_sequence<I...>) {
+        uint64_t live[Words];
+        for (size_t w = 0; w < Words; ++w) live[w] = enabled[w].load(std::memory_order_acquire);
+        ((live[I / 64] >> (I % 64) & 1 ? Table[I](msg) : void()), ...);
+    }
+
+public:
+    using value_type = T;
+
+    StaticTopic() = default;
+    StaticTopic(const StaticTopic&) = delete;
+    StaticTopic& operator=(const StaticTopic&) = delete;
+
+    void enable(size_t slot) { enabled[slot / 64].fetch_or(uint64_t(1) << (slot % 64)); }
+    // Sets the bits of `scope` in word `w` to those of `on`, flipping only
+    // the ones that differ. A node assigns only its own slots, from its own
+    // executor, so no one else moves them between the load and the flip.
+    void assign(size_t w, uint64_t scope, uint64_t on) {
+        const uint64_t flip = (enabled[w].load(std::memory_order_relaxed) ^ on) & scope;
+        if (flip) enabled[w].fetch_xor(flip, std::memory_order_release);
+    }
+
+    void publish(const T& val) {
+        if constexpr (N > 0) {
+            Payload<T> msg(val);
+            dispatch(msg, std::make_index_sequence<N>{});
+        } else {
+            (void)val;
+        }
+    }
+};
+)";
+
+static const char* RIVET_RUNTIME_TIMERS = R"(
+#include <cstdlib>
+#include <deque>
+#include <map>
+
+// Hierarchical timing wheel (after Varghese & Lauck) behind `every` timers.
+// Four levels of 64 slots at 100 us resolution reach ~28 minutes (longer
+// timers park in the top level and are re-placed as it turns); a timer sits in
+// the level that matches how far off it is and cascades down as the wheel
+// turns, so start and cancel are O(1) list splices whatever the timer count.
+// Timers live in a slab addressed by index + generation, so a stale Id never
+// touches a reused slot. The main thread's event loop turns the wheel and runs
+// callbacks; any thread may start or cancel. Statistics are kept per label, i.e. per
+// `every` declaration, across the mode entries that restart it.
+class Timers {
+public:
+    using Id = uint64_t;
+    using Callback = std::function<void(Id)>;
+
+    struct Stats {
+        const char* label = "";
+        int64_t period_ns = 0;
+        uint64_t fires = 0;
+        uint64_t missed = 0;       // periods skipped because the wheel ran late
+        int64_t jitter_sum_ns = 0; // sum of (fire time - due time)
+        int64_t jitter_max_ns = 0;
+    };
+
+    static Timers& instance() {
+        static Timers t;
+        return t;
+    }
+
+    Id start(const char* label, int64_t period_ns, Callback cb);
+    // False if the timer had already been cancelled, or cancelled itself.
+    bool cancel(Id id);
+    bool stats(Id id, Stats& out);
+    void dump_stats(std::ostream& os);
+
+    // Runs every tick that is due and returns when the next busy one is
+    // (INT64_MAX if no timer is running).
+    int64_t advance();
+    // Called when start() adds a timer due before the time advance() last
+    // returned, so the loop can re-arm its wait.
+    void set_waker(std::function<void()> w) { waker = std::move(w); }
+
+private:
+    static constexpr int Levels = 4;
+    static constexpr int SlotBits = 6;
+    static constexpr int Slots = 1 << SlotBits;
+    static constexpr int64_t TickNs = 100000;
+    static constexpr int32_t None = -1;
+
+    struct Timer {
+        Callback cb;
+        Stats* st = nullptr;
+        int64_t period_ns = 0;
+        int64_t due_ns = 0;
+        uint64_t due_tick = 0;
+        uint32_t gen = 1;
+        bool active = false;
+        int32_t prev = None;
+        int32_t next = None;
+        int level = 0;
+        int slot = 0;
+    };
+
+    // Recursive: callbacks run under the lock and may start or cancel timers.
+    std::recursive_mutex mu;
+    std::function<void()> waker;
+    std::deque<Timer> slab; // deque: growing it never moves a running callback
+    std::vector<int32_t> free_slots;
+    std::vector<std::pair<int32_t, uint32_t>> due; // (slot, generation) firing this tick
+    std::map<std::string, Stats> totals;           // by label; nodes never move
+    int32_t heads[Levels][Slots];
+    const int64_t origin_ns = Clock::now_ns();
+    uint64_t now_tick = 0; // next tick to process
+    uint64_t armed_tick = 0; // what advance() last reported; 0 while it runs
+    size_t active_count = 0;
+    int32_t firing = None;
+    bool firing_cancelled = false;
+
+    Timers() {
+        for (auto& level : heads)
+            for (auto& h : level) h = None;
+    }
+
+    Timer* lookup(Id id) {
+        uint32_t idx = (uint32_t)id;
+        if (idx >= slab.size() || slab[idx].gen != (uint32_t)(id >> 32) || !slab[idx].active) return nullptr;
+        return &slab[idx];
+    }
+    uint64_t tick_at(int64_t ns) const { return (uint64_t)((ns - origin_ns + TickNs - 1) / TickNs); }
+    int64_t time_of(uint64_t tick) const { return origin_ns + (int64_t)tick * TickNs; }
+
+    void link(int32_t i);
+    void unlink(int32_t i);
+    void release(int32_t i);
+    void process_tick();
+    uint64_t next_busy_tick() const;
+};
+
+void Timers::link(int32_t i) {
+    Timer& t = slab[i];
+    uint64_t due = std::max(t.due_tick, now_tick);
+    uint64_t delta = due - now_tick;
+    int level = 0;
+    while (level < Levels - 1 && delta >= (uint64_t(1) << (SlotBits * (level + 1)))) ++level;
+    uint64_t horizon = uint64_t(1) << (SlotBits * Levels);
+    if (delta >= horizon) due = now_tick + horizon - 1; // re-placed when it cascades down
+    t.level = level;
+    t.slot = (int)((due >> (SlotBits * level)) & (Slots - 1));
+    t.prev = None;
+    t.next = heads[level][t.slot];
+    if (t.next != None) slab[t.next].prev = i;
+    heads[level][t.slot] = i;
+}
+
+void Timers::unlink(int32_t i) {
+    Timer& t = slab[i];
+    if (t.prev != None) slab[t.prev].next = t.next;
+    else heads[t.level][t.slot] = t.next;
+    if (t.next != None) slab[t.next].prev = t.prev;
+    t.prev = t.next = None;
+}
+
+void Timers::release(int32_t i) {
+    slab[i].cb = nullptr;
+    slab[i].gen++;
+    free_slots.push_back(i);
+}
+
+Timers::Id Timers::start(const char* label, int64_t period_ns, Callback cb) {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    int32_t i;
+    if (!free_slots.empty()) {
+        i = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        i = (int32_t)slab.size();
+        slab.emplace_back();
+    }
+    Timer& t = slab[i];
+    t.cb = std::move(cb);
+    auto it = totals.try_emplace(label).first;
+    t.st = &it->second;
+    t.st->label = it->first.c_str();
+    t.st->period_ns = period_ns;
+    t.period_ns = period_ns;
+    t.due_ns = Clock::now_ns() + period_ns;
+    t.due_tick = tick_at(t.due_ns);
+    t.active = true;
+    link(i);
+    active_count++;
+    if (t.due_tick < armed_tick && waker) waker();
+    return (uint64_t(t.gen) << 32) | (uint32_t)i;
+}
+
+bool Timers::cancel(Id id) {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    Timer* t = lookup(id);
+    if (!t) return false;
+    int32_t i = (int32_t)(uint32_t)id;
+    unlink(i);
+    t->active = false;
+    active_count--;
+    // A timer cancelled from its own callback is freed once the callback returns.
+    if (i == firing) firing_cancelled = true;
+    else release(i);
+    return true;
+}
+
+bool Timers::stats(Id id, Stats& out) {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    Timer* t = lookup(id);
+    if (!t) return false;
+    out = *t->st;
+    return true;
+}
+
+void Timers::dump_stats(std::ostream& os) {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    for (const auto& [label, st] : totals) {
+        int64_t avg = st.fires ? st.jitter_sum_ns / (int64_t)st.fires : 0;
+        os << "[TIMER] " << label << ": fires=" << st.fires << " missed=" << st.missed
+           << " jitter avg=" << avg / 1000 << "us max=" << st.jitter_max_ns / 1000 << "us\n";
+    }
+    os << std::flush;
+}
+
+void Timers::process_tick() {
+    // Cascade: at each 64^l boundary, level l's current slot moves down a level.
+    for (int level = 1; level < Levels; ++level) {
+        if (now_tick & ((uint64_t(1) << (SlotBits * level)) - 1)) break;
+        int slot = (int)((now_tick >> (SlotBits * level)) & (Slots - 1));
+        int32_t i = heads[level][slot];
+        heads[level][slot] = None;
+        while (i != None) {
+            int32_t next = slab[i].next;
+            link(i);
+            i = next;
+        }
+    }
+
+    // Fire everything due this tick. Detach the slot first: callbacks may
+    // start or cancel timers, including ones in this very list, and a slot
+    // cancelled and reused meanwhile must not fire as the new timer.
+    int slot = (int)(now_tick & (Slots - 1));
+    due.clear();
+    for (int32_t i = heads[0][slot]; i != None; i = slab[i].next) due.emplace_back(i, slab[i].gen);
+    heads[0][slot] = None;
+    for (auto [i, gen] : due) slab[i].prev = slab[i].next = None;
+
+    for (auto [i, gen] : due) {
+        Timer& t = slab[i];
+        if (!t.active || t.gen != gen) continue;
+        int64_t now = Clock::now_ns();
+        int64_t jitter = now - t.due_ns;
+        t.st->fires++;
+        t.st->jitter_sum_ns += jitter;
+        t.st->jitter_max_ns = std::max(t.st->jitter_max_ns, jitter);
+        // Next period counts from the due time, not the fire time, so the phase
+        // does not drift; periods already missed are skipped, not bunched up.
+        t.due_ns += t.period_ns;
+        while (t.due_ns <= now) {
+            t.due_ns += t.period_ns;
+            t.st->missed++;
+        }
+        t.due_tick = tick_at(t.due_ns); // > now_tick, since due_ns > now >= time_of(now_tick)
+        link(i);
+
+        firing = i;
+        firing_cancelled = false;
+        t.cb((uint64_t(t.gen) << 32) | (uint32_t)i);
+        firing = None;
+        if (firing_cancelled) release(i);
+    }
+    now_tick++;
+}
+
+// First tick with work: a non-empty level-0 slot, or a boundary at which a
+// non-empty higher-level slot cascades down. Empty stretches are slept over.
+uint64_t Timers::next_busy_tick() const {
+    uint64_t best = now_tick + (uint64_t(1) << (SlotBits * Levels));
+    for (int level = 0; level < Levels; ++level) {
+        uint64_t step = uint64_t(1) << (SlotBits * level);
+        uint64_t first = (now_tick + step - 1) & ~(step - 1);
+        for (uint64_t j = 0; j < (uint64_t)Slots; ++j) {
+            uint64_t tick = first + j * step;
+            if (tick >= best) break;
+            if (heads[level][(tick >> (SlotBits * level)) & (Slots - 1)] != None) {
+                best = tick;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+int64_t Timers::advance() {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    armed_tick = 0; // callbacks starting timers need not wake us
+    int64_t now = Clock::now_ns();
+    if (!active_count) now_tick = std::max(now_tick, tick_at(now)); // empty wheel: nothing to cascade
+    while (time_of(now_tick) <= now) process_tick();
+    if (!active_count) {
+        armed_tick = std::numeric_limits<uint64_t>::max();
+        return std::numeric_limits<int64_t>::max();
+    }
+    armed_tick = next_busy_tick();
+    return time_of(armed_tick);
+}
+)";
+
+static const char* RIVET_RUNTIME_LOOP = R"(
+#include <csignal>
+#include <cstdlib>
+#include <deque>
+#include <unordered_map>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// The main thread's event loop. Sources (the timer wheel, housekeeping) do
+// their due work and report their next deadline; the loop then waits for that
+// deadline, a cross-thread wake() or SIGINT/SIGTERM. On Linux the wait is one
+// epoll_wait over an eventfd, a timerfd armed to the deadline (epoll's own
+// timeout only has millisecond resolution), a signalfd and any descriptors
+// handed to watch(); elsewhere it is a condition variable and a plain signal
+// handler. RIVET_SPIN_US=<n> polls for up to n us before parking, for
+// deployments that would rather burn a core than pay a wakeup. Under --sim it
+// never waits: it moves the virtual clock to the deadline, and stops once
+// nothing is scheduled or RIVET_SIM_END_MS of virtual time have passed.
+class EventLoop {
+public:
+    using Source = std::function<int64_t()>; // returns next deadline in Clock ns, INT64_MAX for none
+    using FdHandler = std::function<void(uint32_t events)>;
+
+    struct Stats {
+        uint64_t iterations = 0;
+        uint64_t parks = 0;     // blocking waits
+        uint64_t spin_hits = 0; // waits ended by work arriving while spinning
+        uint64_t wakeups = 0;   // wake() calls that reached the loop
+    };
+
+    static EventLoop& instance() {
+        static EventLoop loop;
+        return loop;
+    }
+
+    // Main thread only, like watch()/unwatch().
+    void add_source(Source s) { sources.push_back(std::move(s)); }
+    // Runs `fn` on the loop every `period_ns`, phase-locked to the first call.
+    void every(int64_t period_ns, std::function<void()> fn);
+
+    // Any thread.
+    void post(std::function<void()> fn);
+    void wake();
+    void stop(int sig = 0);
+
+#if defined(__linux__) && !defined(RIVET_SIM)
+    void watch(int fd, uint32_t events, FdHandler h);
+    void unwatch(int fd);
+#endif
+
+    // Runs until stop() or a signal; returns the signal number, or 0.
+    int run();
+    const Stats& stats() const { return st; }
+    void dump_stats(std::ostream& os) const {
+        os << "[LOOP] iterations=" << st.iterations << " parks=" << st.parks << " spin_hits=" << st.spin_hits
+           << " wakeups=" << st.wakeups << std::endl;
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+private:
+    std::vector<Source> sources;
+    std::mutex posted_mu;
+    std::deque<std::function<void()>> posted;
+    std::atomic<bool> notified{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<int> stop_signal{0};
+    int64_t spin_ns = 0;
+    Stats st;
+
+#if defined(RIVET_SIM)
+    int64_t end_ns = std::numeric_limits<int64_t>::max();
+#elif defined(__linux__)
+    static constexpr int MaxEvents = 32;
+    int epfd = -1, evfd = -1, tfd = -1, sigfd = -1;
+    int64_t armed = -1;
+    uint64_t busy_turns = 0;
+    std::unordered_map<int, std::shared_ptr<FdHandler>> watched;
+
+    void arm(int64_t deadline);
+    void dispatch(const epoll_event* evs, int n);
+#else
+    std::mutex park_mu;
+    std::condition_variable park_cv;
+    static inline volatile std::sig_atomic_t caught = 0;
+    static void on_signal(int sig) { caught = sig; }
+#endif
+
+    EventLoop();
+    ~EventLoop();
+    void run_posted();
+    void wait_until(int64_t deadline);
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+};
+
+void EventLoop::every(int64_t period_ns, std::function<void()> fn) {
+    add_source([period_ns, fn = std::move(fn), next = Clock::now_ns() + period_ns]() mutable {
+        int64_t now = Clock::now_ns();
+        if (now < next) return next;
+        fn();
+        do next += period_ns; while (next <= now);
+        return next;
+    });
+}
+
+void EventLoop::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(posted_mu);
+        posted.push_back(std::move(fn));
+    }
+    wake();
+}
+
+void EventLoop::stop(int sig) {
+    if (sig) stop_signal.store(sig);
+    stopping.store(true);
+    wake();
+}
+
+void EventLoop::run_posted() {
+    std::deque<std::function<void()>> batch;
+    {
+        std::lock_guard<std::mutex> lock(posted_mu);
+        batch.swap(posted);
+    }
+    for (auto& fn : batch) fn();
+}
+
+int EventLoop::run() {
+    while (!stopping.load()) {
+        st.iterations++;
+        run_posted();
+        int64_t deadline = std::numeric_limits<int64_t>::max();
+        for (auto& s : sources) deadline = std::min(deadline, s());
+        if (stopping.load()) break;
+        wait_until(deadline);
+    }
+    return stop_signal.load();
+}
+
+#if defined(RIVET_SIM)
+EventLoop::EventLoop() {
+    if (const char* env = std::getenv("RIVET_SIM_END_MS")) end_ns = std::max(0L, std::atol(env)) * 1000000;
+}
+
+EventLoop::~EventLoop() {}
+
+void EventLoop::wake() { notified.store(true); }
+
+void EventLoop::wait_until(int64_t deadline) {
+    if (notified.exchange(false)) {
+        st.wakeups++;
+        return;
+    }
+    if (deadline == std::numeric_limits<int64_t>::max()) return stop(); // nothing left that could happen
+    if (deadline > end_ns) {
+        Clock::virtual_ns = std::max(Clock::virtual_ns, end_ns);
+        return stop();
+    }
+    st.parks++;
+    Clock::virtual_ns = std::max(Clock::virtual_ns, deadline);
+}
+#elif defined(__linux__)
+EventLoop::EventLoop() {
+    // Block the stop signals before any other thread exists, so every thread
+    // inherits the mask and they are only ever delivered through the signalfd.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epfd < 0 || evfd < 0 || tfd < 0 || sigfd < 0) {
+        std::cerr << "[LOOP] cannot create epoll/eventfd/timerfd/signalfd" << std::endl;
+        std::abort();
+    }
+    for (int fd : {evfd, tfd, sigfd}) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if (const char* env = std::getenv("RIVET_SPIN_US")) spin_ns = std::max(0L, std::atol(env)) * 1000;
+}
+
+EventLoop::~EventLoop() {
+    for (int fd : {sigfd, tfd, evfd, epfd})
+        if (fd >= 0) close(fd);
+}
+
+void EventLoop::watch(int fd, uint32_t events, FdHandler h) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    bool known = watched.count(fd) != 0;
+    watched[fd] = std::make_shared<FdHandler>(std::move(h));
+    epoll_ctl(epfd, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+}
+
+void EventLoop::unwatch(int fd) {
+    if (watched.erase(fd)) epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+// Coalesced: one eventfd write until the loop has seen it.
+void EventLoop::wake() {
+    if (notified.exchange(true)) return;
+    uint64_t one = 1;
+    ssize_t r = write(evfd, &one, sizeof one);
+    (void)r;
+}
+
+void EventLoop::arm(int64_t deadline) {
+    if (deadline == armed) return;
+    armed = deadline;
+    itimerspec its{}; // all zero disarms
+    if (deadline != std::numeric_limits<int64_t>::max()) {
+        int64_t rel = std::max<int64_t>(deadline - Clock::now_ns(), 1);
+        its.it_value.tv_sec = rel / 1000000000;
+        its.it_value.tv_nsec = rel % 1000000000;
+    }
+    timerfd_settime(tfd, 0, &its, nullptr);
+}
+
+void EventLoop::wait_until(int64_t deadline) {
+    epoll_event evs[MaxEvents];
+    int n = 0;
+    if (spin_ns > 0) {
+        const int64_t spin_end = std::min(deadline, Clock::now_ns() + spin_ns);
+        for (unsigned i = 1; n == 0; ++i) {
+            // The flag is free to read; descriptors and signals cost a syscall.
+            if (notified.load(std::memory_order_acquire) || i % 64 == 0) {
+                n = epoll_wait(epfd, evs, MaxEvents, 0);
+                if (n > 0) st.spin_hits++;
+            }
+            if (n == 0 && Clock::now_ns() >= spin_end) break;
+            cpu_relax();
+        }
+    }
+    if (n == 0) {
+        if (Clock::now_ns() >= deadline) {
+            // A loop that never parks still notices signals and descriptors.
+            if (++busy_turns % 64 == 0 && (n = epoll_wait(epfd, evs, MaxEvents, 0)) > 0) dispatch(evs, n);
+            return;
+        }
+        arm(deadline);
+        st.parks++;
+        n = epoll_wait(epfd, evs, MaxEvents, -1);
+    }
+    if (n > 0) dispatch(evs, n);
+}
+
+void EventLoop::dispatch(const epoll_event* evs, int n) {
+    for (int i = 0; i < n; ++i) {
+        int fd = evs[i].data.fd;
+        if (fd == evfd) {
+            uint64_t v;
+            ssize_t r = read(evfd, &v, sizeof v);
+            (void)r;
+            notified.store(false); // before run_posted(), so a later post() writes again
+            st.wakeups++;
+        } else if (fd == tfd) {
+            uint64_t v;
+            ssize_t r = read(tfd, &v, sizeof v);
+            (void)r;
+            armed = -1;
+        } else if (fd == sigfd) {
+            signalfd_siginfo si;
+            while (read(sigfd, &si, sizeof si) == (ssize_t)sizeof si) stop((int)si.ssi_signo);
+        } else {
+            auto it = watched.find(fd);
+            if (it == watched.end()) continue;
+            auto h = it->second; // the handler may unwatch itself
+            (*h)(evs[i].events);
+        }
+    }
+}
+#else
+EventLoop::EventLoop() {
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    if (const char* env = std::getenv("RIVET_SPIN_US")) spin_ns = std::max(0L, std::atol(env)) * 1000;
+}
+
+EventLoop::~EventLoop() {}
+
+void EventLoop::wake() {
+    if (notified.exchange(true)) return;
+    std::lock_guard<std::mutex> lock(park_mu);
+    park_cv.notify_one();
+}
+
+void EventLoop::wait_until(int64_t deadline) {
+    if (spin_ns > 0) {
+        const int64_t spin_end = std::min(deadline, Clock::now_ns() + spin_ns);
+        while (!notified.load() && !caught && Clock::now_ns() < spin_end) cpu_relax();
+        if (notified.load() || caught) st.spin_hits++;
+    }
+    std::unique_lock<std::mutex> lock(park_mu);
+    int64_t now = Clock::now_ns();
+    if (!notified.load() && !caught && now < deadline) {
+        // A signal handler cannot notify a condition variable, so the flag it
+        // sets is polled at least every 20 ms.
+        int64_t until = std::min(deadline, now + 20000000);
+        st.parks++;
+        park_cv.wait_for(lock, std::chrono::nanoseconds(until - now), [&] { return notified.load() || caught; });
+    }
+    if (notified.exchange(false)) st.wakeups++;
+    if (caught) stop(caught);
+}
+#endif
+
+inline const char* signal_name(int sig) {
+    switch (sig) {
+        case SIGINT: return "SIGINT";
+        case SIGTERM: return "SIGTERM";
+        default: return "stop request";
+    }
+}
+
+// RIVET_SHUTDOWN_MS=<n> bounds how long shutdown waits for queues to drain
+// (default 2000).
+inline std::chrono::milliseconds shutdown_timeout() {
+    if (const char* env = std::getenv("RIVET_SHUTDOWN_MS")) {
+        long n = std::atol(env);
+        if (n >= 0) return std::chrono::milliseconds(n);
+    }
+    return std::chrono::milliseconds(2000);
+}
+)";
+
+static const char* RIVET_RUNTIME_SHM = R"(
+#if !defined(__linux__)
+#error "--transport=shm needs Linux: POSIX shared memory and futexes"
+#endif
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <deque>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Which nodes this process runs: RIVET_NODES=<Name,Name,...>, default all.
+// Every process still constructs every node, but only hosted ones are
+// initialised, subscribed, timed and told about system transitions; the
+// others are inert stand-ins whose topics are fed from shared memory.
+class Deployment {
+    static const std::vector<std::string>& selected() {
+        static const std::vector<std::string> names = [] {
+            std::vector<std::string> out;
+            if (const char* env = std::getenv("RIVET_NODES")) {
+                std::stringstream ss(env);
+                std::string name;
+                while (std::getline(ss, name, ','))
+                    if (!name.empty()) out.push_back(name);
+            }
+            return out;
+        }();
+        return names;
+    }
+
+public:
+    static bool partitioned() { return !selected().empty(); }
+    static bool hosts(const std::string& node) {
+        const auto& names = selected();
+        return names.empty() || std::find(names.begin(), names.end(), node) != names.end();
+    }
+};
+
+// Traffic across one process boundary -- a topic written to a ring, or a
+// request sent to another process -- so the cost of each cut can be read off.
+// Send times are only measured with RIVET_IPC_STATS set.
+struct IpcStat {
+    std::string label;
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> send_ns{0};
+    std::atomic<uint64_t> dropped{0};
+
+    void count(size_t n, int64_t started) {
+        messages.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(n, std::memory_order_relaxed);
+        if (started) send_ns.fetch_add((uint64_t)(Clock::now_ns() - started), std::memory_order_relaxed);
+    }
+};
+
+class IpcStats {
+    static std::mutex& mu() {
+        static std::mutex m;
+        return m;
+    }
+    static std::deque<IpcStat>& all() {
+        static std::deque<IpcStat> stats; // deque: references stay valid
+        return stats;
+    }
+
+public:
+    static bool timing() {
+        static const bool on = std::getenv("RIVET_IPC_STATS") != nullptr;
+        return on;
+    }
+    static int64_t start() { return timing() ? Clock::now_ns() : 0; }
+
+    static IpcStat& get(const std::string& label) {
+        std::lock_guard<std::mutex> lock(mu());
+        for (auto& st : all())
+            if (st.label == label) return st;
+        all().emplace_back();
+        all().back().label = label;
+        return all().back();
+    }
+
+    static void dump(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mu());
+        for (const auto& st : all()) {
+            uint64_t n = st.messages.load(std::memory_order_relaxed);
+            uint64_t avg = n ? st.send_ns.load(std::memory_order_relaxed) / n : 0;
+            os << "[IPC] " << st.label << ": messages=" << n << " bytes=" << st.bytes.load(std::memory_order_relaxed)
+               << " dropped=" << st.dropped.load(std::memory_order_relaxed) << " send avg=" << avg << "ns\n";
+        }
+        os << std::flush;
+    }
+};
+
+// How a payload sits in a ring slot. Trivially copyable values are copied
+// bytewise; strings are length-prefixed and cut at MaxLen bytes.
+template <typename T, typename = void>
+struct ShmCodec {
+    static_assert(std::is_trivially_copyable_v<T>, "no shared-memory layout for this type");
+    static constexpr size_t Words = (sizeof(T) + 7) / 8;
+    static constexpr const char* name = "pod";
+    // False if `v` had to be cut to fit the slot.
+    static bool encode(const T& v, uint64_t* w) {
+        std::memset(w, 0, Words * 8);
+        std::memcpy(w, &v, sizeof(T));
+        return true;
+    }
+    static void decode(const uint64_t* w, T& v) { std::memcpy(&v, w, sizeof(T)); }
+};
+
+template <>
+struct ShmCodec<std::string> {
+    static constexpr size_t Words = 32;
+    static constexpr size_t MaxLen = Words * 8 - 8;
+    static constexpr const char* name = "string";
+    static bool encode(const std::string& v, uint64_t* w) {
+        uint64_t len = std::min(v.size(), MaxLen);
+        std::memset(w, 0, Words * 8);
+        w[0] = len;
+        std::memcpy(w + 1, v.data(), len);
+        return len == v.size();
+    }
+    static void decode(const uint64_t* w, std::string& v) {
+        v.assign(reinterpret_cast<const char*>(w + 1), (size_t)std::min<uint64_t>(w[0], MaxLen));
+    }
+};
+
+// One topic's segment: a broadcast ring in POSIX shared memory with a single
+// writer (the process hosting the topic's node) and any number of readers,
+// each keeping its own cursor in its own memory. Every slot is a seqlock
+// stamped with the sequence number written into it, so a reader can tell
+// "not written yet" from "overwritten since" and never needs the writer's
+// permission: a slow or crashed reader costs the writer nothing, and readers
+// survive the writer restarting because the head lives in the segment.
+// Readers that fall a whole ring behind skip ahead and count the loss.
+// Wakeups go through a futex word in the segment, and the writer only makes
+// the syscall when someone is asleep on it.
+class ShmRing {
+    static constexpr uint32_t Magic = 0x52565431; // "RVT1"
+    static constexpr uint32_t Slots = 1024;
+
+    struct Header {
+        std::atomic<uint32_t> magic;
+        uint32_t slots;
+        uint32_t words;
+        uint32_t stride;
+        uint64_t tag;
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint32_t> futex;
+        std::atomic<uint32_t> waiters;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                  "shared-memory atomics must be lock-free");
+
+    Header* hdr = nullptr;
+    char* base = nullptr;
+    size_t bytes = 0;
+    uint32_t words = 0;
+    uint32_t stride = 0;
+
+    std::atomic<uint64_t>& seq_of(uint64_t s) const {
+        return *reinterpret_cast<std::atomic<uint64_t>*>(base + (s & (Slots - 1)) * stride);
+    }
+    std::atomic<uint64_t>* data_of(uint64_t s) const { return &seq_of(s) + 1; }
+
+    static long futex(std::atomic<uint32_t>* addr, int op, uint32_t val, const timespec* ts) {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), op, val, ts, nullptr, 0);
+    }
+
+public:
+    ShmRing() = default;
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+    ~ShmRing() {
+        if (hdr) munmap(hdr, bytes);
+    }
+
+    // Creates the segment, or attaches to the one another process created.
+    // `tag` names the topic and payload layout; a segment left behind by a
+    // different program or version is refused rather than misread.
+    bool open(const std::string& name, uint32_t payload_words, uint64_t tag) {
+        words = payload_words;
+        stride = (uint32_t)(((1 + words) * 8 + 63) / 64 * 64);
+        size_t header = (sizeof(Header) + 63) / 64 * 64;
+        bytes = header + (size_t)Slots * stride;
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        bool creator = fd >= 0;
+        if (!creator) fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0 || (creator && ftruncate(fd, (off_t)bytes) != 0)) {
+            std::cerr << "[SHM] " << name << ": " << std::strerror(errno) << std::endl;
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        // The creator may still be sizing and stamping the segment.
+        const int64_t give_up = Clock::now_ns() + 1000000000;
+        struct stat st {};
+        while (!creator && fstat(fd, &st) == 0 && (size_t)st.st_size < bytes && Clock::now_ns() < give_up)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        void* mem = (creator || (size_t)st.st_size >= bytes)
+                        ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                        : MAP_FAILED;
+        close(fd);
+        if (mem == MAP_FAILED) {
+            std::cerr << "[SHM] " << name << ": segment has the wrong size; remove /dev/shm" << name << std::endl;
+            return false;
+        }
+        hdr = static_cast<Header*>(mem);
+        base = static_cast<char*>(mem) + header;
+        if (creator) {
+            hdr->slots = Slots;
+            hdr->words = words;
+            hdr->stride = stride;
+            hdr->tag = tag;
+            hdr->magic.store(Magic, std::memory_order_release);
+            return true;
+        }
+        while (hdr->magic.load(std::memory_order_acquire) != Magic && Clock::now_ns() < give_up)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (hdr->magic.load(std::memory_order_acquire) != Magic || hdr->slots != Slots || hdr->words != words ||
+            hdr->stride != stride || hdr->tag != tag) {
+            std::cerr << "[SHM] " << name << ": segment belongs to another topic or build; remove /dev/shm" << name
+                      << std::endl;
+            munmap(hdr, bytes);
+            hdr = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    // Writer side; one writer per segment.
+    void write(const uint64_t* w) {
+        uint64_t s = hdr->head.load(std::memory_order_relaxed);
+        auto& seq = seq_of(s);
+        auto* data = data_of(s);
+        seq.store(2 * s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (uint32_t i = 0; i < words; ++i) data[i].store(w[i], std::memory_order_relaxed);
+        seq.store(2 * s + 2, std::memory_order_release);
+        hdr->head.store(s + 1, std::memory_order_release);
+        hdr->futex.fetch_add(1);
+        if (hdr->waiters.load() > 0) futex(&hdr->futex, FUTEX_WAKE, INT_MAX, nullptr);
+    }
+
+    // Reads the sample at `cursor` and advances it. False if nothing new.
+    bool read(uint64_t& cursor, uint64_t* w, uint64_t& lost) const {
+        for (;;) {
+            auto& seq = seq_of(cursor);
+            uint64_t s = seq.load(std::memory_order_acquire);
+            if (s < 2 * cursor + 2) return false; // not written (or still being written)
+            if (s == 2 * cursor + 2) {
+                const auto* data = data_of(cursor);
+                for (uint32_t i = 0; i < words; ++i) w[i] = data[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq.load(std::memory_order_relaxed) == s) {
+                    cursor++;
+                    return true;
+                }
+            }
+            // Lapped: resume at the oldest slot the writer cannot be touching.
+            uint64_t head = hdr->head.load(std::memory_order_acquire);
+            uint64_t oldest = head >= Slots ? head - Slots + 1 : 0;
+            if (oldest > cursor) {
+                lost += oldest - cursor;
+                cursor = oldest;
+            }
+        }
+    }
+
+    uint64_t head() const { return hdr->head.load(std::memory_order_acquire); }
+    uint32_t ticket() const { return hdr->futex.load(); }
+
+    // Waits until a write after ticket() was taken, spinning for `spin_ns`
+    // first. Gives up after `timeout_ns` so the caller can check for shutdown.
+    void wait(uint32_t ticket, int64_t spin_ns, int64_t timeout_ns) {
+        if (spin_ns > 0) {
+            const int64_t end = Clock::now_ns() + spin_ns;
+            while (hdr->futex.load(std::memory_order_acquire) == ticket && Clock::now_ns() < end)
+                std::this_thread::yield();
+        }
+        if (hdr->futex.load() != ticket) return;
+        timespec ts{(time_t)(timeout_ns / 1000000000), (long)(timeout_ns % 1000000000)};
+        hdr->waiters.fetch_add(1);
+        futex(&hdr->futex, FUTEX_WAIT, ticket, &ts);
+        hdr->waiters.fetch_sub(1);
+    }
+
+    void wake_all() { futex(&hdr->futex, FUTEX_WAKE, INT_MAX, nullptr); }
+};
+
+// What the transport reports about a writer at shutdown.
+struct ShmWriterBase {
+    std::string name;
+    std::atomic<uint64_t> truncated{0}; // samples cut to fit a slot
+};
+
+template <typename T>
+class ShmWriter : public ShmWriterBase {
+    ShmRing ring;
+    IpcStat* st = nullptr;
+
+public:
+    bool open(const std::string& segment, uint64_t tag, IpcStat& stat) {
+        name = segment;
+        st = &stat;
+        return ring.open(segment, ShmCodec<T>::Words, tag);
+    }
+    void write(const T& v) {
+        int64_t started = IpcStats::start();
+        uint64_t w[ShmCodec<T>::Words];
+        if (!ShmCodec<T>::encode(v, w)) truncated.fetch_add(1, std::memory_order_relaxed);
+        ring.write(w);
+        st->count(sizeof w, started);
+    }
+};
+
+// A topic that may have listeners in other processes. The process hosting its
+// node attaches a writer; everywhere else it behaves like the plain topic.
+template <typename TopicT>
+class Shared : public TopicT {
+    using T = typename TopicT::value_type;
+    ShmWriter<T>* out = nullptr;
+
+public:
+    void export_to(ShmWriter<T>* w) { out = w; }
+    void publish(const T& val) {
+        if (out) out->write(val); // remote readers first: local handlers may run long
+        TopicT::publish(val);
+    }
+};
+
+// Owns this process's segments and the threads that bring remote topics in.
+// With the inline executor a thread only wakes the event loop, which drains
+// the ring and publishes on the main thread like any other handler; with actor
+// and pool executors the thread publishes itself, since that only queues.
+// Every topic has its own ring and thread, so samples keep their order within
+// a topic but not across topics, even when one node published both.
+class ShmTransport {
+    static constexpr size_t MaxWords = ShmCodec<std::string>::Words;
+
+    struct Import {
+        std::string name;
+        ShmRing ring;
+        uint64_t cursor = 0; // owned by whoever drains
+        uint64_t lost = 0;
+        std::atomic<bool> queued{false};
+        std::function<void(const uint64_t*)> deliver;
+        std::thread thread;
+
+        void drain() {
+            uint64_t w[MaxWords];
+            while (ring.read(cursor, w, lost)) deliver(w);
+        }
+    };
+
+    std::string prefix = "rivet";
+    std::vector<std::unique_ptr<Import>> imports;
+    std::vector<std::shared_ptr<ShmWriterBase>> writers;
+    std::atomic<bool> stopping{false};
+
+    static uint64_t fnv1a(const std::string& s) {
+        uint64_t h = 1469598103934665603ull;
+        for (unsigned char c : s) h = (h ^ c) * 1099511628211ull;
+        return h;
+    }
+
+    std::string segment(const std::string& path) const {
+        std::string name = "/" + prefix + ".";
+        for (char c : path) name += (std::isalnum((unsigned char)c) || c == '-' || c == '_') ? c : '.';
+        return name;
+    }
+
+    template <typename T>
+    static uint64_t tag(const std::string& topic) {
+        return fnv1a(topic + ":" + ShmCodec<T>::name + ":" + std::to_string(sizeof(T)));
+    }
+
+    void run(Import& im, bool on_loop, int64_t spin_ns, uint64_t seen) {
+        while (!stopping.load()) {
+            uint32_t ticket = im.ring.ticket();
+            uint64_t head = im.ring.head();
+            if (head != seen) {
+                seen = head;
+                if (!on_loop) im.drain();
+                else if (!im.queued.exchange(true)) {
+                    EventLoop::instance().post([&im] {
+                        im.queued.store(false);
+                        im.drain();
+                    });
+                }
+            }
+            im.ring.wait(ticket, spin_ns, 100000000);
+        }
+    }
+
+public:
+    static ShmTransport& instance() {
+        static ShmTransport t;
+        return t;
+    }
+
+    void set_prefix(const std::string& p) { prefix = p; }
+
+    // `topic` ("Node.topic") goes into the segment tag, `path` names it.
+    template <typename T>
+    ShmWriter<T>* writer(const std::string& topic, const std::string& path) {
+        auto w = std::make_shared<ShmWriter<T>>();
+        if (!w->open(segment(path), tag<T>(topic), IpcStats::get("topic " + topic + " -> " + segment(path))))
+            return nullptr;
+        writers.push_back(w);
+        return w.get();
+    }
+
+    // Feeds samples written to `path` from now on into `deliver`. With
+    // `newest`, the last sample written before this process came up is
+    // delivered first, so latched state survives a restart.
+    template <typename T, typename F>
+    void import(const std::string& topic, const std::string& path, bool newest, F deliver) {
+        static_assert(ShmCodec<T>::Words <= MaxWords, "payload too large for a ring slot");
+        auto im = std::make_unique<Import>();
+        im->name = path;
+        if (!im->ring.open(segment(path), ShmCodec<T>::Words, tag<T>(topic))) return;
+        uint64_t head = im->ring.head();
+        im->cursor = newest && head ? head - 1 : head;
+        im->deliver = [deliver](const uint64_t* w) {
+            T v;
+            ShmCodec<T>::decode(w, v);
+            deliver(v);
+        };
+        imports.push_back(std::move(im));
+    }
+
+    void start(bool on_loop) {
+        int64_t spin_ns = 0;
+        if (const char* env = std::getenv("RIVET_SPIN_US")) spin_ns = std::max(0L, std::atol(env)) * 1000;
+        for (auto& im : imports) {
+            Import* p = im.get();
+            // A sample already waiting at the cursor is picked up on the first pass.
+            uint64_t seen = p->cursor;
+            p->thread = std::thread([this, p, on_loop, spin_ns, seen] { run(*p, on_loop, spin_ns, seen); });
+        }
+    }
+
+    void stop() {
+        stopping.store(true);
+        for (auto& im : imports) {
+            im->ring.wake_all();
+            if (im->thread.joinable()) im->thread.join();
+            if (im->lost) LogLine() << "[SHM] " << im->name << ": " << im->lost << " samples lost to overrun";
+        }
+        for (auto& w : writers) {
+            if (uint64_t t = w->truncated.load())
+                LogLine() << "[SHM] " << w->name << ": " << t << " strings cut to " << ShmCodec<std::string>::MaxLen
+                          << " bytes";
+        }
+    }
+};
+)";
+
+static const char* RIVET_RUNTIME_DEPLOY = R"(
+#include <cstddef>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Where a process receives requests: an abstract-namespace Unix datagram
+// socket named after the program and process, so nothing is left on disk.
+struct RpcTarget {
+    std::string process;
+    sockaddr_un addr{};
+    socklen_t len = 0;
+
+    RpcTarget(const std::string& program, const std::string& proc) : process(proc) {
+        std::string name = "rivet." + program + "." + proc;
+        addr.sun_family = AF_UNIX;
+        size_t n = std::min(name.size(), sizeof(addr.sun_path) - 1);
+        std::memcpy(addr.sun_path + 1, name.data(), n); // sun_path[0] == 0: abstract
+        len = (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + n);
+    }
+};
+
+// Request stubs for `--deploy` builds. Requests are fire-and-forget, so a
+// remote one is a single datagram: the caller encodes the arguments and
+// returns, and the receiving process's event loop decodes them and calls the
+// handler the way a local request would (directly, or queued to the node).
+// A full receive queue is retried for up to 100 ms before the request is
+// dropped and counted; a process that is not running drops it at once.
+class RpcEndpoint {
+    int rx = -1;
+    int tx = -1;
+    std::once_flag tx_once;
+    std::function<void(WireReader&)> dispatch;
+    std::mutex warn_mu;
+    std::vector<std::string> warned;
+
+    void warn_once(const std::string& process, int err) {
+        std::lock_guard<std::mutex> lock(warn_mu);
+        if (std::find(warned.begin(), warned.end(), process) != warned.end()) return;
+        warned.push_back(process);
+        std::cerr << "[RPC] cannot reach process '" << process << "': " << std::strerror(err) << std::endl;
+    }
+
+public:
+    static constexpr size_t MaxDatagram = 65536;
+
+    static RpcEndpoint& instance() {
+        static RpcEndpoint ep;
+        return ep;
+    }
+
+    ~RpcEndpoint() {
+        if (rx >= 0) close(rx);
+        if (tx >= 0) close(tx);
+    }
+
+    // Main thread: starts taking requests for this process's nodes.
+    bool serve(const RpcTarget& self, std::function<void(WireReader&)> d) {
+        dispatch = std::move(d);
+        rx = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (rx < 0 || bind(rx, reinterpret_cast<const sockaddr*>(&self.addr), self.len) != 0) {
+            std::cerr << "[RPC] cannot listen as '" << self.process << "': " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        EventLoop::instance().watch(rx, EPOLLIN, [this](uint32_t) {
+            static uint8_t buf[MaxDatagram];
+            ssize_t n;
+            while ((n = recv(rx, buf, sizeof buf, 0)) > 0) {
+                WireReader in(buf, (size_t)n);
+                dispatch(in);
+            }
+        });
+        return true;
+    }
+
+    // Dispatch side: a request from a build of a different program, or garbled.
+    void reject(const std::string& what) {
+        std::lock_guard<std::mutex> lock(warn_mu);
+        if (std::find(warned.begin(), warned.end(), what) != warned.end()) return;
+        warned.push_back(what);
+        std::cerr << "[RPC] dropped " << what << ": schema mismatch or malformed arguments" << std::endl;
+    }
+
+    // Encoding space for one outgoing request on the calling thread.
+    static uint8_t* buffer() {
+        thread_local uint8_t buf[MaxDatagram];
+        return buf;
+    }
+
+    // Any thread; `w` wraps buffer().
+    void send(const RpcTarget& to, const WireWriter& w, IpcStat& st) {
+        std::call_once(tx_once, [this] { tx = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0); });
+        int64_t started = IpcStats::start();
+        if (!w.ok()) {
+            st.dropped.fetch_add(1, std::memory_order_relaxed);
+            warn_once(to.process, EMSGSIZE);
+            return;
+        }
+        for (int attempt = 0;; ++attempt) {
+            if (sendto(tx, w.data(), w.size(), MSG_DONTWAIT, reinterpret_cast<const sockaddr*>(&to.addr), to.len) >= 0) {
+                st.count(w.size(), started);
+                return;
+            }
+            if ((errno == EAGAIN || errno == ENOBUFS) && attempt < 2000) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                continue;
+            }
+            st.dropped.fetch_add(1, std::memory_order_relaxed);
+            warn_once(to.process, errno);
+            return;
+        }
+    }
+};
+
+// Datagram ids besides a request's (node << 16 | request): request number
+// RpcSetState moves the node to one of its local modes, and node number 0xFFFF
+// carries the system mode between processes.
+constexpr uint64_t RpcSetState = 0xFFFF;
+constexpr uint64_t RpcSystemMode = 0xFFFFull << 16;
+
+// There is one system mode for all processes, and the manifest's first
+// process (the leader) decides it. The others forward their transitions to
+// it, and it sends each transition it makes to all of them in the order it
+// makes them, so every process goes through the same modes; a transition made
+// in another process takes effect there once the leader has sent it back. A
+// process that starts after the leader asks it for the current mode. Shutdown
+// is each process's own: detach() leaves the others where they are.
+class SystemModeLink {
+public:
+    enum Op : uint64_t { Request, Apply, Sync };
+
+    // Main thread, before any init(): `followers` are the other processes, in
+    // manifest order.
+    static void lead(std::vector<RpcTarget> followers) {
+        peers() = std::move(followers);
+        SystemManager::announce.store(&announce, std::memory_order_release);
+    }
+    // `self` is this process's place among the leader's followers.
+    static void follow(RpcTarget leader, uint32_t self) {
+        peers().push_back(std::move(leader));
+        SystemManager::forward.store(&forward, std::memory_order_release);
+        send(peers()[0], Sync, self);
+    }
+    static void detach() {
+        SystemManager::forward.store(nullptr, std::memory_order_release);
+        SystemManager::announce.store(nullptr, std::memory_order_release);
+    }
+
+    // __rivet_rpc_dispatch, on the event loop.
+    static void receive(uint64_t op, WireReader& in) {
+        const uint64_t v = in.varint();
+        const uint64_t limit = op == Sync ? peers().size() : SystemManager::count();
+        if (!in.done() || op > Sync || v >= limit) return RpcEndpoint::instance().reject("a system mode message");
+        if (op == Request) {
+            SystemManager::set_mode((ModeId)v);
+        } else if (op == Apply) {
+            SystemManager::apply((ModeId)v);
+        } else {
+            std::lock_guard<std::mutex> lock(mu);
+            send(peers()[v], Apply, latest);
+        }
+    }
+
+private:
+    static inline std::mutex mu; // orders a Sync answer with the transitions around it
+    static inline ModeId latest = 0;
+
+    static std::vector<RpcTarget>& peers() {
+        static std::vector<RpcTarget> p;
+        return p;
+    }
+    static void send(const RpcTarget& to, uint64_t op, uint64_t v) {
+        static IpcStat& st = IpcStats::get("system modes");
+        WireWriter w(RpcEndpoint::buffer(), RpcEndpoint::MaxDatagram);
+        w.varint(RpcSystemMode + op);
+        w.varint(v);
+        RpcEndpoint::instance().send(to, w, st);
+    }
+    static void announce(ModeId m) {
+        std::lock_guard<std::mutex> lock(mu);
+        latest = m;
+        for (const auto& p : peers()) send(p, Apply, m);
+    }
+    static void forward(ModeId m) { send(peers()[0], Request, m); }
+};
+
+// Pins the process (and every thread it starts afterwards) to `cpus`.
+inline void pin_to_cpus(std::initializer_list<int> cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus) CPU_SET(c, &set);
+    if (sched_setaffinity(0, sizeof set, &set) != 0)
+        std::cerr << "[DEPLOY] cannot pin to the manifest's CPUs: " << std::strerror(errno) << std::endl;
+}
+)";
+
+static const char* RIVET_RUNTIME_RECORD = R"(
+#if !defined(__linux__)
+#error "--record needs Linux: mmap'd log files"
+#endif
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A topic as the log knows it: records carry the topic's index in the log's
+// own table, which maps it to a name and schema hash, so a log still replays
+// into a build that added, removed or reordered topics.
+struct LoggedTopic {
+    const char* name;
+    uint64_t schema;
+};
+
+// Log layout: this header, the topic table (one schema hash per topic), then
+// records from data_offset on, each starting on an 8-byte boundary.
+struct LogHeader {
+    char magic[8]; // "RIVETLOG"
+    uint32_t version;
+    uint32_t topics;
+    uint64_t data_offset;
+    uint64_t capacity; // bytes reserved for records
+    uint64_t used;     // set when the recorder closes; 0 after a crash
+    int64_t started_ns;
+};
+
+// size counts the header and payload and is written last: a zero size ends
+// the log, so a crash leaves at most one partial record, which is ignored.
+struct LogRecord {
+    uint32_t size;
+    uint32_t topic;
+    int64_t time_ns;
+    uint64_t seq;
+
+    static constexpr size_t Align = 8;
+    static size_t stride(size_t n) { return (n + Align - 1) & ~(Align - 1); }
+    std::atomic<uint32_t>& committed() { return *reinterpret_cast<std::atomic<uint32_t>*>(&size); }
+    const uint8_t* payload() const { return reinterpret_cast<const uint8_t*>(this + 1); }
+};
+static_assert(sizeof(LogRecord) == 24 && std::atomic<uint32_t>::is_always_lock_free, "log layout");
+
+// RIVET_RECORD=<file> appends every publish to a log preallocated at start-up
+// (RIVET_RECORD_MB, default 256) and mapped with its pages already faulted in.
+// A publisher encodes the sample into a thread-local buffer, claims space with
+// one fetch_add and copies it in: no locks, syscalls or allocation. Once the
+// log is full further samples are counted as dropped; at shutdown the file is
+// cut to what was written.
+class Recorder {
+    static constexpr size_t MaxPayload = 65536;
+    int fd = -1;
+    uint8_t* base = nullptr;
+    size_t mapped = 0;
+    std::string path;
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> dropped{0};  // the log was full
+    std::atomic<uint64_t> oversized{0}; // encoded past MaxPayload
+
+    LogHeader* header() const { return reinterpret_cast<LogHeader*>(base); }
+
+public:
+    enum class Mode { Off, Record, Replay };
+    // Fixed before any node runs.
+    static inline Mode mode = Mode::Off;
+
+    static Recorder& instance() {
+        static Recorder r;
+        return r;
+    }
+
+    bool open(const std::string& file, const LoggedTopic* topics, size_t n) {
+        size_t mb = 256;
+        if (const char* env = std::getenv("RIVET_RECORD_MB")) mb = (size_t)std::max(1L, std::atol(env));
+        const uint64_t data_offset = LogRecord::stride(sizeof(LogHeader) + n * sizeof(uint64_t));
+        const uint64_t capacity = (uint64_t)mb << 20;
+        path = file;
+        mapped = data_offset + capacity;
+        fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)mapped) != 0) {
+            std::cerr << "[RECORD] cannot create " << file << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        posix_fallocate(fd, 0, (off_t)mapped); // best effort: keeps a full disk from faulting mid-run
+        void* m = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (m == MAP_FAILED) {
+            std::cerr << "[RECORD] cannot map " << file << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        base = static_cast<uint8_t*>(m);
+        LogHeader* h = header();
+        std::memcpy(h->magic, "RIVETLOG", 8);
+        h->version = 1;
+        h->topics = (uint32_t)n;
+        h->data_offset = data_offset;
+        h->capacity = capacity;
+        h->used = 0;
+        h->started_ns = Clock::now_ns();
+        uint64_t* table = reinterpret_cast<uint64_t*>(h + 1);
+        for (size_t i = 0; i < n; ++i) table[i] = topics[i].schema;
+        mode = Mode::Record;
+        LogLine() << "[RECORD] " << file << ", " << mb << " MB preallocated";
+        return true;
+    }
+
+    // Any thread.
+    template <typename Codec, typename T>
+    void append(uint32_t topic, const T& v) {
+        thread_local uint8_t scratch[MaxPayload];
+        WireWriter w(scratch, sizeof scratch);
+        Codec::encode(w, v);
+        // Before claiming space: a claimed record that is never committed
+        // reads as the end of the log.
+        if (!w.ok()) {
+            oversized.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        const size_t size = sizeof(LogRecord) + w.size();
+        const size_t stride = LogRecord::stride(size);
+        const uint64_t at = tail.fetch_add(stride, std::memory_order_relaxed);
+        if (at + stride > header()->capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto* rec = reinterpret_cast<LogRecord*>(base + header()->data_offset + at);
+        rec->topic = topic;
+        rec->time_ns = Clock::now_ns();
+        rec->seq = seq.fetch_add(1, std::memory_order_relaxed);
+        std::memcpy(rec + 1, scratch, w.size());
+        rec->committed().store((uint32_t)size, std::memory_order_release);
+    }
+
+    // Main thread, after the executors have drained.
+    void close() {
+        if (!base) return;
+        LogHeader* h = header();
+        const uint64_t used = std::min<uint64_t>(tail.load(), h->capacity);
+        const uint64_t data_offset = h->data_offset;
+        h->used = used;
+        munmap(base, mapped);
+        base = nullptr;
+        if (ftruncate(fd, (off_t)(data_offset + used)) != 0)
+            std::cerr << "[RECORD] cannot trim " << path << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        LogLine line;
+        line << "[RECORD] " << seq.load() << " samples, " << used << " bytes";
+        if (uint64_t d = dropped.load()) line << ", " << d << " dropped, log full: raise RIVET_RECORD_MB";
+        if (uint64_t o = oversized.load()) line << ", " << o << " dropped, over " << MaxPayload << " bytes encoded";
+    }
+};
+
+// Every topic of a --record build. Nodes publish through it; while replaying,
+// their publishes are discarded and only inject() reaches the listeners.
+template <typename TopicT, typename Codec, uint32_t Id>
+class Recorded : public TopicT {
+    using T = typename TopicT::value_type;
+
+public:
+    void publish(const T& val) {
+        if (Recorder::mode == Recorder::Mode::Off) return TopicT::publish(val);
+        if (Recorder::mode == Recorder::Mode::Replay) return;
+        Recorder::instance().append<Codec>(Id, val);
+        TopicT::publish(val);
+    }
+    void inject(const T& val) { TopicT::publish(val); }
+};
+
+// RIVET_REPLAY=<file> feeds a log back into the topics from the event loop,
+// at the recorded pace or, with RIVET_REPLAY_FAST=1, as fast as the listeners
+// take it; the process stops when the log ends. Per topic it reports how long
+// publish() took -- the handlers themselves under the inline executor, the
+// hand-off to the mailboxes otherwise -- and, at the recorded pace, how late
+// samples went out.
+class Replayer {
+public:
+    // Decodes one payload into local topic `topic` and publishes it.
+    using Inject = bool (*)(uint32_t topic, WireReader& in);
+
+private:
+    struct TopicStats {
+        uint64_t count = 0;
+        int64_t total_ns = 0;
+        int64_t max_ns = 0;
+        int64_t max_late_ns = 0;
+    };
+
+    int fd = -1;
+    const uint8_t* base = nullptr;
+    size_t mapped = 0;
+    const LoggedTopic* topics = nullptr;
+    Inject inject = nullptr;
+    std::vector<int> local; // log topic -> local topic, -1 if this build lacks it
+    std::vector<TopicStats> stats;
+    uint64_t pos = 0, end = 0;
+    bool fast = false;
+    bool done = false;
+    int64_t first_ns = 0, start_ns = 0;
+    bool started = false;
+    uint64_t replayed = 0, skipped = 0, malformed = 0;
+
+    const LogHeader* header() const { return reinterpret_cast<const LogHeader*>(base); }
+
+    // The next complete record, or nullptr at the end of the log.
+    const LogRecord* peek() const {
+        if (pos + sizeof(LogRecord) > end) return nullptr;
+        auto* rec = reinterpret_cast<const LogRecord*>(base + header()->data_offset + pos);
+        uint32_t size = rec->size;
+        if (size < sizeof(LogRecord) || pos + size > end) return nullptr;
+        return rec;
+    }
+
+    void finish() {
+        done = true;
+        LogLine() << "[REPLAY] finished: " << replayed << " samples in " << (Clock::now_ns() - start_ns) / 1000000
+                  << " ms";
+        EventLoop::instance().stop();
+    }
+
+public:
+    static Replayer& instance() {
+        static Replayer r;
+        return r;
+    }
+
+    ~Replayer() {
+        if (base) munmap(const_cast<uint8_t*>(base), mapped);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool open(const std::string& file, const LoggedTopic* t, size_t n, Inject f) {
+        fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LogHeader)) {
+            std::cerr << "[REPLAY] cannot read " << file << std::endl;
+            return false;
+        }
+        mapped = (size_t)st.st_size;
+        void* m = mmap(nullptr, mapped, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (m == MAP_FAILED) {
+            std::cerr << "[REPLAY] cannot map " << file << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        base = static_cast<const uint8_t*>(m);
+        const LogHeader* h = header();
+        if (std::memcmp(h->magic, "RIVETLOG", 8) != 0 || h->version != 1 || h->data_offset > mapped) {
+            std::cerr << "[REPLAY] " << file << " is not a Rivet log" << std::endl;
+            return false;
+        }
+        topics = t;
+        inject = f;
+        const uint64_t* table = reinterpret_cast<const uint64_t*>(h + 1);
+        for (uint32_t i = 0; i < h->topics; ++i) {
+            int match = -1;
+            for (size_t k = 0; k < n; ++k)
+                if (t[k].schema == table[i]) match = (int)k;
+            local.push_back(match);
+        }
+        stats.resize(n);
+        end = mapped - h->data_offset;
+        if (h->used) end = std::min(end, h->used);
+        fast = std::getenv("RIVET_REPLAY_FAST") != nullptr;
+        if (const LogRecord* rec = peek()) first_ns = rec->time_ns;
+        Recorder::mode = Recorder::Mode::Replay;
+        LogLine() << "[REPLAY] " << file << (fast ? ", as fast as possible" : ", at the recorded pace");
+        return true;
+    }
+
+    // Event loop source: publishes what is due and returns the next deadline.
+    int64_t advance() {
+        if (done) return INT64_MAX;
+        int64_t now = Clock::now_ns();
+        if (!started) { // the recorded pace counts from the loop's first turn, after init()
+            started = true;
+            start_ns = now;
+        }
+        for (int budget = 256; budget > 0; --budget) {
+            const LogRecord* rec = peek();
+            if (!rec) {
+                finish();
+                return INT64_MAX;
+            }
+            const int64_t due = start_ns + (rec->time_ns - first_ns);
+            if (!fast && due > now) return due;
+            pos += LogRecord::stride(rec->size);
+            int k = rec->topic < local.size() ? local[rec->topic] : -1;
+            if (k < 0) {
+                ++skipped;
+                continue;
+            }
+            WireReader in(rec->payload(), rec->size - sizeof(LogRecord));
+            const int64_t t0 = Clock::now_ns();
+            if (!inject((uint32_t)k, in)) {
+                ++malformed;
+                continue;
+            }
+            now = Clock::now_ns();
+            TopicStats& s = stats[k];
+            s.count++;
+            s.total_ns += now - t0;
+            s.max_ns = std::max(s.max_ns, now - t0);
+            if (!fast) s.max_late_ns = std::max(s.max_late_ns, t0 - due);
+            ++replayed;
+        }
+        return now; // more is due: come straight back after the loop's other work
+    }
+
+    void report(std::ostream& os) const {
+        for (size_t k = 0; k < stats.size(); ++k) {
+            const TopicStats& s = stats[k];
+            if (!s.count) continue;
+            os << "[REPLAY] " << topics[k].name << ": " << s.count << " samples, publish avg=" << s.total_ns / (int64_t)s.count
+               << "ns max=" << s.max_ns << "ns";
+            if (!fast) os << ", late max=" << s.max_late_ns << "ns";
+            os << "\n";
+        }
+        if (skipped) os << "[REPLAY] " << skipped << " samples of topics this build does not have\n";
+        if (malformed) os << "[REPLAY] " << malformed << " samples failed to decode\n";
+        os << std::flush;
+    }
+};
+)";
+
+static const char* RIVET_RUNTIME_SIM = R"(
+// --sim: a single-threaded discrete-event scheduler. Every handler a node is
+// posted -- listener, request, transition, timer tick -- becomes an event at
+// the current virtual time (plus RIVET_SIM_LATENCY_US, default 0) and events
+// run in (time, post order). Nothing depends on threads or the wall clock, so
+// a run is a pure function of its inputs and hours of virtual time pass as
+// fast as the handlers run.
+class Sim {
+    struct Event {
+        int64_t at;
+        uint64_t seq;
+        Task fn;
+    };
+    struct Later {
+        bool operator()(const Event& a, const Event& b) const { return a.at != b.at ? a.at > b.at : a.seq > b.seq; }
+    };
+    std::vector<Event> heap;
+    uint64_t next_seq = 0;
+    uint64_t handled = 0;
+    int64_t latency_ns = 0;
+
+    Sim() {
+        if (const char* env = std::getenv("RIVET_SIM_LATENCY_US")) latency_ns = std::max(0L, std::atol(env)) * 1000;
+    }
+
+    void run_next() {
+        std::pop_heap(heap.begin(), heap.end(), Later());
+        Event ev = std::move(heap.back());
+        heap.pop_back();
+        Clock::virtual_ns = std::max(Clock::virtual_ns, ev.at);
+        ev.fn();
+        handled++;
+    }
+
+public:
+    static Sim& instance() {
+        static Sim s;
+        return s;
+    }
+
+    void post(Task t) {
+        heap.push_back(Event{Clock::now_ns() + latency_ns, next_seq++, std::move(t)});
+        std::push_heap(heap.begin(), heap.end(), Later());
+    }
+
+    uint64_t events() const { return handled; }
+
+    // Event loop source: runs what is due and returns when the next event is.
+    int64_t advance() {
+        while (!heap.empty() && heap.front().at <= Clock::now_ns()) run_next();
+        return heap.empty() ? std::numeric_limits<int64_t>::max() : heap.front().at;
+    }
+
+    // Shutdown: runs events until none are left or `limit` of virtual time has
+    // passed (handlers that keep posting to each other never run dry).
+    bool drain(std::chrono::nanoseconds limit) {
+        const int64_t end = Clock::now_ns() + (int64_t)limit.count();
+        while (!heap.empty() && heap.front().at <= end) run_next();
+        return heap.empty();
+    }
+};
+
+// Base of every node under --sim; the queue depth is accepted for symmetry
+// with the other executors, the event queue is unbounded.
+class SimNode {
+public:
+    explicit SimNode(size_t) {}
+    SimNode(const SimNode&) = delete;
+    SimNode& operator=(const SimNode&) = delete;
+
+    void post(Task t) { Sim::instance().post(std::move(t)); }
+};
+)";
+
+static const char* RIVET_RUNTIME_FUTURE = R"(
+#include <tuple>
+
+// Continuations copy the handler's arguments and replies. From C++20 on `this`
+// has to be named; [=] picking it up is deprecated there.
+#if __cplusplus > 201703L
+#define RIVET_CAPTURE =, this
+#else
+#define RIVET_CAPTURE =
+#endif
+
+// Shared state of a group of `request async` calls joined by one `on` block:
+// a reply slot per call and the two continuations. States are recycled
+// through a per-type free list, so once the pool is warm a request allocates
+// nothing for its state (std::future would, every time). References are
+// counted: the caller's Future, each call in flight, each armed timeout and
+// a continuation on its way to the caller each hold one. The first of "every
+// reply is in" and "a timeout passed" settles the state and hands its
+// continuation to the caller's executor; whatever arrives later is dropped.
+template <typename... T>
+class FutureState {
+public:
+    using Done = std::function<void(const T&...)>;
+    using Expired = std::function<void(const char* request)>;
+
+    static FutureState* acquire() {
+        FutureState* s = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(pool_mu);
+            if (!pool.empty()) {
+                s = pool.back();
+                pool.pop_back();
+            }
+        }
+        if (!s) s = new FutureState();
+        s->refs.store(1, std::memory_order_relaxed);
+        s->remaining.store(sizeof...(T), std::memory_order_relaxed);
+        s->settled.store(false, std::memory_order_relaxed);
+        return s;
+    }
+
+    void retain() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        values = std::tuple<T...>();
+        for (auto& t : timers) t.store(0, std::memory_order_relaxed); // a fired timer leaves its id
+        done = nullptr;
+        expired = nullptr;
+        std::lock_guard<std::mutex> lock(pool_mu);
+        pool.push_back(this);
+    }
+
+    // Continuations for a caller without an executor: they run on the thread
+    // that settles the state.
+    void then(Done on_done, Expired on_expired) {
+        done = std::move(on_done);
+        expired = std::move(on_expired);
+        caller = nullptr;
+        post = nullptr;
+    }
+    // Continuations queued on `node`'s executor.
+    template <typename N>
+    void then(N* node, Done on_done, Expired on_expired) {
+        then(std::move(on_done), std::move(on_expired));
+        caller = node;
+        post = [](void* n, std::function<void()> t) { static_cast<N*>(n)->post(std::move(t)); };
+    }
+
+    // Starts reply I's timeout; done before its request is sent, so the reply
+    // always finds the timer to cancel. `request` names the call in reports.
+    void arm(size_t i, const char* request, int64_t timeout_ns) {
+        retain(); // the timer's, dropped by whichever of expiry and disarm() wins
+        timers[i].store(Timers::instance().start(request, timeout_ns, [this, request](Timers::Id id) {
+            Timers::instance().cancel(id); // one-shot
+            expire(request);
+            release();
+        }));
+    }
+
+    template <size_t I, typename V>
+    void reply(V&& v) {
+        disarm(I);
+        if (settled.load(std::memory_order_acquire)) return; // timed out already
+        std::get<I>(values) = std::forward<V>(v);
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 && !settled.exchange(true)) deliver(nullptr);
+    }
+
+private:
+    static inline std::mutex pool_mu;
+    static inline std::vector<FutureState*> pool;
+
+    std::tuple<T...> values;
+    std::atomic<size_t> remaining{0};
+    std::atomic<bool> settled{false};
+    std::atomic<uint32_t> refs{0};
+    std::atomic<Timers::Id> timers[sizeof...(T)] = {}; // 0: none armed
+    Done done;
+    Expired expired;
+    void* caller = nullptr;
+    void (*post)(void*, std::function<void()>) = nullptr;
+
+    FutureState() = default;
+
+    void disarm(size_t i) {
+        Timers::Id id = timers[i].exchange(0);
+        if (id && Timers::instance().cancel(id)) release();
+    }
+
+    void expire(const char* request) {
+        if (settled.exchange(true)) return;
+        for (size_t i = 0; i < sizeof...(T); ++i) disarm(i);
+        deliver(request);
+    }
+
+    // Runs the reply continuation (`request` null) or the timeout one.
+    void deliver(const char* request) {
+        if (!post) {
+            run(request);
+            return;
+        }
+        retain();
+        post(caller, [this, request] {
+            run(request);
+            release();
+        });
+    }
+    void run(const char* request) {
+        if (!request) std::apply(done, values);
+        else if (expired) expired(request);
+    }
+};
+
+// The caller's handle on a FutureState, released when the handler that made
+// the requests returns; the calls and timers keep the state alive after that.
+template <typename... T>
+class Future {
+    FutureState<T...>* s = FutureState<T...>::acquire();
+
+public:
+    Future() = default;
+    ~Future() { s->release(); }
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    FutureState<T...>* operator->() const { return s; }
+    FutureState<T...>* get() const { return s; }
+};
+
+// Stores a handler's return value as reply I of `st`. Handlers that await
+// return a Sequence instead, which has an overload of its own.
+template <size_t I, typename... T, typename V>
+void reply_with(FutureState<T...>* st, V&& v) {
+    st->template reply<I>(std::forward<V>(v));
+}
+
+// A callback that stores a reply handed to it as reply I of `st`; a null
+// reply (the handler stopped without one) just lets go of the state.
+template <size_t I, typename... T>
+auto reply_to(FutureState<T...>* st) {
+    st->retain();
+    return [st](const auto* v) {
+        if (v) st->template reply<I>(*v);
+        st->release();
+    };
+}
+
+// Hands a handler's return value to k, as a pointer.
+template <typename V, typename K>
+void when_replied(V&& v, K&& k) {
+    k(&v);
+}
+
+// Whether N runs its handlers on an executor of its own (has post()).
+template <typename N, typename = void>
+struct queues_handlers : std::false_type {};
+template <typename N>
+struct queues_handlers<N, std::void_t<decltype(std::declval<N&>().post(std::function<void()>()))>>
+    : std::true_type {};
+
+// The reply a request carries; a handler without a value replies `true`.
+template <typename R>
+struct ReplyOf {
+    using type = R;
+};
+template <>
+struct ReplyOf<void> {
+    using type = bool;
+};
+
+// Queues `(node->*fn)(args...)` on the node's executor, like post_call, and
+// stores what it returns as reply I of `st`.
+template <size_t I, typename... T, typename N, typename R, typename... P, typename... A>
+void post_request(FutureState<T...>* st, N* node, R (N::*fn)(P...), A&&... args) {
+    st->retain();
+    node->post([st, node, fn, tup = std::make_tuple(std::decay_t<A>(std::forward<A>(args))...)]() mutable {
+        reply_with<I>(st, std::apply([&](auto&... a) { return (node->*fn)(a...); }, tup));
+        st->release();
+    });
+}
+)";
+
+static const char* RIVET_RUNTIME_SEQUENCE = R"(
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+
+// Coroutine frames of bodies that await or wait, recycled by size class so a
+// warm sequence allocates nothing. Frames past the largest class use the heap.
+class FramePool {
+public:
+    static constexpr size_t Step = 64;
+    static constexpr size_t Classes = 64;
+
+    static void* take(size_t n) {
+        size_t c = (n + Step - 1) / Step;
+        if (c >= Classes) return ::operator new(n);
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (Free* f = heads[c]) {
+                heads[c] = f->next;
+                return f;
+            }
+        }
+        return ::operator new(c * Step);
+    }
+    static void give(void* p, size_t n) {
+        size_t c = (n + Step - 1) / Step;
+        if (c >= Classes) {
+            ::operator delete(p);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mu);
+        heads[c] = new (p) Free{heads[c]};
+    }
+
+private:
+    struct Free {
+        Free* next;
+    };
+    static inline std::mutex mu;
+    static inline Free* heads[Classes] = {};
+};
+
+// What a finished body hands on: its value, or nothing for a mode or timer body.
+template <typename T>
+struct SequenceResult {
+    std::function<void(T&&)> done;
+    bool returned = false;
+    void return_value(T v) {
+        returned = true;
+        if (done) done(std::move(v));
+    }
+};
+template <>
+struct SequenceResult<void> {
+    std::function<void()> done;
+    bool returned = false;
+    void return_void() {
+        returned = true;
+        if (done) done();
+    }
+};
+
+// A handler, func, mode or timer body that awaits or waits. It starts when
+// its Sequence is dropped, so calling one from plain code just runs it; a
+// caller awaiting its reply takes it with then() first. Each suspension point
+// keeps the frame alive (a reply or a timer holds the handle), and an
+// `await` that times out destroys the frame, which reports `stopped`.
+template <typename T>
+class Sequence {
+public:
+    struct promise_type : SequenceResult<T> {
+        std::function<void()> stopped;
+
+        static void* operator new(size_t n) { return FramePool::take(n); }
+        static void operator delete(void* p, size_t n) { FramePool::give(p, n); }
+
+        Sequence get_return_object() { return Sequence(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void unhandled_exception() { std::terminate(); }
+        ~promise_type() {
+            if (!this->returned && stopped) stopped();
+        }
+    };
+
+    Sequence(Sequence&& o) noexcept : h(std::exchange(o.h, {})) {}
+    Sequence(const Sequence&) = delete;
+    Sequence& operator=(const Sequence&) = delete;
+    ~Sequence() {
+        if (h) h.resume();
+    }
+
+    // Starts the body with somewhere to send its result.
+    void then(decltype(SequenceResult<T>::done) done, std::function<void()> stopped) && {
+        auto c = std::exchange(h, {});
+        c.promise().done = std::move(done);
+        c.promise().stopped = std::move(stopped);
+        c.resume();
+    }
+
+private:
+    std::coroutine_handle<promise_type> h;
+    explicit Sequence(std::coroutine_handle<promise_type> c) : h(c) {}
+};
+
+// A handler that awaits replies with what its Sequence returns.
+template <typename U>
+struct ReplyOf<Sequence<U>> {
+    using type = U;
+};
+template <>
+struct ReplyOf<Sequence<void>> {
+    using type = bool;
+};
+
+// when_replied for a handler that awaits: k gets the value once the body
+// returns, or null if it was stopped.
+template <typename U, typename K>
+void when_replied(Sequence<U>&& s, K&& k) {
+    if constexpr (std::is_void_v<U>) {
+        std::move(s).then([k] { bool v = true; k(&v); }, [k] { k(nullptr); });
+    } else {
+        std::move(s).then([k](U&& v) { k(&v); }, [k] { k(nullptr); });
+    }
+}
+
+// reply_with for a handler that awaits: the reply goes in when its body
+// returns. A body stopped by its own timeout never replies; the caller's
+// timeout covers that.
+template <size_t I, typename... T, typename U>
+void reply_with(FutureState<T...>* st, Sequence<U>&& s) {
+    st->retain(); // until the body returns or stops
+    if constexpr (std::is_void_v<U>) {
+        std::move(s).then([st] { st->template reply<I>(true); st->release(); }, [st] { st->release(); });
+    } else {
+        std::move(s).then([st](U&& v) { st->template reply<I>(std::move(v)); st->release(); },
+                          [st] { st->release(); });
+    }
+}
+
+// Calls f and stores its result as reply I of `st`.
+template <size_t I, typename S, typename F>
+void reply_from(S* st, F&& f) {
+    if constexpr (std::is_void_v<std::invoke_result_t<F&>>) {
+        f();
+        st->template reply<I>(true);
+    } else {
+        reply_with<I>(st, f());
+    }
+}
+
+// `await request`: sends the request, suspends the caller until the reply is
+// in and resumes it on the caller's executor. A single-slot FutureState from
+// the pool carries the reply and the timeout. When the timeout passes first
+// the caller's body is abandoned: the warning is logged and the frame freed.
+template <typename T, typename C>
+class Ask {
+public:
+    using Send = std::function<void(FutureState<T>*)>;
+
+    Ask(C* caller, const char* request, int64_t timeout_ns, Send send)
+        : caller(caller), request(request), timeout_ns(timeout_ns), send(std::move(send)) {}
+    Ask(const Ask&) = delete;
+    Ask& operator=(const Ask&) = delete;
+    ~Ask() { st->release(); }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        auto done = [this, h](const T& v) {
+            value = v;
+            h.resume();
+        };
+        C* c = caller;
+        auto expired = [c, h](const char* req) {
+            if (LogLevel::WARN >= c->log_level) LogLine(c->name, LogLevel::WARN) << req << " timed out";
+            h.destroy();
+        };
+        if constexpr (queues_handlers<C>::value) st->then(c, done, expired);
+        else st->then(done, expired);
+        if (timeout_ns > 0) st->arm(0, request, timeout_ns);
+        // A reply sent in place resumes the caller, which may finish and free
+        // this awaiter before send() returns: work from locals.
+        FutureState<T>* s = st;
+        Send go = std::move(send);
+        s->retain();
+        go(s);
+        s->release();
+    }
+    T await_resume() { return std::move(value); }
+
+private:
+    C* caller;
+    const char* request;
+    int64_t timeout_ns;
+    Send send;
+    FutureState<T>* st = FutureState<T>::acquire();
+    T value{};
+};
+
+// `await request` of an idempotent handler: the call goes through the
+// target's Coalescer, which may attach it to a run already under way.
+template <typename C, typename G, typename T = typename G::Reply, typename... A>
+auto ask(C* caller, const char* request, int64_t timeout_ns, G& target, A&&... args) {
+    return Ask<T, C>(caller, request, timeout_ns,
+                     [&target, tup = std::make_tuple(std::decay_t<A>(std::forward<A>(args))...)](FutureState<T>* st) {
+                         std::apply([&](const auto&... a) { target.call(reply_to<0>(st), a...); }, tup);
+                     });
+}
+
+template <typename C, typename N, typename R, typename... P, typename... A>
+auto ask(C* caller, const char* request, int64_t timeout_ns, N* node, R (N::*fn)(P...), A&&... args) {
+    using T = typename ReplyOf<R>::type;
+    return Ask<T, C>(caller, request, timeout_ns,
+                     [node, fn, tup = std::make_tuple(std::decay_t<A>(std::forward<A>(args))...)](FutureState<T>* st) {
+                         auto call = [node, fn, tup]() mutable {
+                             return std::apply([&](auto&... a) { return (node->*fn)(a...); }, tup);
+                         };
+                         if constexpr (queues_handlers<N>::value) {
+                             st->retain();
+                             node->post([st, call]() mutable {
+                                 reply_from<0>(st, call);
+                                 st->release();
+                             });
+                         } else {
+                             reply_from<0>(st, call);
+                         }
+                     });
+}
+
+// `wait`: resumes the caller on its executor once the delay has passed, from
+// a one-shot timer on the wheel.
+template <typename C>
+class Delay {
+public:
+    Delay(C* caller, const char* label, int64_t ns) : caller(caller), label(label), ns(ns) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        C* c = caller;
+        Timers::instance().start(label, ns, [c, h](Timers::Id id) {
+            Timers::instance().cancel(id); // one-shot
+            if constexpr (queues_handlers<C>::value) c->post([h] { h.resume(); });
+            else h.resume();
+        });
+    }
+    void await_resume() const noexcept {}
+
+private:
+    C* caller;
+    const char* label;
+    int64_t ns;
+};
+
+template <typename C>
+Delay<C> after(C* caller, const char* label, int64_t ns) {
+    return Delay<C>(caller, label, ns);
+}
+)";
+
+static const char* RIVET_RUNTIME_COALESCE = R"(
+#include <deque>
+
+// How many calls of each `idempotent` request shared another call's run
+// instead of running the handler (RIVET_REQUEST_STATS=1).
+struct CoalesceStat {
+    std::string label;
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> saved{0};
+};
+
+class CoalesceStats {
+    static std::mutex& mu() {
+        static std::mutex m;
+        return m;
+    }
+    static std::deque<CoalesceStat>& all() {
+        static std::deque<CoalesceStat> stats; // deque: references stay valid
+        return stats;
+    }
+
+public:
+    static CoalesceStat& get(const std::string& label) {
+        std::lock_guard<std::mutex> lock(mu());
+        for (auto& st : all())
+            if (st.label == label) return st;
+        all().emplace_back();
+        all().back().label = label;
+        return all().back();
+    }
+
+    static void dump(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mu());
+        for (const auto& st : all()) {
+            uint64_t n = st.calls.load(std::memory_order_relaxed), saved = st.saved.load(std::memory_order_relaxed);
+            os << "[REQ] " << st.label << ": calls=" << n << " ran=" << n - saved << " coalesced=" << saved << "\n";
+        }
+        os << std::flush;
+    }
+};
+
+// The calls of one `idempotent` onRequest. A call whose arguments match a run
+// that is queued or still executing joins that run instead of starting
+// another; when the run returns, every caller joined to it gets its reply.
+// Runs are kept in a short list that finished ones are reused from.
+template <typename N, typename R, typename... P>
+class Coalescer {
+public:
+    using Reply = typename ReplyOf<R>::type;
+    using Waiter = std::function<void(const Reply*)>; // null reply: the run stopped without one
+
+    Coalescer(N* node, R (N::*fn)(P...), const char* label) : node(node), fn(fn), stat(CoalesceStats::get(label)) {}
+    Coalescer(const Coalescer&) = delete;
+    Coalescer& operator=(const Coalescer&) = delete;
+
+    // Runs the handler (queued on the node's executor, if it has one) unless
+    // an equal call is in flight. `w` may be empty when nobody needs the reply.
+    template <typename... A>
+    void call(Waiter w, A&&... args) {
+        Key key(std::forward<A>(args)...);
+        stat.calls.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (auto& r : runs) {
+                if (!r.live || r.key != key) continue;
+                if (w) r.waiters.push_back(std::move(w));
+                stat.saved.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            Run& r = vacant();
+            r.live = true;
+            r.key = key;
+            if (w) r.waiters.push_back(std::move(w));
+        }
+        auto run = [this, key] {
+            when_replied(std::apply([this](const auto&... a) { return (node->*fn)(a...); }, key),
+                         [this, key](const Reply* v) { finish(key, v); });
+        };
+        if constexpr (queues_handlers<N>::value) node->post(run);
+        else run();
+    }
+
+private:
+    using Key = std::tuple<std::decay_t<P>...>;
+    struct Run {
+        bool live = false;
+        Key key;
+        std::vector<Waiter> waiters;
+    };
+
+    N* node;
+    R (N::*fn)(P...);
+    CoalesceStat& stat;
+    std::mutex mu;
+    std::vector<Run> runs;
+
+    Run& vacant() {
+        for (auto& r : runs)
+            if (!r.live) return r;
+        return runs.emplace_back();
+    }
+
+    // The run for `key` returned: later calls start a new one.
+    void finish(const Key& key, const Reply* v) {
+        std::vector<Waiter> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (auto& r : runs) {
+                if (!r.live || r.key != key) continue;
+                r.live = false;
+                waiters.swap(r.waiters);
+                break;
+            }
+        }
+        for (auto& w : waiters) w(v);
+    }
+};
+)";
+
+void emit_runtime(std::ostream& os, const CppGenOptions& opts, const RuntimeFeatures& features) {
+    if (opts.executor == ExecutorKind::Sim) os << "#define RIVET_SIM 1\n";
+    os << RIVET_RUNTIME << "\n";
+    os << RIVET_RUNTIME_WIRE << "\n";
+    if (opts.dispatch == DispatchKind::Static) os << RIVET_RUNTIME_STATIC << "\n";
+    if (opts.executor != ExecutorKind::Inline) os << RIVET_RUNTIME_MAILBOX << "\n";
+    if (opts.executor == ExecutorKind::Actor) os << RIVET_RUNTIME_ACTOR << "\n";
+    if (opts.executor == ExecutorKind::Pool) os << RIVET_RUNTIME_POOL << "\n";
+    if (opts.executor == ExecutorKind::Sim) os << RIVET_RUNTIME_SIM << "\n";
+    if (features.timers) os << RIVET_RUNTIME_TIMERS << "\n";
+    if (features.futures) os << RIVET_RUNTIME_FUTURE << "\n";
+    if (features.sequences) os << RIVET_RUNTIME_SEQUENCE << "\n";
+    if (features.coalesce) os << RIVET_RUNTIME_COALESCE << "\n";
+    os << RIVET_RUNTIME_LOOP << "\n";
+    if (opts.transport == TransportKind::Shm) os << RIVET_RUNTIME_SHM << "\n";
+    if (opts.deploy_process >= 0) os << RIVET_RUNTIME_DEPLOY << "\n";
+    if (opts.record) os << RIVET_RUNTIME_RECORD << "\n";
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "codegen_cpp.hpp"
+#include <ostream>
+
+// Program features that pull in optional runtime sections.
+struct RuntimeFeatures {
+    bool timers = false;  // the program declares `every` timers
+    bool futures = false; // some `request async` waits for its reply (needs timers)
+    bool sequences = false; // some body awaits or waits: C++20 coroutines (needs futures)
+    bool coalesce = false;  // some onRequest is `idempotent` (needs futures)
+};
+
+// Emits the C++ runtime support code that every generated program is built on.
+// Optional sections (executors, timers, ...) are only emitted when the options
+// or the program need them.
+void emit_runtime(std::ostream& os, const CppGenOptions& opts, const RuntimeFeatures& features);
@@ -1,5 +1,6 @@
 #include "validate.hpp"
 #include "builtins.hpp"
+#include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
 #include <iostream>
@@ -10,11 +11,14 @@
 
 struct TopicSymbol {
     TypeInfo type;
+    bool latched = false;
+    int history = 0;
 };
 
 struct FuncSymbol {
     std::vector<TypeInfo> param_types;
     TypeInfo return_type;
+    bool suspends = false; // a coroutine: its result is only available to `await request`
 };
 
 struct NodeSymbol {
@@ -89,6 +93,23 @@ static std::vector<std::string> extract_interpolations(const std::string& s) {
     return out;
 }
 
+// Returns an error message if `node.topic` cannot be read as `kind`, "" otherwise.
+static std::string topic_read_error(const std::string& node, const std::string& topic, Expr::TopicRead::Kind kind) {
+    auto itn = g_nodes.find(node);
+    if (itn == g_nodes.end()) return "Unknown node '" + node + "' in expression";
+    auto itt = itn->second.topics.find(topic);
+    if (itt == itn->second.topics.end()) return "Node '" + node + "' has no topic '" + topic + "'";
+    const TopicSymbol& ts = itt->second;
+    if (kind == Expr::TopicRead::Kind::Value) {
+        if (!ts.latched && !ts.history)
+            return "Topic '" + node + "." + topic + "' is not latched; declare it 'latched' to read '.value'";
+    } else if (!ts.history) {
+        return "Topic '" + node + "." + topic + "' keeps no history; declare it with 'history N' to read '" +
+               (kind == Expr::TopicRead::Kind::Count ? ".count'" : ".at(i)'");
+    }
+    return "";
+}
+
 static void collect_symbols(const Program& p, const DiagnosticEngine& diag) {
     g_nodes.clear();
     g_system_modes.clear();
@@ -121,19 +142,24 @@ static void collect_symbols(const Program& p, const DiagnosticEngine& diag) {
             ns.name = n->name;
             ns.is_controller = n->is_controller;
 
-            for (const auto& t : n->topics) ns.topics[t.name] = { t.type };
+            for (const auto& t : n->topics) ns.topics[t.name] = { t.type, t.latched, t.history };
 
             for (const auto& r : n->requests) {
                 FuncSymbol fs;
                 for (const auto& param : r.sig.params) fs.param_types.push_back(param.type);
                 fs.return_type = r.sig.return_type;
+                fs.suspends = body_suspends(r.body);
                 ns.public_funcs[r.sig.name] = fs;
+                if (r.idempotent && r.sig.return_type.base == ValType::Custom) {
+                    diag.error(r.sig.loc, "idempotent request '" + r.sig.name + "' must return int, float, string or bool");
+                }
             }
 
             for (const auto& f : n->private_funcs) {
                 FuncSymbol fs;
                 for (const auto& param : f.sig.params) fs.param_types.push_back(param.type);
                 fs.return_type = f.sig.return_type;
+                fs.suspends = body_suspends(f.body);
                 ns.private_funcs[f.sig.name] = fs;
             }
 
@@ -242,6 +268,12 @@ static bool check_logic(const Program& p, const DiagnosticEngine& diag) {
                 if (!fs && iu != itn->second.public_funcs.end()) fs = &iu->second;
 
                 if (fs) {
+                    if (fs->suspends) {
+                        diag.error(e->loc, "'" + call->callee +
+                                           "' awaits or waits, so it has no value to use in an expression");
+                        has_error = true;
+                        return fs->return_type.base;
+                    }
                     if (arg_types.size() != fs->param_types.size()) {
                         diag.error(e->loc, "Argument count mismatch in call to '" + call->callee + "'. Expected " +
                                    std::to_string(fs->param_types.size()) + ", got " + std::to_string(arg_types.size()));
@@ -265,6 +297,21 @@ static bool check_logic(const Program& p, const DiagnosticEngine& diag) {
             has_error = true;
             return ValType::Int;
         }
+        if (auto tr = std::get_if<Expr::TopicRead>(&e->v)) {
+            if (tr->kind == Expr::TopicRead::Kind::At &&
+                self(self, tr->index, current_node, current_params) != ValType::Int) {
+                diag.error(e->loc, "History index must be an int");
+                has_error = true;
+            }
+            std::string err = topic_read_error(tr->node, tr->topic, tr->kind);
+            if (!err.empty()) {
+                diag.error(e->loc, err);
+                has_error = true;
+                return ValType::Int;
+            }
+            if (tr->kind == Expr::TopicRead::Kind::Count) return ValType::Int;
+            return g_nodes[tr->node].topics[tr->topic].type.base;
+        }
         if (auto un = std::get_if<Expr::Unary>(&e->v)) {
             ValType rhs = self(self, un->rhs, current_node, current_params);
             if (un->op == UnaryOp::Not) {
@@ -341,12 +388,30 @@ static bool check_logic(const Program& p, const DiagnosticEngine& diag) {
                        const std::string&,
                        const std::vector<Param>&)> validate_stmts;
 
+    // Where the body being checked cannot suspend (null: it can).
+    const char* no_suspend = nullptr;
+
     validate_stmts = [&](const std::vector<StmtPtr>& stmts,
                          const std::string& current_node,
-                         const std::vector<Param>& current_params) {
+                         const std::vector<Param>& outer_params) {
+        // `await request ... -> x` adds x for the rest of the block.
+        std::vector<Param> current_params = outer_params;
+        // Replies of `request async` calls in this block not yet joined by an `on` block.
+        std::vector<Param> pending_replies;
         for (const auto& sp : stmts) {
             if (!sp) continue;
 
+            if (auto w = std::get_if<WaitStmt>(&sp->v)) {
+                if (w->ns <= 0) {
+                    diag.error(w->loc, "'wait' needs a positive duration");
+                    has_error = true;
+                }
+                if (no_suspend) {
+                    diag.error(w->loc, std::string("'wait' cannot be used in ") + no_suspend);
+                    has_error = true;
+                }
+            }
+
             // Validate Log Arguments (Variables)
             if (auto log = std::get_if<LogStmt>(&sp->v)) {
                 for (const auto& arg : log->args) {
@@ -367,9 +432,28 @@ static bool check_logic(const Program& p, const DiagnosticEngine& diag) {
                         }
                     };
 
+                    // {Node.topic.value}, {Node.topic.count} and {Node.topic.at(N)}.
+                    auto check_topic_value = [&](const std::string& inner) {
+                        size_t d1 = inner.find('.');
+                        size_t d2 = d1 == std::string::npos ? d1 : inner.find('.', d1 + 1);
+                        if (d2 == std::string::npos) return;
+                        std::string field = inner.substr(d2 + 1);
+                        Expr::TopicRead::Kind kind;
+                        if (field == "value") kind = Expr::TopicRead::Kind::Value;
+                        else if (field == "count") kind = Expr::TopicRead::Kind::Count;
+                        else if (field.rfind("at(", 0) == 0) kind = Expr::TopicRead::Kind::At;
+                        else return;
+                        std::string err = topic_read_error(inner.substr(0, d1), inner.substr(d1 + 1, d2 - d1 - 1), kind);
+                        if (!err.empty()) {
+                            diag.error(log->loc, err);
+                            has_error = true;
+                        }
+                    };
+
                     if (arg.size() >= 2 && arg.front() == '"') {
                         for (const auto& inner : extract_interpolations(arg)) {
                             if (is_simple_ident(inner)) check_var(inner);
+                            else check_topic_value(inner);
                         }
                         continue;
                     }
@@ -419,6 +503,46 @@ static bool check_logic(const Program& p, const DiagnosticEngine& diag) {
                                std::to_string(func_sym.param_types.size()) + ", got " + std::to_string(req->args.size()));
                     has_error = true;
                 }
+
+                if (req->timeout_ns < 0 || (req->timeout_ns > 0 && req->result.empty() && !req->is_await)) {
+                    diag.error(req->loc, "'timeout' needs a positive duration and a reply to wait for ('-> name')");
+                    has_error = true;
+                }
+                if (req->is_await && no_suspend) {
+                    diag.error(req->loc, std::string("'await' cannot be used in ") + no_suspend);
+                    has_error = true;
+                }
+                if (!req->result.empty()) {
+                    bool taken = false;
+                    for (const auto& p : current_params) taken = taken || p.name == req->result;
+                    for (const auto& p : pending_replies) taken = taken || p.name == req->result;
+                    if (taken) {
+                        diag.error(req->loc, "Reply name '" + req->result + "' is already in use");
+                        has_error = true;
+                    }
+                    Param reply{req->loc, req->result, func_sym.return_type};
+                    if (req->is_await) current_params.push_back(reply);
+                    else pending_replies.push_back(reply);
+                }
+                if (!req->awaits.empty()) {
+                    std::vector<Param> scope = current_params;
+                    for (const auto& name : req->awaits) {
+                        auto it = std::find_if(pending_replies.begin(), pending_replies.end(),
+                                               [&](const Param& p) { return p.name == name; });
+                        if (it == pending_replies.end()) {
+                            diag.error(req->loc, "'" + name + "' is not the reply of an earlier 'request async' in this block");
+                            has_error = true;
+                            continue;
+                        }
+                        scope.push_back(*it);
+                        pending_replies.erase(it);
+                    }
+                    const char* outer = no_suspend;
+                    no_suspend = "an 'on' block";
+                    validate_stmts(req->on_reply, current_node, scope);
+                    validate_stmts(req->on_timeout, current_node, current_params);
+                    no_suspend = outer;
+                }
             }
 
             if (auto trans = std::get_if<TransitionStmt>(&sp->v)) {
@@ -502,6 +626,10 @@ static bool check_logic(const Program& p, const DiagnosticEngine& diag) {
                 validate_stmts(ifs->else_body, current_node, current_params);
             }
         }
+        for (const auto& p : pending_replies) {
+            diag.error(p.loc, "Reply '" + p.name + "' is never waited for: add an 'on " + p.name + ":' block");
+            has_error = true;
+        }
     };
 
     auto validate_listener = [&](const OnListenDecl& lis, const std::string& current_node) {
@@ -518,6 +646,10 @@ static bool check_logic(const Program& p, const DiagnosticEngine& diag) {
             return;
         }
         TypeInfo topicType = src_node.topics[lis.topic_name].type;
+        if (lis.replay && !src_node.topics[lis.topic_name].history) {
+            diag.error(lis.loc, "'replay' needs a topic declared with 'history N'");
+            has_error = true;
+        }
 
         if (!lis.delegate_to.empty()) {
             auto& my_node = g_nodes[current_node];
@@ -536,18 +668,54 @@ static bool check_logic(const Program& p, const DiagnosticEngine& diag) {
                 has_error = true;
             }
         } else {
+            no_suspend = "a listener body; move it into a func and delegate with 'do'";
             validate_stmts(lis.body, current_node, lis.sig.params);
+            no_suspend = nullptr;
+        }
+    };
+
+    auto validate_timer = [&](const EveryDecl& t, const std::string& current_node) {
+        if (t.period_ns <= 0) {
+            diag.error(t.loc, "Timer period must be positive");
+            has_error = true;
+        }
+        if (t.delegate_to.empty()) {
+            validate_stmts(t.body, current_node, {});
+            return;
+        }
+        auto& my_node = g_nodes[current_node];
+        auto it = my_node.private_funcs.find(t.delegate_to);
+        if (it == my_node.private_funcs.end()) {
+            diag.error(t.loc, "Cannot delegate to unknown function '" + t.delegate_to + "'");
+            has_error = true;
+        } else if (!it->second.param_types.empty()) {
+            diag.error(t.loc, "Timer function '" + t.delegate_to + "' must take no arguments");
+            has_error = true;
         }
     };
 
+    for (const auto& decl : p.decls) {
+        if (auto n = std::get_if<NodeDecl>(&decl)) {
+            for (const auto& t : n->topics) {
+                if (t.history < 0 || (t.history > 0 && t.type.base != ValType::Int &&
+                                      t.type.base != ValType::Float && t.type.base != ValType::Bool)) {
+                    diag.error(t.loc, "'history' needs a positive depth and an int, float or bool topic");
+                    has_error = true;
+                }
+            }
+        }
+    }
+
     for (const auto& decl : p.decls) {
         if (auto n = std::get_if<NodeDecl>(&decl)) {
             for (const auto& req : n->requests)       validate_stmts(req.body, n->name, req.sig.params);
             for (const auto& func : n->private_funcs) validate_stmts(func.body, n->name, func.sig.params);
             for (const auto& lis : n->listeners)      validate_listener(lis, n->name);
+            for (const auto& t : n->timers)           validate_timer(t, n->name);
         } else if (auto m = std::get_if<ModeDecl>(&decl)) {
             validate_stmts(m->body, m->node_name, {});
             for (const auto& lis : m->listeners)      validate_listener(lis, m->node_name);
+            for (const auto& t : m->timers)           validate_timer(t, m->node_name);
         }
     }
 
@@ -559,3 +727,49 @@ bool validate_program(const Program& program, const DiagnosticEngine& diag) {
     collect_symbols(program, diag);
     return check_logic(program, diag);
 }
+
+bool validate_deployment(const Program& program, const std::vector<DeployProcess>& processes,
+                         const DiagnosticEngine& diag) {
+    auto process_of = [&](const std::string& node) -> const DeployProcess* {
+        for (const auto& proc : processes)
+            if (std::find(proc.nodes.begin(), proc.nodes.end(), node) != proc.nodes.end()) return &proc;
+        return nullptr;
+    };
+    bool ok = true;
+    std::function<void(const std::string&, const std::vector<StmtPtr>&)> scan =
+        [&](const std::string& node, const std::vector<StmtPtr>& body) {
+        for (const auto& sp : body) {
+            if (auto is = std::get_if<IfStmt>(&sp->v)) {
+                scan(node, is->then_body);
+                for (const auto& br : is->elifs) scan(node, br.body);
+                scan(node, is->else_body);
+            } else if (auto rq = std::get_if<RequestStmt>(&sp->v)) {
+                scan(node, rq->on_reply);
+                scan(node, rq->on_timeout);
+                if (process_of(node) == process_of(rq->target_node)) continue;
+                if (rq->is_await) {
+                    diag.error(rq->loc, "'await request " + rq->target_node + "." + rq->func_name +
+                                            "()' waits for a reply, which requests between processes do not carry");
+                    ok = false;
+                } else if (!rq->result.empty()) {
+                    diag.error(rq->loc, "'request async " + rq->target_node + "." + rq->func_name + "() -> " +
+                                            rq->result + "' waits for a reply, which requests between processes do not carry");
+                    ok = false;
+                }
+            }
+        }
+    };
+    for (const auto& decl : program.decls) {
+        if (auto n = std::get_if<NodeDecl>(&decl)) {
+            for (const auto& r : n->requests) scan(n->name, r.body);
+            for (const auto& l : n->listeners) scan(n->name, l.body);
+            for (const auto& t : n->timers) scan(n->name, t.body);
+            for (const auto& f : n->private_funcs) scan(n->name, f.body);
+        } else if (auto m = std::get_if<ModeDecl>(&decl)) {
+            scan(m->node_name, m->body);
+            for (const auto& l : m->listeners) scan(m->node_name, l.body);
+            for (const auto& t : m->timers) scan(m->node_name, t.body);
+        }
+    }
+    return ok;
+}
@@ -1,6 +1,12 @@
 #pragma once
 #include "ast.hpp"
+#include "deploy.hpp"
 #include "diag.hpp"
 
 bool validate_program(const Program& program,
                       const DiagnosticEngine& diag);
+
+// `--deploy`: checks what the split into processes rules out, such as waiting
+// for the reply to a request sent to another process.
+bool validate_deployment(const Program& program, const std::vector<DeployProcess>& processes,
+                         const DiagnosticEngine& diag);
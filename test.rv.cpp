@@ -8,66 +8,1752 @@
 #include <sstream>
 #include <algorithm>
 #include <utility>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <array>
+#include <cstdlib>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 
-enum class LogLevel { INFO, WARN, ERROR, DEBUG };
-struct Logger {
-    static void log(const std::string& node, LogLevel level, const std::string& msg) {
-        std::cout << "[" << node << "] ";
-        switch(level) {
-            case LogLevel::INFO:  std::cout << "[INFO] "; break;
-            case LogLevel::WARN:  std::cout << "\033[33m[WARN]\033[0m "; break;
-            case LogLevel::ERROR: std::cout << "\033[31m[ERROR]\033[0m "; break;
-            case LogLevel::DEBUG: std::cout << "\033[36m[DEBUG]\033[0m "; break;
+// In order of severity: a node logs a line when its level is at or above
+// the node's `log_level`.
+enum class LogLevel { DEBUG, INFO, WARN, ERROR };
+
+#if defined(_WIN32)
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Where the log writer sends its batches of whole lines. A sink is only ever
+// called from the writer thread (or, once the writer has stopped, from
+// whoever logs); it may modify `parts`.
+class LogSink {
+public:
+    virtual ~LogSink() = default;
+    virtual void write(iovec* parts, int count) = 0;
+
+protected:
+    static void write_all(int fd, iovec* v, int n) {
+#if defined(_WIN32)
+        for (int i = 0; i < n; ++i) std::fwrite(v[i].iov_base, 1, v[i].iov_len, fd == 1 ? stdout : stderr);
+#else
+        while (n > 0) {
+            ssize_t w = ::writev(fd, v, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return; // nowhere left to report it
+            }
+            while (n > 0 && (size_t)w >= v->iov_len) {
+                w -= (ssize_t)v->iov_len;
+                ++v;
+                --n;
+            }
+            if (n > 0) {
+                v->iov_base = static_cast<char*>(v->iov_base) + w;
+                v->iov_len -= (size_t)w;
+            }
+        }
+#endif
+    }
+};
+
+class StdoutSink : public LogSink {
+public:
+    void write(iovec* parts, int count) override { write_all(1, parts, count); }
+};
+
+#if !defined(_WIN32)
+// Appends to `path`; once it would grow past `max_bytes` it is renamed to
+// path.1 (path.1 to path.2, and so on, keeping `keep` old files) and a new
+// one is started.
+class RotatingFileSink : public LogSink {
+public:
+    RotatingFileSink(std::string path, uint64_t max_bytes, int keep)
+        : path(std::move(path)), max_bytes(max_bytes), keep(keep) {
+        open();
+    }
+    ~RotatingFileSink() override {
+        if (fd >= 0) ::close(fd);
+    }
+
+    void write(iovec* parts, int count) override {
+        uint64_t bytes = 0;
+        for (int i = 0; i < count; ++i) bytes += parts[i].iov_len;
+        if (size > 0 && size + bytes > max_bytes) rotate();
+        if (fd < 0) return;
+        write_all(fd, parts, count);
+        size += bytes;
+    }
+
+private:
+    std::string path;
+    uint64_t max_bytes;
+    int keep;
+    int fd = -1;
+    uint64_t size = 0;
+
+    void open() {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        struct stat st;
+        size = fd >= 0 && ::fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    }
+    void rotate() {
+        if (fd >= 0) ::close(fd);
+        for (int i = keep - 1; i >= 1; --i)
+            std::rename((path + "." + std::to_string(i)).c_str(), (path + "." + std::to_string(i + 1)).c_str());
+        if (keep > 0) std::rename(path.c_str(), (path + ".1").c_str());
+        else std::remove(path.c_str());
+        open();
+    }
+};
+#endif
+
+// `log` and `print` lines are formatted by the thread that logs them, in a
+// buffer of its own, and copied into that thread's ring; one writer thread
+// drains every ring and hands what it found to the sink as a single writev.
+// Logging takes no lock and never waits for the terminal. Lines from one
+// thread come out in order; lines from different threads interleave whole.
+//   RIVET_LOG_FILE=<path>      rotating file instead of stdout
+//   RIVET_LOG_FILE_MB=<n>      size at which it rotates (default 16)
+//   RIVET_LOG_FILE_KEEP=<n>    rotated files kept (default 3)
+//   RIVET_LOG_RING_KB=<n>      per-thread ring (default 64)
+//   RIVET_LOG_OVERFLOW=block|drop|count
+//       what a full ring does: wait for the writer (default), drop the line,
+//       or drop it and have the writer report how many were dropped (and
+//       how many were longer than the ring and cut to fit).
+class Logger {
+public:
+    enum class Overflow { Block, Drop, Count };
+
+    // A reusable line buffer. Reading it back does not copy.
+    class Text : private std::stringbuf, public std::ostream {
+    public:
+        Text() : std::ostream(static_cast<std::stringbuf*>(this)) {}
+        std::string_view view() const { return {pbase(), size_t(pptr() - pbase())}; }
+        void reset() {
+            clear();
+            flags(std::ios_base::dec | std::ios_base::skipws);
+            precision(6);
+            seekp(0);
+        }
+    };
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    // The calling thread's next free line buffer, empty; release() hands it
+    // back. Nested (a value being formatted logs), each gets its own.
+    Text& acquire() {
+        Local& l = local();
+        if (l.depth == l.texts.size()) l.texts.emplace_back(new Text());
+        Text& t = *l.texts[l.depth++];
+        t.reset();
+        return t;
+    }
+    void release() { --local().depth; }
+
+    // Queues `t` as one line (a newline is added unless it ends in one).
+    void commit(Text& t) {
+        if (t.view().empty() || t.view().back() != '\n') t.put('\n');
+        std::string_view line = t.view();
+        if (!running.load(std::memory_order_acquire)) {
+            write_direct(line);
+            return;
+        }
+        Ring& r = *local().ring;
+        // A line longer than the ring keeps its head, [Node] [LEVEL] included.
+        static constexpr std::string_view cut = " [truncated]\n";
+        std::string_view end;
+        if (line.size() > r.cap) {
+            line = line.substr(0, r.cap - cut.size());
+            end = cut;
+            truncated.fetch_add(1, std::memory_order_relaxed);
+        }
+        for (;;) {
+            const uint64_t h = r.head.load(std::memory_order_relaxed);
+            if (r.cap - (h - r.tail.load(std::memory_order_acquire)) >= line.size() + end.size()) {
+                put(r, h, line);
+                put(r, h + line.size(), end);
+                r.head.store(h + line.size() + end.size(), std::memory_order_seq_cst);
+                wake();
+                return;
+            }
+            if (overflow != Overflow::Block) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            wake();
+            std::this_thread::yield();
+        }
+    }
+
+    // Returns once everything logged before the call has reached the sink.
+    void flush() {
+        std::vector<std::pair<Ring*, uint64_t>> upto;
+        for (Ring* r = rings.load(std::memory_order_acquire); r; r = r->next)
+            upto.emplace_back(r, r->head.load(std::memory_order_acquire));
+        for (auto& [r, h] : upto) drain(*r, h);
+    }
+
+    // Drains the rings and stops the writer; later lines are written in place.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (!running.load()) return;
+            stopping = true;
+        }
+        cv.notify_one();
+        writer.join();
+        running.store(false, std::memory_order_release);
+    }
+
+    // Lines from here on go to `s`.
+    void set_sink(std::unique_ptr<LogSink> s) {
+        std::lock_guard<std::mutex> lock(sink_mu);
+        sink = std::move(s);
+    }
+
+    uint64_t dropped_lines() const { return dropped.load(std::memory_order_relaxed); }
+    uint64_t truncated_lines() const { return truncated.load(std::memory_order_relaxed); }
+
+    // The `log_level` of nodes without a `{log: ...}` config: RIVET_LOG_LEVEL,
+    // or every level that was compiled in.
+    static LogLevel default_level() {
+        static const LogLevel level = [] {
+            const char* v = std::getenv("RIVET_LOG_LEVEL");
+            if (!v) return LogLevel::DEBUG;
+            if (std::strcmp(v, "info") == 0) return LogLevel::INFO;
+            if (std::strcmp(v, "warn") == 0) return LogLevel::WARN;
+            if (std::strcmp(v, "error") == 0) return LogLevel::ERROR;
+            return LogLevel::DEBUG;
+        }();
+        return level;
+    }
+
+private:
+    // Single producer (its thread), single consumer (the writer). head and
+    // tail count bytes ever written and read; a line may wrap.
+    struct Ring {
+        explicit Ring(size_t cap) : cap(cap), data(new char[cap]) {}
+        const size_t cap;
+        std::unique_ptr<char[]> data;
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        Ring* next = nullptr;
+    };
+    // A thread that exits waits for its ring to empty, so what it logged
+    // comes out before anything logged after it has been joined.
+    struct Local {
+        Ring* ring = nullptr;
+        std::vector<std::unique_ptr<Text>> texts;
+        size_t depth = 0;
+        ~Local() {
+            if (ring) Logger::instance().drain(*ring, ring->head.load(std::memory_order_relaxed));
+        }
+    };
+
+    std::atomic<Ring*> rings{nullptr}; // every thread's, never freed before the logger
+    size_t ring_bytes = 64 * 1024;
+    Overflow overflow = Overflow::Block;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> truncated{0}; // lines cut to fit their ring
+    std::mutex sink_mu;
+    std::unique_ptr<LogSink> sink;
+    std::atomic<bool> running{false};
+    std::atomic<bool> sleeping{false};
+    bool stopping = false;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::thread writer;
+
+    Logger() {
+        if (const char* kb = std::getenv("RIVET_LOG_RING_KB")) ring_bytes = std::max(1L, std::atol(kb)) * 1024;
+        if (const char* o = std::getenv("RIVET_LOG_OVERFLOW")) {
+            if (std::strcmp(o, "drop") == 0) overflow = Overflow::Drop;
+            else if (std::strcmp(o, "count") == 0) overflow = Overflow::Count;
+        }
+#if !defined(_WIN32)
+        if (const char* path = std::getenv("RIVET_LOG_FILE")) {
+            const char* mb = std::getenv("RIVET_LOG_FILE_MB");
+            const char* keep = std::getenv("RIVET_LOG_FILE_KEEP");
+            sink.reset(new RotatingFileSink(path, (uint64_t)std::max(1L, mb ? std::atol(mb) : 16L) << 20,
+                                            keep ? std::max(0, std::atoi(keep)) : 3));
+        }
+#endif
+        if (!sink) sink.reset(new StdoutSink());
+        running.store(true);
+#if defined(_WIN32)
+        writer = std::thread([this] { run(); });
+#else
+        // The writer may start before the event loop claims SIGINT/SIGTERM;
+        // it must never be the thread they are delivered to.
+        sigset_t all, saved;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &saved);
+        writer = std::thread([this] { run(); });
+        pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+#endif
+    }
+    ~Logger() {
+        stop();
+        for (Ring* r = rings.load(); r;) {
+            Ring* next = r->next;
+            delete r;
+            r = next;
+        }
+    }
+
+    Local& local() {
+        static thread_local Local l;
+        if (!l.ring) {
+            l.ring = new Ring(ring_bytes);
+            l.ring->next = rings.load(std::memory_order_relaxed);
+            while (!rings.compare_exchange_weak(l.ring->next, l.ring, std::memory_order_release)) {}
+        }
+        return l;
+    }
+
+    void drain(Ring& r, uint64_t upto) {
+        while (running.load(std::memory_order_acquire) && r.tail.load(std::memory_order_acquire) < upto) {
+            wake();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    // Copies `text` into the ring from byte `at` on, wrapping at the end.
+    static void put(Ring& r, uint64_t at, std::string_view text) {
+        const size_t from = at % r.cap, first = std::min(text.size(), r.cap - from);
+        std::memcpy(&r.data[from], text.data(), first);
+        std::memcpy(&r.data[0], text.data() + first, text.size() - first);
+    }
+
+    void wake() {
+        if (sleeping.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mu);
+            cv.notify_one();
+        }
+    }
+
+    void write_direct(std::string_view line) {
+        iovec v{const_cast<char*>(line.data()), line.size()};
+        std::lock_guard<std::mutex> lock(sink_mu);
+        sink->write(&v, 1);
+    }
+
+    bool pending() const {
+        for (Ring* r = rings.load(std::memory_order_acquire); r; r = r->next)
+            if (r->head.load(std::memory_order_seq_cst) != r->tail.load(std::memory_order_relaxed)) return true;
+        return false;
+    }
+
+    void run() {
+        std::vector<iovec> parts;
+        std::vector<std::pair<Ring*, uint64_t>> taken;
+        uint64_t reported = 0, reported_cut = 0;
+        for (;;) {
+            parts.clear();
+            taken.clear();
+            for (Ring* r = rings.load(std::memory_order_acquire); r; r = r->next) {
+                const uint64_t t = r->tail.load(std::memory_order_relaxed);
+                const uint64_t h = r->head.load(std::memory_order_acquire);
+                if (h == t) continue;
+                const size_t at = t % r->cap, first = std::min<uint64_t>(h - t, r->cap - at);
+                parts.push_back(iovec{&r->data[at], first});
+                if (h - t > first) parts.push_back(iovec{&r->data[0], size_t(h - t - first)});
+                taken.emplace_back(r, h);
+            }
+            std::string notice;
+            if (overflow == Overflow::Count && dropped.load(std::memory_order_relaxed) != reported) {
+                const uint64_t now = dropped.load(std::memory_order_relaxed);
+                notice = "[LOG] " + std::to_string(now - reported) + " lines dropped, ring full: raise RIVET_LOG_RING_KB\n";
+                reported = now;
+            }
+            if (overflow == Overflow::Count && truncated.load(std::memory_order_relaxed) != reported_cut) {
+                const uint64_t now = truncated.load(std::memory_order_relaxed);
+                notice += "[LOG] " + std::to_string(now - reported_cut) +
+                          " lines truncated, longer than the ring: raise RIVET_LOG_RING_KB\n";
+                reported_cut = now;
+            }
+            if (!notice.empty()) parts.push_back(iovec{&notice[0], notice.size()});
+            if (!parts.empty()) {
+                {
+                    std::lock_guard<std::mutex> lock(sink_mu);
+                    sink->write(parts.data(), (int)parts.size());
+                }
+                for (auto& [r, h] : taken) r->tail.store(h, std::memory_order_release);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mu);
+            if (stopping && !pending()) return;
+            sleeping.store(true, std::memory_order_seq_cst);
+            if (!pending()) cv.wait_for(lock, std::chrono::milliseconds(100));
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+};
+
+// One line through the logger: `LogLine(name, LogLevel::WARN) << ...;` for a
+// node's `log`, `LogLine() << ...;` for anything else. The line is queued
+// when the statement ends.
+class LogLine {
+public:
+    LogLine() : t(Logger::instance().acquire()) {}
+    LogLine(const std::string& node, LogLevel level) : LogLine() {
+        t << "[" << node << "] ";
+        switch (level) {
+            case LogLevel::INFO:  t << "[INFO] "; break;
+            case LogLevel::WARN:  t << "\033[33m[WARN]\033[0m "; break;
+            case LogLevel::ERROR: t << "\033[31m[ERROR]\033[0m "; break;
+            case LogLevel::DEBUG: t << "\033[36m[DEBUG]\033[0m "; break;
+        }
+    }
+    ~LogLine() {
+        Logger::instance().commit(t);
+        Logger::instance().release();
+    }
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    template <typename V>
+    LogLine& operator<<(const V& v) {
+        t << v;
+        return *this;
+    }
+    // For functions that print to a std::ostream.
+    std::ostream& stream() { return t; }
+
+private:
+    Logger::Text& t;
+};
+
+// Grace-period tracking for copy-on-write snapshots. Readers bump the counter of
+// the epoch parity they observed; writers swap in a new snapshot and retire the
+// old one, which is reclaimed once both parities have drained past it. Nothing
+// here blocks, so a handler may subscribe to the topic that is calling it.
+class Rcu {
+    // The reader counts are spread over cache lines by thread, so publishers
+    // on different threads (to any topics) do not write the same line.
+    struct alignas(64) Shard {
+        std::atomic<long> readers[2];
+    };
+    static constexpr size_t Shards = 32;
+    static inline Shard shards[Shards];
+    static inline std::atomic<size_t> next_shard{0};
+
+    static Shard& local_shard() {
+        static thread_local Shard& s = shards[next_shard.fetch_add(1, std::memory_order_relaxed) % Shards];
+        return s;
+    }
+
+public:
+    class ReadGuard {
+        Shard& shard;
+        unsigned parity;
+    public:
+        ReadGuard() : shard(local_shard()), parity(epoch.load() & 1u) { shard.readers[parity].fetch_add(1); }
+        ~ReadGuard() { shard.readers[parity].fetch_sub(1); }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    };
+
+    template <typename U>
+    static void retire(const U* p) {
+        std::lock_guard<std::mutex> lock(mu);
+        retired.push_back(Retired{epoch.load(), [p] { delete p; }});
+        collect_locked();
+    }
+
+    // Reclaims whatever has passed its grace period. Called from writers and
+    // periodically from the main loop.
+    static void collect() {
+        std::lock_guard<std::mutex> lock(mu);
+        collect_locked();
+    }
+
+private:
+    struct Retired {
+        unsigned epoch;
+        std::function<void()> reclaim;
+    };
+
+    static inline std::atomic<unsigned> epoch{0};
+    static inline std::mutex mu;
+    static inline std::vector<Retired> retired;
+
+    // A guard increments and decrements the same shard, so no shard goes
+    // below zero and a zero sum means no reader of `parity` was in before
+    // its shard was read.
+    static long readers(unsigned parity) {
+        long n = 0;
+        for (const auto& s : shards) n += s.readers[parity].load();
+        return n;
+    }
+
+    static void collect_locked() {
+        // Advance while the parity that is not being entered has drained.
+        for (int i = 0; i < 2; ++i) {
+            unsigned e = epoch.load();
+            if (readers((e + 1) & 1u) != 0) break;
+            epoch.store(e + 1);
+        }
+        unsigned now = epoch.load();
+        auto keep = std::partition(retired.begin(), retired.end(),
+                                   [&](const Retired& r) { return now - r.epoch < 2; });
+        for (auto it = keep; it != retired.end(); ++it) it->reclaim();
+        retired.erase(keep, retired.end());
+    }
+};
+
+// Monotonic time for everything the runtime schedules or rate-limits. Under
+// --sim it is virtual: it starts at 0 and only the event loop moves it.
+struct Clock {
+#if defined(RIVET_SIM)
+    static inline int64_t virtual_ns = 0;
+    static int64_t now_ns() { return virtual_ns; }
+#else
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+#endif
+};
+
+// Per-listener `every` / `debounce` / `sample` policy. It is checked on the
+// publishing side, before a handler is called or queued, so dropped samples
+// cost a couple of atomic operations and never touch the listener's mailbox.
+// Stateless apart from timestamps and a counter: no timer per subscription.
+class ListenGate {
+    static constexpr int64_t Never = std::numeric_limits<int64_t>::min() / 2;
+    const int64_t every_ns;
+    const int64_t debounce_ns;
+    const uint64_t sample_every;
+    std::atomic<uint64_t> seen{0};
+    std::atomic<int64_t> last_seen{Never};
+    std::atomic<int64_t> last_pass{Never};
+
+public:
+    ListenGate(int64_t every, int64_t debounce, int sample)
+        : every_ns(every), debounce_ns(debounce), sample_every(sample > 1 ? (uint64_t)sample : 1) {}
+
+    bool admit() {
+        // sample 1/N: keep the 1st, (N+1)th, ... sample.
+        if (sample_every > 1 && seen.fetch_add(1, std::memory_order_relaxed) % sample_every != 0) return false;
+        if (!every_ns && !debounce_ns) return true;
+        int64_t now = Clock::now_ns();
+        // debounce: leading edge, i.e. pass a sample only after a quiet gap.
+        if (debounce_ns && now - last_seen.exchange(now, std::memory_order_relaxed) < debounce_ns) return false;
+        // every: at most one sample per period; the CAS settles racing publishers.
+        if (every_ns) {
+            int64_t prev = last_pass.load(std::memory_order_relaxed);
+            if (now - prev < every_ns) return false;
+            if (!last_pass.compare_exchange_strong(prev, now, std::memory_order_relaxed)) return false;
         }
-        std::cout << msg << std::endl;
+        return true;
+    }
+};
+
+// What a subscriber receives: a reference to the value being published. A
+// handler that runs on another thread calls share() instead, which copies the
+// value into an immutable buffer once per publish and hands every later caller
+// the same buffer.
+template <typename T>
+class Payload {
+    const T& ref;
+    mutable std::shared_ptr<const T> shared;
+
+public:
+    explicit Payload(const T& v) : ref(v) {}
+    Payload(const Payload&) = delete;
+    Payload& operator=(const Payload&) = delete;
+
+    const T& get() const { return ref; }
+    operator const T&() const { return ref; }
+
+    std::shared_ptr<const T> share() const {
+        if (!shared) shared = std::make_shared<const T>(ref);
+        return shared;
+    }
+};
+
+// carry() picks what a queued handler captures: scalars by value, anything
+// else as the shared buffer. unwrap() turns either back into `const T&`.
+template <typename T>
+auto carry(const Payload<T>& p) {
+    if constexpr (std::is_arithmetic_v<T>) return p.get();
+    else return p.share();
+}
+template <typename T>
+const T& unwrap(const T& v) { return v; }
+template <typename T>
+const T& unwrap(const std::shared_ptr<const T>& p) { return *p; }
+
+// One bit of a ListenSet: a subscription that only delivers while it is set.
+struct ListenSlot {
+    const std::atomic<uint64_t>* word = nullptr; // null: always on
+    uint64_t bit = 0;
+
+    bool on() const { return !word || (word->load(std::memory_order_acquire) & bit); }
+};
+
+// The listeners declared in a node's mode blocks, one bit each. The compiler
+// subscribes every one of them once, at init, and precomputes for each mode
+// the bits it turns on; a mode change then stores the new bits a word at a
+// time, so it allocates nothing and touches no subscriber lists. Only the
+// node's own executor changes the bits.
+template <size_t N>
+class ListenSet {
+public:
+    static constexpr size_t Words = (N + 63) / 64;
+    using Mask = std::array<uint64_t, Words>;
+
+    ListenSlot slot(size_t i) const { return ListenSlot{&bits[i / 64], uint64_t(1) << (i % 64)}; }
+
+    // Clears the bits of `scope`, then sets those of `on`.
+    void assign(const Mask& scope, const Mask& on) {
+        for (size_t w = 0; w < Words; ++w)
+            bits[w].store((bits[w].load(std::memory_order_relaxed) & ~scope[w]) | on[w], std::memory_order_release);
     }
+    void set(size_t i) { bits[i / 64].fetch_or(uint64_t(1) << (i % 64), std::memory_order_release); }
+
+private:
+    std::array<std::atomic<uint64_t>, Words> bits{};
 };
 
 template <typename T>
 class Topic {
     struct Sub {
         int id;
-        std::function<void(T)> cb;
+        std::function<void(const Payload<T>&)> cb;
+        ListenSlot slot;
     };
-    std::vector<Sub> subscribers;
+    using Snapshot = std::vector<Sub>;
+
+    // Publishers only ever read the current snapshot; subscribe/unsubscribe
+    // copy it, swap the pointer and hand the old one to Rcu.
+    std::atomic<const Snapshot*> subscribers{new Snapshot()};
+    std::mutex write_mu;
     int next_id = 1;
+
+    void swap_in(Snapshot* next) {
+        const Snapshot* old = subscribers.exchange(next);
+        Rcu::retire(old);
+    }
+
 public:
-    void publish(T val) {
-        for (auto& s : subscribers) {
-            if (s.cb) s.cb(val);
+    using value_type = T;
+
+    Topic() = default;
+    ~Topic() { delete subscribers.load(); }
+    Topic(const Topic&) = delete;
+    Topic& operator=(const Topic&) = delete;
+
+    void publish(const T& val) {
+        Rcu::ReadGuard guard;
+        const Snapshot* snap = subscribers.load();
+        Payload<T> msg(val);
+        for (const auto& s : *snap) {
+            if (s.cb && s.slot.on()) s.cb(msg);
         }
     }
 
-    // Returns a subscription handle that can be used to unsubscribe.
-    int subscribe(std::function<void(T)> cb) {
+    // Returns a subscription handle that can be used to unsubscribe. With a
+    // slot, samples are only delivered while the slot is on.
+    int subscribe(std::function<void(const Payload<T>&)> cb, ListenSlot slot = {}) {
+        std::lock_guard<std::mutex> lock(write_mu);
+        auto* next = new Snapshot(*subscribers.load());
         int id = next_id++;
-        subscribers.push_back(Sub{id, std::move(cb)});
+        next->push_back(Sub{id, std::move(cb), slot});
+        swap_in(next);
         return id;
     }
 
     void unsubscribe(int id) {
-        subscribers.erase(
-            std::remove_if(subscribers.begin(), subscribers.end(),
+        std::lock_guard<std::mutex> lock(write_mu);
+        auto* next = new Snapshot(*subscribers.load());
+        next->erase(
+            std::remove_if(next->begin(), next->end(),
                            [&](const Sub& s) { return s.id == id; }),
-            subscribers.end());
+            next->end());
+        swap_in(next);
+    }
+};
+
+// Last-value slot for `latched` topics. Plain values sit behind a seqlock: the
+// publisher never waits for readers, and a reader retries only if a publish
+// overlapped its copy. The words are relaxed atomics so the racing copy is
+// well defined.
+template <typename T>
+class Seqlock {
+    static constexpr size_t Words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> data[Words] = {};
+
+public:
+    void store(const T& v) {
+        uint64_t buf[Words] = {};
+        std::memcpy(buf, &v, sizeof(T));
+        // Odd sequence = write in progress; publishers of one topic take turns.
+        uint64_t s = seq.load(std::memory_order_relaxed);
+        while ((s & 1) || !seq.compare_exchange_weak(s, s + 1, std::memory_order_relaxed)) {
+            s = seq.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t w = 0; w < Words; ++w) data[w].store(buf[w], std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        uint64_t buf[Words];
+        for (;;) {
+            uint64_t s = seq.load(std::memory_order_acquire);
+            if (s & 1) continue;
+            for (size_t w = 0; w < Words; ++w) buf[w] = data[w].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s) break;
+        }
+        T v;
+        std::memcpy(&v, buf, sizeof(T));
+        return v;
+    }
+};
+
+// Values that cannot be copied bytewise (strings) are swapped in whole and the
+// old copy handed to Rcu, so readers still never hold up the publisher.
+template <typename T>
+class RcuBox {
+    std::atomic<const T*> cur{new T()};
+    std::mutex write_mu;
+
+public:
+    RcuBox() = default;
+    ~RcuBox() { delete cur.load(); }
+    RcuBox(const RcuBox&) = delete;
+    RcuBox& operator=(const RcuBox&) = delete;
+
+    void store(const T& v) {
+        std::lock_guard<std::mutex> lock(write_mu);
+        Rcu::retire(cur.exchange(new T(v)));
+    }
+
+    T load() const {
+        Rcu::ReadGuard guard;
+        return *cur.load();
+    }
+};
+
+template <typename T>
+using Latch = std::conditional_t<std::is_trivially_copyable_v<T>, Seqlock<T>, RcuBox<T>>;
+
+// A topic that also remembers what it last published. Until the first publish
+// value() is the type's zero value.
+template <typename TopicT>
+class Latched : public TopicT {
+    using T = typename TopicT::value_type;
+    Latch<T> latest;
+
+public:
+    void publish(const T& val) {
+        latest.store(val);
+        TopicT::publish(val);
+    }
+    T value() const { return latest.load(); }
+};
+
+// Fixed ring of the last N samples for `history N` topics; all storage is
+// inline, so publishing never allocates. Each slot is its own seqlock, so a
+// reader racing the publisher gets a whole sample (possibly a newer one if the
+// ring wrapped under it), never a torn one.
+template <typename T, size_t N>
+class HistoryRing {
+    static_assert(N > 0, "history depth must be positive");
+    std::atomic<uint64_t> claimed{0};
+    std::atomic<uint64_t> committed{0};
+    Seqlock<T> slots[N];
+
+public:
+    void push(const T& v) {
+        uint64_t seq = claimed.fetch_add(1, std::memory_order_relaxed);
+        slots[seq % N].store(v);
+        // Publish in claim order so `committed` never exposes an unwritten slot.
+        while (committed.load(std::memory_order_acquire) != seq) std::this_thread::yield();
+        committed.store(seq + 1, std::memory_order_release);
+    }
+
+    // Samples published so far (not capped at N).
+    uint64_t published() const { return committed.load(std::memory_order_acquire); }
+    size_t count() const { return (size_t)std::min<uint64_t>(published(), N); }
+
+    // at(0) is the newest sample; out-of-range reads give the zero value.
+    T at(int64_t i) const {
+        uint64_t n = published();
+        if (i < 0 || (uint64_t)i >= std::min<uint64_t>(n, N)) return T{};
+        return slots[(n - 1 - (uint64_t)i) % N].load();
+    }
+
+    // Calls f(sample) oldest first for the buffered samples published before
+    // sequence number `upto`.
+    template <typename F>
+    void replay(uint64_t upto, F&& f) const {
+        uint64_t from = upto > N ? upto - N : 0;
+        for (uint64_t s = from; s < upto; ++s) f(slots[s % N].load());
+    }
+};
+
+template <typename TopicT, size_t N>
+class History : public TopicT {
+    using T = typename TopicT::value_type;
+    HistoryRing<T, N> ring;
+
+public:
+    void publish(const T& val) {
+        ring.push(val);
+        TopicT::publish(val);
+    }
+    T value() const { return ring.at(0); }
+    size_t count() const { return ring.count(); }
+    T at(int64_t i) const { return ring.at(i); }
+    uint64_t published() const { return ring.published(); }
+    template <typename F>
+    void replay(uint64_t upto, F&& f) const { ring.replay(upto, std::forward<F>(f)); }
+};
+
+// Mode names are interned by the compiler: system modes into the SysMode ids
+// of the generated program (0 is Init), each node's local modes into ids of
+// its own. A node registers for the system modes it has blocks for and is
+// only called on transitions into or out of one of them, so a transition
+// costs the same however many modes and uninterested nodes there are.
+using ModeId = uint16_t;
+
+// Mode changes run to completion: a change asked for while another is being
+// applied (a reaction transitioning again, or another thread) is queued and
+// applied after it, in a loop, so reactions never nest and the stack stays
+// flat however long the chain. A change that repeats the one queued just
+// before it is dropped.
+class ModeQueue {
+public:
+    // True if the caller is to apply `m` now, then keep applying next() until
+    // it returns false. Otherwise `m` is queued (or dropped) for whoever is
+    // applying.
+    bool request(ModeId m) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (busy) {
+            if (pending.empty() || pending.back() != m) pending.push_back(m);
+            return false;
+        }
+        busy = true;
+        return true;
+    }
+    bool next(ModeId& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (pending.empty()) {
+            busy = false;
+            return false;
+        }
+        m = pending.front();
+        pending.pop_front();
+        return true;
     }
+
+private:
+    std::mutex mu;
+    bool busy = false;
+    std::deque<ModeId> pending;
 };
 
+// A transition fans out: each interested node's reaction is queued on that
+// node's executor (its actor thread, or the pool's workers), so the reactions
+// run in parallel, each node's still in order with its other work. Nodes run
+// in-line react in place, one after another. The transition is complete when
+// the last reaction returns: that one applies the next queued transition, so
+// no transition starts before every node has reacted to the one before it.
+// RIVET_TRANSITION_STATS=1 prints each transition's latency, from the
+// `transition system` until the last reaction, and every node's reaction time.
 class SystemManager {
 public:
-    static std::string current_mode;
-    static std::vector<std::function<void(std::string)>> on_transition;
-    static void set_mode(const std::string& m) {
-        if (current_mode != m) {
-            std::cout << "[SYS] Transitioning to: " << m << std::endl;
-            current_mode = m;
-            for (auto& cb : on_transition) cb(m);
+    using Reaction = void (*)(ModeId);
+    using Post = void (*)(std::function<void()>); // queues on the node's executor
+
+    static inline ModeId current_mode = 0;
+
+    // Called by main() before anything registers.
+    static void declare(const char* const* mode_names, size_t count) {
+        names = mode_names;
+        by_mode.assign(count, {});
+    }
+    // `react` runs, with the new mode, for every transition into or out of
+    // one of `modes`; through `post` if given, in place if not.
+    static void on(const char* node, std::initializer_list<ModeId> modes, Reaction react, Post post = nullptr) {
+        nodes.push_back(Node{node, react, post, std::vector<bool>(by_mode.size()), 0});
+        for (ModeId m : modes) {
+            nodes.back().modes[m] = true;
+            by_mode[m].push_back(nodes.size() - 1);
+        }
+    }
+    static const char* name(ModeId m) { return names[m]; }
+    static size_t count() { return by_mode.size(); }
+
+    static void set_mode(ModeId m) {
+        if (auto f = forward.load(std::memory_order_acquire)) return f(m);
+        apply(m);
+    }
+    // Makes the transition here even when another process decides the mode.
+    static void apply(ModeId m) {
+        if (!queue.request(m)) return;
+        run_from(m);
+    }
+
+    // --deploy: `forward` sends a set_mode() to the process that decides the
+    // system mode instead of making it here; `announce` sees each transition
+    // this process makes, in order, as it starts.
+    static inline std::atomic<Reaction> forward{nullptr};
+    static inline std::atomic<Reaction> announce{nullptr};
+
+private:
+    struct Node {
+        const char* name;
+        Reaction react;
+        Post post;
+        std::vector<bool> modes;
+        int64_t took_ns; // of its last reaction; read once the barrier is passed
+    };
+
+    // Applies `m` and whatever is queued after it, until a transition has
+    // reactions still running elsewhere; the last of those carries on.
+    static void run_from(ModeId m) {
+        do {
+            if (!start(m)) return;
+        } while (queue.next(m));
+    }
+
+    // True if the transition completed before returning.
+    static bool start(ModeId m) {
+        if (current_mode == m) return true;
+        LogLine() << "[SYS] Transitioning to: " << names[m];
+        const ModeId from = current_mode;
+        current_mode = m;
+        if (auto a = announce.load(std::memory_order_acquire)) a(m);
+        // Entering nodes first, then the ones only leaving, each in
+        // registration order.
+        reacting.clear();
+        for (size_t n : by_mode[m]) reacting.push_back(n);
+        for (size_t n : by_mode[from])
+            if (!nodes[n].modes[m]) reacting.push_back(n);
+        started_ns = Clock::now_ns();
+        pending.store(reacting.size() + 1, std::memory_order_relaxed); // +1: held until all are queued
+        for (size_t n : reacting) {
+            if (nodes[n].post) nodes[n].post([n, m] { react(n, m); });
+            else react(n, m);
+        }
+        return arrive();
+    }
+
+    static void react(size_t n, ModeId m) {
+        const int64_t t0 = Clock::now_ns();
+        nodes[n].react(m);
+        nodes[n].took_ns = Clock::now_ns() - t0;
+        if (!arrive()) return;
+        // Last one out: the transition is complete here.
+        if (queue.next(m)) run_from(m);
+    }
+
+    // The barrier. True for whoever brings it to zero.
+    static bool arrive() {
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return false;
+        static const bool stats = std::getenv("RIVET_TRANSITION_STATS") != nullptr;
+        if (stats) {
+            LogLine line;
+            line << "[SYS] " << names[current_mode] << " complete in " << (Clock::now_ns() - started_ns) / 1000 << "us";
+            for (size_t i = 0; i < reacting.size(); ++i)
+                line << (i ? ", " : ": ") << nodes[reacting[i]].name << " " << nodes[reacting[i]].took_ns / 1000 << "us";
+        }
+        return true;
+    }
+
+    static inline const char* const* names = nullptr;
+    static inline std::vector<Node> nodes;
+    static inline std::vector<std::vector<size_t>> by_mode; // mode -> nodes
+    static inline ModeQueue queue;
+    // The transition in flight; only its starter and its last reaction touch these.
+    static inline std::vector<size_t> reacting;
+    static inline int64_t started_ns = 0;
+    static inline std::atomic<size_t> pending{0};
+};
+
+
+#include <string_view>
+
+// The binary form of topic samples and request arguments, for anything that
+// leaves the process. Fields follow each other in declaration order with no
+// tags: ints are zigzag varints, floats 8 little-endian bytes, bools one byte
+// and strings a varint length followed by the bytes. Every topic and request
+// gets a generated codec carrying a schema hash of its declaration, so both
+// ends can tell whether they were built from the same one.
+class WireWriter {
+    uint8_t* begin;
+    uint8_t* p;
+    uint8_t* end;
+    bool fits = true;
+
+    bool room(size_t n) {
+        if ((size_t)(end - p) >= n) return true;
+        fits = false;
+        p = end;
+        return false;
+    }
+
+public:
+    WireWriter(uint8_t* buf, size_t cap) : begin(buf), p(buf), end(buf + cap) {}
+
+    void varint(uint64_t v) {
+        if (!room(v < 0x80 ? 1 : (size_t)(70 - __builtin_clzll(v)) / 7)) return;
+        while (v >= 0x80) {
+            *p++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (uint8_t)v;
+    }
+    void fixed64(uint64_t v) {
+        if (!room(8)) return;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::memcpy(p, &v, 8);
+        p += 8;
+#else
+        for (int i = 0; i < 8; ++i) *p++ = (uint8_t)(v >> (8 * i));
+#endif
+    }
+    void put(int v) { varint(((uint64_t)(int64_t)v << 1) ^ (uint64_t)((int64_t)v >> 63)); }
+    void put(double v) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof bits);
+        fixed64(bits);
+    }
+    void put(bool v) {
+        if (room(1)) *p++ = v ? 1 : 0;
+    }
+    void put(std::string_view v) {
+        varint(v.size());
+        if (!room(v.size())) return;
+        std::memcpy(p, v.data(), v.size());
+        p += v.size();
+    }
+
+    // False once something did not fit; the contents are then unusable.
+    bool ok() const { return fits; }
+    const uint8_t* data() const { return begin; }
+    size_t size() const { return (size_t)(p - begin); }
+};
+
+// Reads what WireWriter wrote. Strings come back as views into the input, so
+// decoding never allocates; they are valid as long as the input is.
+class WireReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool good = true;
+
+    bool need(size_t n) {
+        if ((size_t)(end - p) >= n) return true;
+        good = false;
+        p = end;
+        return false;
+    }
+
+public:
+    WireReader(const uint8_t* data, size_t n) : p(data), end(data + n) {}
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (!need(1)) return 0;
+            uint8_t b = *p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        good = false;
+        return 0;
+    }
+    uint64_t fixed64() {
+        if (!need(8)) return 0;
+        uint64_t v = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::memcpy(&v, p, 8);
+        p += 8;
+#else
+        for (int i = 0; i < 8; ++i) v |= (uint64_t)*p++ << (8 * i);
+#endif
+        return v;
+    }
+    void get(int& v) {
+        uint64_t z = varint();
+        v = (int)(int64_t)((z >> 1) ^ (~(z & 1) + 1));
+    }
+    void get(double& v) {
+        uint64_t bits = fixed64();
+        std::memcpy(&v, &bits, sizeof v);
+    }
+    void get(bool& v) {
+        v = need(1) && *p++ != 0;
+    }
+    void get(std::string_view& v) {
+        uint64_t n = varint();
+        if (!need(n)) {
+            v = {};
+            return;
+        }
+        v = std::string_view(reinterpret_cast<const char*>(p), n);
+        p += n;
+    }
+
+    bool ok() const { return good; }
+    // Everything read, nothing malformed.
+    bool done() const { return good && p == end; }
+};
+
+
+#include <cstdlib>
+#include <deque>
+#include <map>
+
+// Hierarchical timing wheel (after Varghese & Lauck) behind `every` timers.
+// Four levels of 64 slots at 100 us resolution reach ~28 minutes (longer
+// timers park in the top level and are re-placed as it turns); a timer sits in
+// the level that matches how far off it is and cascades down as the wheel
+// turns, so start and cancel are O(1) list splices whatever the timer count.
+// Timers live in a slab addressed by index + generation, so a stale Id never
+// touches a reused slot. The main thread's event loop turns the wheel and runs
+// callbacks; any thread may start or cancel. Statistics are kept per label, i.e. per
+// `every` declaration, across the mode entries that restart it.
+class Timers {
+public:
+    using Id = uint64_t;
+    using Callback = std::function<void(Id)>;
+
+    struct Stats {
+        const char* label = "";
+        int64_t period_ns = 0;
+        uint64_t fires = 0;
+        uint64_t missed = 0;       // periods skipped because the wheel ran late
+        int64_t jitter_sum_ns = 0; // sum of (fire time - due time)
+        int64_t jitter_max_ns = 0;
+    };
+
+    static Timers& instance() {
+        static Timers t;
+        return t;
+    }
+
+    Id start(const char* label, int64_t period_ns, Callback cb);
+    // False if the timer had already been cancelled, or cancelled itself.
+    bool cancel(Id id);
+    bool stats(Id id, Stats& out);
+    void dump_stats(std::ostream& os);
+
+    // Runs every tick that is due and returns when the next busy one is
+    // (INT64_MAX if no timer is running).
+    int64_t advance();
+    // Called when start() adds a timer due before the time advance() last
+    // returned, so the loop can re-arm its wait.
+    void set_waker(std::function<void()> w) { waker = std::move(w); }
+
+private:
+    static constexpr int Levels = 4;
+    static constexpr int SlotBits = 6;
+    static constexpr int Slots = 1 << SlotBits;
+    static constexpr int64_t TickNs = 100000;
+    static constexpr int32_t None = -1;
+
+    struct Timer {
+        Callback cb;
+        Stats* st = nullptr;
+        int64_t period_ns = 0;
+        int64_t due_ns = 0;
+        uint64_t due_tick = 0;
+        uint32_t gen = 1;
+        bool active = false;
+        int32_t prev = None;
+        int32_t next = None;
+        int level = 0;
+        int slot = 0;
+    };
+
+    // Recursive: callbacks run under the lock and may start or cancel timers.
+    std::recursive_mutex mu;
+    std::function<void()> waker;
+    std::deque<Timer> slab; // deque: growing it never moves a running callback
+    std::vector<int32_t> free_slots;
+    std::vector<std::pair<int32_t, uint32_t>> due; // (slot, generation) firing this tick
+    std::map<std::string, Stats> totals;           // by label; nodes never move
+    int32_t heads[Levels][Slots];
+    const int64_t origin_ns = Clock::now_ns();
+    uint64_t now_tick = 0; // next tick to process
+    uint64_t armed_tick = 0; // what advance() last reported; 0 while it runs
+    size_t active_count = 0;
+    int32_t firing = None;
+    bool firing_cancelled = false;
+
+    Timers() {
+        for (auto& level : heads)
+            for (auto& h : level) h = None;
+    }
+
+    Timer* lookup(Id id) {
+        uint32_t idx = (uint32_t)id;
+        if (idx >= slab.size() || slab[idx].gen != (uint32_t)(id >> 32) || !slab[idx].active) return nullptr;
+        return &slab[idx];
+    }
+    uint64_t tick_at(int64_t ns) const { return (uint64_t)((ns - origin_ns + TickNs - 1) / TickNs); }
+    int64_t time_of(uint64_t tick) const { return origin_ns + (int64_t)tick * TickNs; }
+
+    void link(int32_t i);
+    void unlink(int32_t i);
+    void release(int32_t i);
+    void process_tick();
+    uint64_t next_busy_tick() const;
+};
+
+void Timers::link(int32_t i) {
+    Timer& t = slab[i];
+    uint64_t due = std::max(t.due_tick, now_tick);
+    uint64_t delta = due - now_tick;
+    int level = 0;
+    while (level < Levels - 1 && delta >= (uint64_t(1) << (SlotBits * (level + 1)))) ++level;
+    uint64_t horizon = uint64_t(1) << (SlotBits * Levels);
+    if (delta >= horizon) due = now_tick + horizon - 1; // re-placed when it cascades down
+    t.level = level;
+    t.slot = (int)((due >> (SlotBits * level)) & (Slots - 1));
+    t.prev = None;
+    t.next = heads[level][t.slot];
+    if (t.next != None) slab[t.next].prev = i;
+    heads[level][t.slot] = i;
+}
+
+void Timers::unlink(int32_t i) {
+    Timer& t = slab[i];
+    if (t.prev != None) slab[t.prev].next = t.next;
+    else heads[t.level][t.slot] = t.next;
+    if (t.next != None) slab[t.next].prev = t.prev;
+    t.prev = t.next = None;
+}
+
+void Timers::release(int32_t i) {
+    slab[i].cb = nullptr;
+    slab[i].gen++;
+    free_slots.push_back(i);
+}
+
+Timers::Id Timers::start(const char* label, int64_t period_ns, Callback cb) {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    int32_t i;
+    if (!free_slots.empty()) {
+        i = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        i = (int32_t)slab.size();
+        slab.emplace_back();
+    }
+    Timer& t = slab[i];
+    t.cb = std::move(cb);
+    auto it = totals.try_emplace(label).first;
+    t.st = &it->second;
+    t.st->label = it->first.c_str();
+    t.st->period_ns = period_ns;
+    t.period_ns = period_ns;
+    t.due_ns = Clock::now_ns() + period_ns;
+    t.due_tick = tick_at(t.due_ns);
+    t.active = true;
+    link(i);
+    active_count++;
+    if (t.due_tick < armed_tick && waker) waker();
+    return (uint64_t(t.gen) << 32) | (uint32_t)i;
+}
+
+bool Timers::cancel(Id id) {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    Timer* t = lookup(id);
+    if (!t) return false;
+    int32_t i = (int32_t)(uint32_t)id;
+    unlink(i);
+    t->active = false;
+    active_count--;
+    // A timer cancelled from its own callback is freed once the callback returns.
+    if (i == firing) firing_cancelled = true;
+    else release(i);
+    return true;
+}
+
+bool Timers::stats(Id id, Stats& out) {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    Timer* t = lookup(id);
+    if (!t) return false;
+    out = *t->st;
+    return true;
+}
+
+void Timers::dump_stats(std::ostream& os) {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    for (const auto& [label, st] : totals) {
+        int64_t avg = st.fires ? st.jitter_sum_ns / (int64_t)st.fires : 0;
+        os << "[TIMER] " << label << ": fires=" << st.fires << " missed=" << st.missed
+           << " jitter avg=" << avg / 1000 << "us max=" << st.jitter_max_ns / 1000 << "us\n";
+    }
+    os << std::flush;
+}
+
+void Timers::process_tick() {
+    // Cascade: at each 64^l boundary, level l's current slot moves down a level.
+    for (int level = 1; level < Levels; ++level) {
+        if (now_tick & ((uint64_t(1) << (SlotBits * level)) - 1)) break;
+        int slot = (int)((now_tick >> (SlotBits * level)) & (Slots - 1));
+        int32_t i = heads[level][slot];
+        heads[level][slot] = None;
+        while (i != None) {
+            int32_t next = slab[i].next;
+            link(i);
+            i = next;
+        }
+    }
+
+    // Fire everything due this tick. Detach the slot first: callbacks may
+    // start or cancel timers, including ones in this very list, and a slot
+    // cancelled and reused meanwhile must not fire as the new timer.
+    int slot = (int)(now_tick & (Slots - 1));
+    due.clear();
+    for (int32_t i = heads[0][slot]; i != None; i = slab[i].next) due.emplace_back(i, slab[i].gen);
+    heads[0][slot] = None;
+    for (auto [i, gen] : due) slab[i].prev = slab[i].next = None;
+
+    for (auto [i, gen] : due) {
+        Timer& t = slab[i];
+        if (!t.active || t.gen != gen) continue;
+        int64_t now = Clock::now_ns();
+        int64_t jitter = now - t.due_ns;
+        t.st->fires++;
+        t.st->jitter_sum_ns += jitter;
+        t.st->jitter_max_ns = std::max(t.st->jitter_max_ns, jitter);
+        // Next period counts from the due time, not the fire time, so the phase
+        // does not drift; periods already missed are skipped, not bunched up.
+        t.due_ns += t.period_ns;
+        while (t.due_ns <= now) {
+            t.due_ns += t.period_ns;
+            t.st->missed++;
         }
+        t.due_tick = tick_at(t.due_ns); // > now_tick, since due_ns > now >= time_of(now_tick)
+        link(i);
+
+        firing = i;
+        firing_cancelled = false;
+        t.cb((uint64_t(t.gen) << 32) | (uint32_t)i);
+        firing = None;
+        if (firing_cancelled) release(i);
+    }
+    now_tick++;
+}
+
+// First tick with work: a non-empty level-0 slot, or a boundary at which a
+// non-empty higher-level slot cascades down. Empty stretches are slept over.
+uint64_t Timers::next_busy_tick() const {
+    uint64_t best = now_tick + (uint64_t(1) << (SlotBits * Levels));
+    for (int level = 0; level < Levels; ++level) {
+        uint64_t step = uint64_t(1) << (SlotBits * level);
+        uint64_t first = (now_tick + step - 1) & ~(step - 1);
+        for (uint64_t j = 0; j < (uint64_t)Slots; ++j) {
+            uint64_t tick = first + j * step;
+            if (tick >= best) break;
+            if (heads[level][(tick >> (SlotBits * level)) & (Slots - 1)] != None) {
+                best = tick;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+int64_t Timers::advance() {
+    std::lock_guard<std::recursive_mutex> lock(mu);
+    armed_tick = 0; // callbacks starting timers need not wake us
+    int64_t now = Clock::now_ns();
+    if (!active_count) now_tick = std::max(now_tick, tick_at(now)); // empty wheel: nothing to cascade
+    while (time_of(now_tick) <= now) process_tick();
+    if (!active_count) {
+        armed_tick = std::numeric_limits<uint64_t>::max();
+        return std::numeric_limits<int64_t>::max();
+    }
+    armed_tick = next_busy_tick();
+    return time_of(armed_tick);
+}
+
+
+#include <csignal>
+#include <cstdlib>
+#include <deque>
+#include <unordered_map>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// The main thread's event loop. Sources (the timer wheel, housekeeping) do
+// their due work and report their next deadline; the loop then waits for that
+// deadline, a cross-thread wake() or SIGINT/SIGTERM. On Linux the wait is one
+// epoll_wait over an eventfd, a timerfd armed to the deadline (epoll's own
+// timeout only has millisecond resolution), a signalfd and any descriptors
+// handed to watch(); elsewhere it is a condition variable and a plain signal
+// handler. RIVET_SPIN_US=<n> polls for up to n us before parking, for
+// deployments that would rather burn a core than pay a wakeup. Under --sim it
+// never waits: it moves the virtual clock to the deadline, and stops once
+// nothing is scheduled or RIVET_SIM_END_MS of virtual time have passed.
+class EventLoop {
+public:
+    using Source = std::function<int64_t()>; // returns next deadline in Clock ns, INT64_MAX for none
+    using FdHandler = std::function<void(uint32_t events)>;
+
+    struct Stats {
+        uint64_t iterations = 0;
+        uint64_t parks = 0;     // blocking waits
+        uint64_t spin_hits = 0; // waits ended by work arriving while spinning
+        uint64_t wakeups = 0;   // wake() calls that reached the loop
+    };
+
+    static EventLoop& instance() {
+        static EventLoop loop;
+        return loop;
+    }
+
+    // Main thread only, like watch()/unwatch().
+    void add_source(Source s) { sources.push_back(std::move(s)); }
+    // Runs `fn` on the loop every `period_ns`, phase-locked to the first call.
+    void every(int64_t period_ns, std::function<void()> fn);
+
+    // Any thread.
+    void post(std::function<void()> fn);
+    void wake();
+    void stop(int sig = 0);
+
+#if defined(__linux__) && !defined(RIVET_SIM)
+    void watch(int fd, uint32_t events, FdHandler h);
+    void unwatch(int fd);
+#endif
+
+    // Runs until stop() or a signal; returns the signal number, or 0.
+    int run();
+    const Stats& stats() const { return st; }
+    void dump_stats(std::ostream& os) const {
+        os << "[LOOP] iterations=" << st.iterations << " parks=" << st.parks << " spin_hits=" << st.spin_hits
+           << " wakeups=" << st.wakeups << std::endl;
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+private:
+    std::vector<Source> sources;
+    std::mutex posted_mu;
+    std::deque<std::function<void()>> posted;
+    std::atomic<bool> notified{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<int> stop_signal{0};
+    int64_t spin_ns = 0;
+    Stats st;
+
+#if defined(RIVET_SIM)
+    int64_t end_ns = std::numeric_limits<int64_t>::max();
+#elif defined(__linux__)
+    static constexpr int MaxEvents = 32;
+    int epfd = -1, evfd = -1, tfd = -1, sigfd = -1;
+    int64_t armed = -1;
+    uint64_t busy_turns = 0;
+    std::unordered_map<int, std::shared_ptr<FdHandler>> watched;
+
+    void arm(int64_t deadline);
+    void dispatch(const epoll_event* evs, int n);
+#else
+    std::mutex park_mu;
+    std::condition_variable park_cv;
+    static inline volatile std::sig_atomic_t caught = 0;
+    static void on_signal(int sig) { caught = sig; }
+#endif
+
+    EventLoop();
+    ~EventLoop();
+    void run_posted();
+    void wait_until(int64_t deadline);
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#else
+        std::this_thread::yield();
+#endif
     }
 };
-std::string SystemManager::current_mode = "Init";
-std::vector<std::function<void(std::string)>> SystemManager::on_transition;
 
+void EventLoop::every(int64_t period_ns, std::function<void()> fn) {
+    add_source([period_ns, fn = std::move(fn), next = Clock::now_ns() + period_ns]() mutable {
+        int64_t now = Clock::now_ns();
+        if (now < next) return next;
+        fn();
+        do next += period_ns; while (next <= now);
+        return next;
+    });
+}
+
+void EventLoop::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(posted_mu);
+        posted.push_back(std::move(fn));
+    }
+    wake();
+}
+
+void EventLoop::stop(int sig) {
+    if (sig) stop_signal.store(sig);
+    stopping.store(true);
+    wake();
+}
+
+void EventLoop::run_posted() {
+    std::deque<std::function<void()>> batch;
+    {
+        std::lock_guard<std::mutex> lock(posted_mu);
+        batch.swap(posted);
+    }
+    for (auto& fn : batch) fn();
+}
+
+int EventLoop::run() {
+    while (!stopping.load()) {
+        st.iterations++;
+        run_posted();
+        int64_t deadline = std::numeric_limits<int64_t>::max();
+        for (auto& s : sources) deadline = std::min(deadline, s());
+        if (stopping.load()) break;
+        wait_until(deadline);
+    }
+    return stop_signal.load();
+}
+
+#if defined(RIVET_SIM)
+EventLoop::EventLoop() {
+    if (const char* env = std::getenv("RIVET_SIM_END_MS")) end_ns = std::max(0L, std::atol(env)) * 1000000;
+}
+
+EventLoop::~EventLoop() {}
+
+void EventLoop::wake() { notified.store(true); }
+
+void EventLoop::wait_until(int64_t deadline) {
+    if (notified.exchange(false)) {
+        st.wakeups++;
+        return;
+    }
+    if (deadline == std::numeric_limits<int64_t>::max()) return stop(); // nothing left that could happen
+    if (deadline > end_ns) {
+        Clock::virtual_ns = std::max(Clock::virtual_ns, end_ns);
+        return stop();
+    }
+    st.parks++;
+    Clock::virtual_ns = std::max(Clock::virtual_ns, deadline);
+}
+#elif defined(__linux__)
+EventLoop::EventLoop() {
+    // Block the stop signals before any other thread exists, so every thread
+    // inherits the mask and they are only ever delivered through the signalfd.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epfd < 0 || evfd < 0 || tfd < 0 || sigfd < 0) {
+        std::cerr << "[LOOP] cannot create epoll/eventfd/timerfd/signalfd" << std::endl;
+        std::abort();
+    }
+    for (int fd : {evfd, tfd, sigfd}) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if (const char* env = std::getenv("RIVET_SPIN_US")) spin_ns = std::max(0L, std::atol(env)) * 1000;
+}
+
+EventLoop::~EventLoop() {
+    for (int fd : {sigfd, tfd, evfd, epfd})
+        if (fd >= 0) close(fd);
+}
+
+void EventLoop::watch(int fd, uint32_t events, FdHandler h) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    bool known = watched.count(fd) != 0;
+    watched[fd] = std::make_shared<FdHandler>(std::move(h));
+    epoll_ctl(epfd, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+}
+
+void EventLoop::unwatch(int fd) {
+    if (watched.erase(fd)) epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+// Coalesced: one eventfd write until the loop has seen it.
+void EventLoop::wake() {
+    if (notified.exchange(true)) return;
+    uint64_t one = 1;
+    ssize_t r = write(evfd, &one, sizeof one);
+    (void)r;
+}
+
+void EventLoop::arm(int64_t deadline) {
+    if (deadline == armed) return;
+    armed = deadline;
+    itimerspec its{}; // all zero disarms
+    if (deadline != std::numeric_limits<int64_t>::max()) {
+        int64_t rel = std::max<int64_t>(deadline - Clock::now_ns(), 1);
+        its.it_value.tv_sec = rel / 1000000000;
+        its.it_value.tv_nsec = rel % 1000000000;
+    }
+    timerfd_settime(tfd, 0, &its, nullptr);
+}
+
+void EventLoop::wait_until(int64_t deadline) {
+    epoll_event evs[MaxEvents];
+    int n = 0;
+    if (spin_ns > 0) {
+        const int64_t spin_end = std::min(deadline, Clock::now_ns() + spin_ns);
+        for (unsigned i = 1; n == 0; ++i) {
+            // The flag is free to read; descriptors and signals cost a syscall.
+            if (notified.load(std::memory_order_acquire) || i % 64 == 0) {
+                n = epoll_wait(epfd, evs, MaxEvents, 0);
+                if (n > 0) st.spin_hits++;
+            }
+            if (n == 0 && Clock::now_ns() >= spin_end) break;
+            cpu_relax();
+        }
+    }
+    if (n == 0) {
+        if (Clock::now_ns() >= deadline) {
+            // A loop that never parks still notices signals and descriptors.
+            if (++busy_turns % 64 == 0 && (n = epoll_wait(epfd, evs, MaxEvents, 0)) > 0) dispatch(evs, n);
+            return;
+        }
+        arm(deadline);
+        st.parks++;
+        n = epoll_wait(epfd, evs, MaxEvents, -1);
+    }
+    if (n > 0) dispatch(evs, n);
+}
+
+void EventLoop::dispatch(const epoll_event* evs, int n) {
+    for (int i = 0; i < n; ++i) {
+        int fd = evs[i].data.fd;
+        if (fd == evfd) {
+            uint64_t v;
+            ssize_t r = read(evfd, &v, sizeof v);
+            (void)r;
+            notified.store(false); // before run_posted(), so a later post() writes again
+            st.wakeups++;
+        } else if (fd == tfd) {
+            uint64_t v;
+            ssize_t r = read(tfd, &v, sizeof v);
+            (void)r;
+            armed = -1;
+        } else if (fd == sigfd) {
+            signalfd_siginfo si;
+            while (read(sigfd, &si, sizeof si) == (ssize_t)sizeof si) stop((int)si.ssi_signo);
+        } else {
+            auto it = watched.find(fd);
+            if (it == watched.end()) continue;
+            auto h = it->second; // the handler may unwatch itself
+            (*h)(evs[i].events);
+        }
+    }
+}
+#else
+EventLoop::EventLoop() {
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    if (const char* env = std::getenv("RIVET_SPIN_US")) spin_ns = std::max(0L, std::atol(env)) * 1000;
+}
+
+EventLoop::~EventLoop() {}
+
+void EventLoop::wake() {
+    if (notified.exchange(true)) return;
+    std::lock_guard<std::mutex> lock(park_mu);
+    park_cv.notify_one();
+}
+
+void EventLoop::wait_until(int64_t deadline) {
+    if (spin_ns > 0) {
+        const int64_t spin_end = std::min(deadline, Clock::now_ns() + spin_ns);
+        while (!notified.load() && !caught && Clock::now_ns() < spin_end) cpu_relax();
+        if (notified.load() || caught) st.spin_hits++;
+    }
+    std::unique_lock<std::mutex> lock(park_mu);
+    int64_t now = Clock::now_ns();
+    if (!notified.load() && !caught && now < deadline) {
+        // A signal handler cannot notify a condition variable, so the flag it
+        // sets is polled at least every 20 ms.
+        int64_t until = std::min(deadline, now + 20000000);
+        st.parks++;
+        park_cv.wait_for(lock, std::chrono::nanoseconds(until - now), [&] { return notified.load() || caught; });
+    }
+    if (notified.exchange(false)) st.wakeups++;
+    if (caught) stop(caught);
+}
+#endif
+
+inline const char* signal_name(int sig) {
+    switch (sig) {
+        case SIGINT: return "SIGINT";
+        case SIGTERM: return "SIGTERM";
+        default: return "stop request";
+    }
+}
+
+// RIVET_SHUTDOWN_MS=<n> bounds how long shutdown waits for queues to drain
+// (default 2000).
+inline std::chrono::milliseconds shutdown_timeout() {
+    if (const char* env = std::getenv("RIVET_SHUTDOWN_MS")) {
+        long n = std::atol(env);
+        if (n >= 0) return std::chrono::milliseconds(n);
+    }
+    return std::chrono::milliseconds(2000);
+}
+
+
+// System modes, interned.
+namespace SysMode {
+enum : ModeId { Init, Normal, Shutdown, Startup, Active, Diagnostics, Safe, Count };
+inline const char* const names[] = {"Init", "Normal", "Shutdown", "Startup", "Active", "Diagnostics", "Safe"};
+} // namespace SysMode
 class CommandCenter;
 extern CommandCenter* CommandCenter_inst;
 class MathHarness;
@@ -77,10 +1763,155 @@ extern ModeWatcher* ModeWatcher_inst;
 class LoggerNode;
 extern LoggerNode* LoggerNode_inst;
 
+// Wire codecs for every topic and request.
+struct TopicWire_CommandCenter_hb {
+    static constexpr uint64_t schema = 0xf58e3f336546df91ull; // topic CommandCenter.hb : int
+    using View = int;
+    static void encode(WireWriter& w, const int& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_CommandCenter_ready {
+    static constexpr uint64_t schema = 0x80c4b07d8732d963ull; // topic CommandCenter.ready : bool
+    using View = bool;
+    static void encode(WireWriter& w, const bool& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_CommandCenter_gate {
+    static constexpr uint64_t schema = 0xd94ed84f34b12123ull; // topic CommandCenter.gate : bool
+    using View = bool;
+    static void encode(WireWriter& w, const bool& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_CommandCenter_ping {
+    static constexpr uint64_t schema = 0x8149900a575f26bull; // topic CommandCenter.ping : int
+    using View = int;
+    static void encode(WireWriter& w, const int& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_CommandCenter_fping {
+    static constexpr uint64_t schema = 0x11e8f515f659a366ull; // topic CommandCenter.fping : float
+    using View = double;
+    static void encode(WireWriter& w, const double& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_CommandCenter_msg {
+    static constexpr uint64_t schema = 0xa99c7693956ad26cull; // topic CommandCenter.msg : string
+    using View = std::string_view;
+    static void encode(WireWriter& w, const std::string& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_CommandCenter_stage {
+    static constexpr uint64_t schema = 0xe916592b5461d161ull; // topic CommandCenter.stage : int
+    using View = int;
+    static void encode(WireWriter& w, const int& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct RequestWire_CommandCenter_boot {
+    static constexpr uint64_t schema = 0x49e72559ff87ad55ull; // request CommandCenter.boot()
+    struct View {};
+    static void encode(WireWriter&) {}
+    static bool decode(WireReader& r, View&) {
+        return r.ok();
+    }
+};
+struct RequestWire_CommandCenter_toActive {
+    static constexpr uint64_t schema = 0xad289e943585a4aull; // request CommandCenter.toActive()
+    struct View {};
+    static void encode(WireWriter&) {}
+    static bool decode(WireReader& r, View&) {
+        return r.ok();
+    }
+};
+struct RequestWire_CommandCenter_toDiag {
+    static constexpr uint64_t schema = 0x1dad954d29455713ull; // request CommandCenter.toDiag()
+    struct View {};
+    static void encode(WireWriter&) {}
+    static bool decode(WireReader& r, View&) {
+        return r.ok();
+    }
+};
+struct RequestWire_CommandCenter_toSafe {
+    static constexpr uint64_t schema = 0x53486107ed87acf9ull; // request CommandCenter.toSafe()
+    struct View {};
+    static void encode(WireWriter&) {}
+    static bool decode(WireReader& r, View&) {
+        return r.ok();
+    }
+};
+struct RequestWire_CommandCenter_flipGate {
+    static constexpr uint64_t schema = 0xbb2714de427421d1ull; // request CommandCenter.flipGate(bool)
+    struct View { bool on; };
+    static void encode(WireWriter& w, bool on) { w.put(on); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v.on);
+        return r.ok();
+    }
+};
+struct TopicWire_MathHarness_done {
+    static constexpr uint64_t schema = 0xd5381259261b8d70ull; // topic MathHarness.done : bool
+    using View = bool;
+    static void encode(WireWriter& w, const bool& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_MathHarness_score {
+    static constexpr uint64_t schema = 0x5f8b460dcef32cb7ull; // topic MathHarness.score : int
+    using View = int;
+    static void encode(WireWriter& w, const int& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_ModeWatcher_seen {
+    static constexpr uint64_t schema = 0x3a259f80c0dce6a7ull; // topic ModeWatcher.seen : int
+    using View = int;
+    static void encode(WireWriter& w, const int& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+struct TopicWire_LoggerNode_lines {
+    static constexpr uint64_t schema = 0xaca107397cca32f0ull; // topic LoggerNode.lines : int
+    using View = int;
+    static void encode(WireWriter& w, const int& v) { w.put(v); }
+    static bool decode(WireReader& r, View& v) {
+        r.get(v);
+        return r.ok();
+    }
+};
+constexpr uint64_t RIVET_SCHEMA = 0xcaea0989c30edb40ull; // all of the above
+
 class CommandCenter {
 public:
     std::string name = "CommandCenter";
-    std::string current_state = "Init";
+    LogLevel log_level = Logger::default_level();
+    ModeId current_state = 0; // 0 Init
+    ModeQueue __rivet_states; // set_state runs to completion
     Topic<int> hb;
     Topic<bool> ready;
     Topic<bool> gate;
@@ -94,9 +1925,9 @@ public:
     bool toSafe();
     bool flipGate(bool on);
     void init();
-    void onSystemChange(std::string sys_mode);
+    void onSystemChange(ModeId sys_mode);
     void onLocalChange();
-    void set_state(const std::string& st);
+    void set_state(ModeId st);
     void __rivet_unsub_sys_listeners();
     void __rivet_unsub_local_listeners();
 };
@@ -105,11 +1936,12 @@ CommandCenter* CommandCenter_inst = nullptr;
 class MathHarness {
 public:
     std::string name = "MathHarness";
-    std::string current_state = "Init";
+    LogLevel log_level = Logger::default_level();
+    ModeId current_state = 0; // 0 Init, 1 Idle, 2 LocalA, 3 LocalB
+    ModeQueue __rivet_states; // set_state runs to completion
     Topic<bool> done;
     Topic<int> score;
-    int __rivet_sub_m2_l0 = -1;
-    int __rivet_sub_m3_l0 = -1;
+    ListenSet<3> __rivet_listening; // CommandCenter.ping, CommandCenter.fping, ModeWatcher.seen
     bool onReady(bool v);
     bool testBooleans();
     bool testArithmetic();
@@ -117,29 +1949,35 @@ public:
     bool onPing(int x);
     bool onFloatPing(double x);
     bool onStage(int s);
-    bool onSysMsg(std::string m);
+    bool onSysMsg(const std::string& m);
+    bool onSafeSeen(int v);
     void init();
-    void onSystemChange(std::string sys_mode);
+    void onSystemChange(ModeId sys_mode);
     void onLocalChange();
-    void set_state(const std::string& st);
+    void set_state(ModeId st);
     void __rivet_unsub_sys_listeners();
     void __rivet_unsub_local_listeners();
+    void __rivet_listen_modes();
 };
 MathHarness* MathHarness_inst = nullptr;
 
 class ModeWatcher {
 public:
     std::string name = "ModeWatcher";
-    std::string current_state = "Init";
+    LogLevel log_level = Logger::default_level();
+    ModeId current_state = 0; // 0 Init
+    ModeQueue __rivet_states; // set_state runs to completion
     Topic<int> seen;
-    bool onMsg(std::string s);
+    Timers::Id __rivet_timer_m1_t0 = 0;
+    void __rivet_every_m1_t0();
+    bool onMsg(const std::string& s);
     bool onGate(bool b);
     bool onDone(bool b);
     bool onScore(int v);
     void init();
-    void onSystemChange(std::string sys_mode);
+    void onSystemChange(ModeId sys_mode);
     void onLocalChange();
-    void set_state(const std::string& st);
+    void set_state(ModeId st);
     void __rivet_unsub_sys_listeners();
     void __rivet_unsub_local_listeners();
 };
@@ -148,53 +1986,55 @@ ModeWatcher* ModeWatcher_inst = nullptr;
 class LoggerNode {
 public:
     std::string name = "LoggerNode";
-    std::string current_state = "Init";
+    LogLevel log_level = Logger::default_level();
+    ModeId current_state = 0; // 0 Init
+    ModeQueue __rivet_states; // set_state runs to completion
     Topic<int> lines;
     bool hbSeen(int v);
     bool readySeen(bool v);
     bool pingSeen(int v);
     bool fpingSeen(double v);
-    bool msgSeen(std::string s);
+    bool msgSeen(const std::string& s);
     bool gateSeen(bool b);
     bool stageSeen(int v);
     bool mhDone(bool b);
     bool mhScore(int v);
     bool mwSeen(int v);
     void init();
-    void onSystemChange(std::string sys_mode);
+    void onSystemChange(ModeId sys_mode);
     void onLocalChange();
-    void set_state(const std::string& st);
+    void set_state(ModeId st);
     void __rivet_unsub_sys_listeners();
     void __rivet_unsub_local_listeners();
 };
 LoggerNode* LoggerNode_inst = nullptr;
 
 bool CommandCenter::boot() {
-    { std::stringstream _ss; _ss << "CommandCenter.boot()"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
-    SystemManager::set_mode("Startup");
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "CommandCenter.boot()";
+    SystemManager::set_mode(SysMode::Startup);
     return true;
 }
 
 bool CommandCenter::toActive() {
-    { std::stringstream _ss; _ss << "CommandCenter.toActive()"; Logger::log(this->name, LogLevel::WARN, _ss.str()); }
-    SystemManager::set_mode("Active");
+    if (LogLevel::WARN >= this->log_level) LogLine(this->name, LogLevel::WARN) << "CommandCenter.toActive()";
+    SystemManager::set_mode(SysMode::Active);
     return true;
 }
 
 bool CommandCenter::toDiag() {
-    { std::stringstream _ss; _ss << "CommandCenter.toDiag()"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
-    SystemManager::set_mode("Diagnostics");
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "CommandCenter.toDiag()";
+    SystemManager::set_mode(SysMode::Diagnostics);
     return true;
 }
 
 bool CommandCenter::toSafe() {
-    { std::stringstream _ss; _ss << "CommandCenter.toSafe()"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
-    SystemManager::set_mode("Safe");
+    if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "CommandCenter.toSafe()";
+    SystemManager::set_mode(SysMode::Safe);
     return true;
 }
 
 bool CommandCenter::flipGate(bool on) {
-    { std::stringstream _ss; _ss << "CommandCenter.flipGate(on=" << on << ")"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "CommandCenter.flipGate(on=" << on << ")";
     this->gate.publish(on);
     return true;
 }
@@ -206,16 +2046,15 @@ void CommandCenter::__rivet_unsub_local_listeners() {
 }
 
 void CommandCenter::init() {
-    this->__rivet_unsub_sys_listeners();
-    this->__rivet_unsub_local_listeners();
-        { std::stringstream _ss; _ss << "Init: kick off"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "Init: kick off";
         CommandCenter_inst->boot();
 }
 
-void CommandCenter::onSystemChange(std::string sys_mode) {
+void CommandCenter::onSystemChange(ModeId sys_mode) {
     this->__rivet_unsub_sys_listeners();
-    if (sys_mode == "Startup") {
-        { std::stringstream _ss; _ss << "SYS Startup entered"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    switch (sys_mode) {
+    case SysMode::Startup: {
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "SYS Startup entered";
         this->hb.publish(1);
         this->msg.publish("sys: Startup");
         this->gate.publish(false);
@@ -229,9 +2068,10 @@ void CommandCenter::onSystemChange(std::string sys_mode) {
         this->stage.publish(1);
         CommandCenter_inst->flipGate(true);
         CommandCenter_inst->toActive();
+        break;
     }
-    if (sys_mode == "Active") {
-        { std::stringstream _ss; _ss << "SYS Active entered"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    case SysMode::Active: {
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "SYS Active entered";
         this->hb.publish(2);
         this->msg.publish("sys: Active");
         this->ping.publish(3);
@@ -242,9 +2082,10 @@ void CommandCenter::onSystemChange(std::string sys_mode) {
         this->stage.publish(2);
         CommandCenter_inst->flipGate(false);
         CommandCenter_inst->toDiag();
+        break;
     }
-    if (sys_mode == "Diagnostics") {
-        { std::stringstream _ss; _ss << "SYS Diagnostics entered"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    case SysMode::Diagnostics: {
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "SYS Diagnostics entered";
         this->hb.publish(9);
         this->msg.publish("sys: Diagnostics");
         this->stage.publish(0);
@@ -252,286 +2093,340 @@ void CommandCenter::onSystemChange(std::string sys_mode) {
         this->ping.publish(9);
         this->fping.publish(0.10);
         this->fping.publish(0.90);
-        MathHarness_inst->set_state("LocalA");
-        MathHarness_inst->set_state("LocalB");
+        MathHarness_inst->set_state(2); // "LocalA"
+        MathHarness_inst->set_state(3); // "LocalB"
         CommandCenter_inst->toSafe();
+        break;
     }
-    if (sys_mode == "Safe") {
-        { std::stringstream _ss; _ss << "SYS Safe entered (end)"; Logger::log(this->name, LogLevel::WARN, _ss.str()); }
+    case SysMode::Safe: {
+        if (LogLevel::WARN >= this->log_level) LogLine(this->name, LogLevel::WARN) << "SYS Safe entered (end)";
         this->hb.publish(3);
         this->msg.publish("sys: Safe");
         this->gate.publish(false);
         this->stage.publish(0);
+        break;
+    }
+    default:
+        break;
     }
 }
 
 void CommandCenter::onLocalChange() {
     this->__rivet_unsub_local_listeners();
+    (void)this->current_state;
 }
 
-void CommandCenter::set_state(const std::string& st) {
-    this->current_state = st;
-    this->onLocalChange();
+void CommandCenter::set_state(ModeId st) {
+    if (!this->__rivet_states.request(st)) return;
+    do {
+        this->current_state = st;
+        this->onLocalChange();
+    } while (this->__rivet_states.next(st));
 }
 
 bool MathHarness::onReady(bool v) {
-    { std::stringstream _ss; _ss << "MathHarness.onReady(v=" << v << ")"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "MathHarness.onReady(v=" << v << ")";
     if (v) {
-        { std::stringstream _ss; _ss << "READY true -> running full test battery"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
-        { std::stringstream _ss; _ss << "MathHarness: tests complete"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "READY true -> running full test battery";
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "MathHarness: tests complete";
         this->done.publish(true);
     } else {
-        { std::stringstream _ss; _ss << "READY false (unexpected)"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "READY false (unexpected)";
     }
     return true;
 }
 
 bool MathHarness::testBooleans() {
-    { std::stringstream _ss; _ss << "TEST: booleans + precedence"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "TEST: booleans + precedence";
     if (true) {
-        { std::stringstream _ss; _ss << "if true PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "if true PASS";
     } else {
-        { std::stringstream _ss; _ss << "if true FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "if true FAIL";
     }
     if ((!false)) {
-        { std::stringstream _ss; _ss << "not false PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "not false PASS";
     } else {
-        { std::stringstream _ss; _ss << "not false FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "not false FAIL";
     }
     if ((true || (false && false))) {
-        { std::stringstream _ss; _ss << "true or (false and false) PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "true or (false and false) PASS";
     } else {
-        { std::stringstream _ss; _ss << "precedence FAIL (case 1)"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "precedence FAIL (case 1)";
     }
     if ((false || (true && false))) {
-        { std::stringstream _ss; _ss << "false or true and false => false PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "false or true and false => false PASS";
     } else {
-        { std::stringstream _ss; _ss << "precedence FAIL (case 2)"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "precedence FAIL (case 2)";
     }
     if (((!true) || true)) {
-        { std::stringstream _ss; _ss << "(not true) or true PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "(not true) or true PASS";
     } else {
-        { std::stringstream _ss; _ss << "(not true) or true FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "(not true) or true FAIL";
     }
     if ((!(true && false))) {
-        { std::stringstream _ss; _ss << "not (true and false) PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "not (true and false) PASS";
     } else {
-        { std::stringstream _ss; _ss << "not (true and false) FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "not (true and false) FAIL";
     }
     if (((true && true) && (true || false))) {
-        { std::stringstream _ss; _ss << "compound boolean PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "compound boolean PASS";
     } else {
-        { std::stringstream _ss; _ss << "compound boolean FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "compound boolean FAIL";
     }
     return true;
 }
 
 bool MathHarness::testArithmetic() {
-    { std::stringstream _ss; _ss << "TEST: arithmetic + comparisons"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "TEST: arithmetic + comparisons";
     if ((((2 + 3) * 4) == 20)) {
-        { std::stringstream _ss; _ss << "(2+3)*4 == 20 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "(2+3)*4 == 20 PASS";
     } else {
-        { std::stringstream _ss; _ss << "(2+3)*4 == 20 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "(2+3)*4 == 20 FAIL";
     }
     if (((2 + (3 * 4)) == 14)) {
-        { std::stringstream _ss; _ss << "2+3*4 precedence PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "2+3*4 precedence PASS";
     } else {
-        { std::stringstream _ss; _ss << "2+3*4 precedence FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "2+3*4 precedence FAIL";
     }
     if (((7 % 3) == 1)) {
-        { std::stringstream _ss; _ss << "7%3 == 1 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "7%3 == 1 PASS";
     } else {
-        { std::stringstream _ss; _ss << "7%3 == 1 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "7%3 == 1 FAIL";
     }
     if ((10 == 10)) {
-        { std::stringstream _ss; _ss << "10==10 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "10==10 PASS";
     } else {
-        { std::stringstream _ss; _ss << "10==10 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "10==10 FAIL";
     }
     if ((10 != 11)) {
-        { std::stringstream _ss; _ss << "10!=11 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "10!=11 PASS";
     } else {
-        { std::stringstream _ss; _ss << "10!=11 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "10!=11 FAIL";
     }
     if ((-5 < 0)) {
-        { std::stringstream _ss; _ss << "-5 < 0 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "-5 < 0 PASS";
     } else {
-        { std::stringstream _ss; _ss << "-5 < 0 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "-5 < 0 FAIL";
     }
     if ((1.5 < 2.0)) {
-        { std::stringstream _ss; _ss << "1.5 < 2.0 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "1.5 < 2.0 PASS";
     } else {
-        { std::stringstream _ss; _ss << "1.5 < 2.0 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "1.5 < 2.0 FAIL";
     }
     if ((2.5 >= 2.5)) {
-        { std::stringstream _ss; _ss << "2.5 >= 2.5 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "2.5 >= 2.5 PASS";
     } else {
-        { std::stringstream _ss; _ss << "2.5 >= 2.5 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "2.5 >= 2.5 FAIL";
     }
     if ((3.14 == 3.14)) {
-        { std::stringstream _ss; _ss << "3.14 == 3.14 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "3.14 == 3.14 PASS";
     } else {
-        { std::stringstream _ss; _ss << "3.14 == 3.14 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "3.14 == 3.14 FAIL";
     }
     if ((3.14 != 3.15)) {
-        { std::stringstream _ss; _ss << "3.14 != 3.15 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "3.14 != 3.15 PASS";
     } else {
-        { std::stringstream _ss; _ss << "3.14 != 3.15 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "3.14 != 3.15 FAIL";
     }
     return true;
 }
 
 bool MathHarness::testBuiltins() {
-    { std::stringstream _ss; _ss << "TEST: builtins (min/max/clamp) via asserts"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "TEST: builtins (min/max/clamp) via asserts";
     if ((std::min<double>((double)(10), (double)(20)) == 10)) {
-        { std::stringstream _ss; _ss << "min(10,20)==10 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "min(10,20)==10 PASS";
     } else {
-        { std::stringstream _ss; _ss << "min(10,20)==10 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "min(10,20)==10 FAIL";
     }
     if ((std::max<double>((double)(10), (double)(20)) == 20)) {
-        { std::stringstream _ss; _ss << "max(10,20)==20 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "max(10,20)==20 PASS";
     } else {
-        { std::stringstream _ss; _ss << "max(10,20)==20 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "max(10,20)==20 FAIL";
     }
     if ((std::min<double>((double)(1.5), (double)(2.0)) == 1.5)) {
-        { std::stringstream _ss; _ss << "min(1.5,2.0)==1.5 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "min(1.5,2.0)==1.5 PASS";
     } else {
-        { std::stringstream _ss; _ss << "min(1.5,2.0)==1.5 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "min(1.5,2.0)==1.5 FAIL";
     }
     if ((std::max<double>((double)(1.5), (double)(2.0)) == 2.0)) {
-        { std::stringstream _ss; _ss << "max(1.5,2.0)==2.0 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "max(1.5,2.0)==2.0 PASS";
     } else {
-        { std::stringstream _ss; _ss << "max(1.5,2.0)==2.0 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "max(1.5,2.0)==2.0 FAIL";
     }
     if ((std::clamp<double>((double)(5), (double)(0), (double)(10)) == 5)) {
-        { std::stringstream _ss; _ss << "clamp(5,0,10)==5 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "clamp(5,0,10)==5 PASS";
     } else {
-        { std::stringstream _ss; _ss << "clamp(5,0,10)==5 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "clamp(5,0,10)==5 FAIL";
     }
     if ((std::clamp<double>((double)(-5), (double)(0), (double)(10)) == 0)) {
-        { std::stringstream _ss; _ss << "clamp(-5,0,10)==0 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "clamp(-5,0,10)==0 PASS";
     } else {
-        { std::stringstream _ss; _ss << "clamp(-5,0,10)==0 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "clamp(-5,0,10)==0 FAIL";
     }
     if ((std::clamp<double>((double)(50), (double)(0), (double)(10)) == 10)) {
-        { std::stringstream _ss; _ss << "clamp(50,0,10)==10 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "clamp(50,0,10)==10 PASS";
     } else {
-        { std::stringstream _ss; _ss << "clamp(50,0,10)==10 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "clamp(50,0,10)==10 FAIL";
     }
     if ((std::clamp<double>((double)(2.5), (double)(0.0), (double)(10.0)) == 2.5)) {
-        { std::stringstream _ss; _ss << "clamp(2.5,0.0,10.0)==2.5 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "clamp(2.5,0.0,10.0)==2.5 PASS";
     } else {
-        { std::stringstream _ss; _ss << "clamp(2.5,0.0,10.0)==2.5 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "clamp(2.5,0.0,10.0)==2.5 FAIL";
     }
     return true;
 }
 
 bool MathHarness::onPing(int x) {
-    { std::stringstream _ss; _ss << "MathHarness.onPing(x=" << x << ")"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "MathHarness.onPing(x=" << x << ")";
     if ((((x % 2) == 0) && (x >= 0))) {
-        { std::stringstream _ss; _ss << "ping even and non-negative"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "ping even and non-negative";
     } else {
-        { std::stringstream _ss; _ss << "ping odd or negative"; Logger::log(this->name, LogLevel::WARN, _ss.str()); }
+        if (LogLevel::WARN >= this->log_level) LogLine(this->name, LogLevel::WARN) << "ping odd or negative";
     }
     if (((x < 0) || (x == 0))) {
-        { std::stringstream _ss; _ss << "ping <= 0 branch"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "ping <= 0 branch";
     } else {
-        { std::stringstream _ss; _ss << "ping > 0 branch"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "ping > 0 branch";
     }
     return true;
 }
 
 bool MathHarness::onFloatPing(double x) {
-    { std::stringstream _ss; _ss << "MathHarness.onFloatPing(x=" << x << ")"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "MathHarness.onFloatPing(x=" << x << ")";
     if ((x < 0.0)) {
-        { std::stringstream _ss; _ss << "fping negative"; Logger::log(this->name, LogLevel::WARN, _ss.str()); }
+        if (LogLevel::WARN >= this->log_level) LogLine(this->name, LogLevel::WARN) << "fping negative";
     } else {
-        { std::stringstream _ss; _ss << "fping non-negative"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "fping non-negative";
     }
     if ((std::clamp<double>((double)(x), (double)(0.0), (double)(1.0)) >= 0.0)) {
-        { std::stringstream _ss; _ss << "clamp(x,0,1) >= 0 PASS"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "clamp(x,0,1) >= 0 PASS";
     } else {
-        { std::stringstream _ss; _ss << "clamp(x,0,1) >= 0 FAIL"; Logger::log(this->name, LogLevel::ERROR, _ss.str()); }
+        if (LogLevel::ERROR >= this->log_level) LogLine(this->name, LogLevel::ERROR) << "clamp(x,0,1) >= 0 FAIL";
     }
     return true;
 }
 
 bool MathHarness::onStage(int s) {
-    { std::stringstream _ss; _ss << "MathHarness.onStage(s=" << s << ")"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "MathHarness.onStage(s=" << s << ")";
     if ((s == 0)) {
-        this->set_state("Idle");
+        this->set_state(1); // "Idle"
     } else if ((s == 1)) {
-        this->set_state("LocalA");
+        this->set_state(2); // "LocalA"
     } else if ((s == 2)) {
-        this->set_state("LocalB");
+        this->set_state(3); // "LocalB"
     } else {
-        this->set_state("Idle");
+        this->set_state(1); // "Idle"
     }
     return true;
 }
 
-bool MathHarness::onSysMsg(std::string m) {
-    std::cout << "MathHarness saw sys msg: " << m << std::endl;
+bool MathHarness::onSysMsg(const std::string& m) {
+    LogLine() << "MathHarness saw sys msg: " << m;
     return true;
 }
 
+bool MathHarness::onSafeSeen(int v) {
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "MathHarness.onSafeSeen(v=" << v << ")";
+    return true;
+}
+
+static constexpr ListenSet<3>::Mask __rivet_MathHarness_sys_scope = {0x4};
+static constexpr ListenSet<3>::Mask __rivet_MathHarness_sys_on[] = {
+    {0x0}, // Init
+    {0x0}, // Normal
+    {0x0}, // Shutdown
+    {0x0}, // Startup
+    {0x0}, // Active
+    {0x0}, // Diagnostics
+    {0x4}, // Safe
+};
+
+static constexpr ListenSet<3>::Mask __rivet_MathHarness_local_scope = {0x3};
+static constexpr ListenSet<3>::Mask __rivet_MathHarness_local_on[] = {
+    {0x0}, // Init
+    {0x0}, // Idle
+    {0x1}, // LocalA
+    {0x2}, // LocalB
+};
+
 void MathHarness::__rivet_unsub_sys_listeners() {
 }
 
 void MathHarness::__rivet_unsub_local_listeners() {
-    if (__rivet_sub_m2_l0 != -1) { CommandCenter_inst->ping.unsubscribe(__rivet_sub_m2_l0); __rivet_sub_m2_l0 = -1; }
-    if (__rivet_sub_m3_l0 != -1) { CommandCenter_inst->fping.unsubscribe(__rivet_sub_m3_l0); __rivet_sub_m3_l0 = -1; }
+}
+
+void MathHarness::__rivet_listen_modes() {
+    CommandCenter_inst->ping.subscribe([this](const auto& val) {
+        this->onPing(val);
+    }, this->__rivet_listening.slot(0));
+    CommandCenter_inst->fping.subscribe([this](const auto& val) {
+        this->onFloatPing(val);
+    }, this->__rivet_listening.slot(1));
+    ModeWatcher_inst->seen.subscribe([this](const auto& val) {
+        this->onSafeSeen(val);
+    }, this->__rivet_listening.slot(2));
 }
 
 void MathHarness::init() {
-    this->__rivet_unsub_sys_listeners();
-    this->__rivet_unsub_local_listeners();
-        { std::stringstream _ss; _ss << "MathHarness Init"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "MathHarness Init";
 }
 
-void MathHarness::onSystemChange(std::string sys_mode) {
+void MathHarness::onSystemChange(ModeId sys_mode) {
     this->__rivet_unsub_sys_listeners();
+    this->__rivet_listening.assign(__rivet_MathHarness_sys_scope, __rivet_MathHarness_sys_on[sys_mode]);
+    switch (sys_mode) {
+    case SysMode::Safe: {
+        break;
+    }
+    default:
+        break;
+    }
 }
 
 void MathHarness::onLocalChange() {
     this->__rivet_unsub_local_listeners();
-    if (this->current_state == "Idle") {
-        { std::stringstream _ss; _ss << "MathHarness local Idle"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    this->__rivet_listening.assign(__rivet_MathHarness_local_scope, __rivet_MathHarness_local_on[this->current_state]);
+    switch (this->current_state) {
+    case 1: { // "Idle"
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "MathHarness local Idle";
         this->score.publish(0);
+        break;
     }
-    if (this->current_state == "LocalA") {
-        if (__rivet_sub_m2_l0 == -1) __rivet_sub_m2_l0 = CommandCenter_inst->ping.subscribe([this](auto val) {
-            this->onPing(val);
-        });
-        { std::stringstream _ss; _ss << "MathHarness local LocalA"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    case 2: { // "LocalA"
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "MathHarness local LocalA";
         this->score.publish(10);
+        break;
     }
-    if (this->current_state == "LocalB") {
-        if (__rivet_sub_m3_l0 == -1) __rivet_sub_m3_l0 = CommandCenter_inst->fping.subscribe([this](auto val) {
-            this->onFloatPing(val);
-        });
-        { std::stringstream _ss; _ss << "MathHarness local LocalB"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    case 3: { // "LocalB"
+        if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "MathHarness local LocalB";
         this->score.publish(20);
+        break;
+    }
+    default:
+        break;
     }
 }
 
-void MathHarness::set_state(const std::string& st) {
-    this->current_state = st;
-    this->onLocalChange();
+void MathHarness::set_state(ModeId st) {
+    if (!this->__rivet_states.request(st)) return;
+    do {
+        this->current_state = st;
+        this->onLocalChange();
+    } while (this->__rivet_states.next(st));
 }
 
-bool ModeWatcher::onMsg(std::string s) {
-    { std::stringstream _ss; _ss << "ModeWatcher.onMsg(s=" << s << ")"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+bool ModeWatcher::onMsg(const std::string& s) {
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "ModeWatcher.onMsg(s=" << s << ")";
     return true;
 }
 
 bool ModeWatcher::onGate(bool b) {
-    { std::stringstream _ss; _ss << "ModeWatcher.onGate(b=" << b << ")"; Logger::log(this->name, LogLevel::WARN, _ss.str()); }
+    if (LogLevel::WARN >= this->log_level) LogLine(this->name, LogLevel::WARN) << "ModeWatcher.onGate(b=" << b << ")";
     return true;
 }
 
 bool ModeWatcher::onDone(bool b) {
-    { std::stringstream _ss; _ss << "ModeWatcher.onDone(b=" << b << ")"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "ModeWatcher.onDone(b=" << b << ")";
     if (b) {
         this->seen.publish(1);
     } else {
@@ -541,87 +2436,104 @@ bool ModeWatcher::onDone(bool b) {
 }
 
 bool ModeWatcher::onScore(int v) {
-    { std::stringstream _ss; _ss << "ModeWatcher.onScore(v=" << v << ")"; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "ModeWatcher.onScore(v=" << v << ")";
     return true;
 }
 
+void ModeWatcher::__rivet_every_m1_t0() {
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "ModeWatcher still Safe";
+    this->seen.publish(2);
+}
+
 void ModeWatcher::__rivet_unsub_sys_listeners() {
+    if (__rivet_timer_m1_t0) { Timers::instance().cancel(__rivet_timer_m1_t0); __rivet_timer_m1_t0 = 0; }
 }
 
 void ModeWatcher::__rivet_unsub_local_listeners() {
 }
 
 void ModeWatcher::init() {
-    this->__rivet_unsub_sys_listeners();
-    this->__rivet_unsub_local_listeners();
 }
 
-void ModeWatcher::onSystemChange(std::string sys_mode) {
+void ModeWatcher::onSystemChange(ModeId sys_mode) {
     this->__rivet_unsub_sys_listeners();
-    if (sys_mode == "Active") {
-        { std::stringstream _ss; _ss << "ModeWatcher sees system Active"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    switch (sys_mode) {
+    case SysMode::Active: {
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "ModeWatcher sees system Active";
+        break;
+    }
+    case SysMode::Safe: {
+        this->__rivet_timer_m1_t0 = Timers::instance().start("ModeWatcher[Safe] every 250ms (line 449)", 250000000, [this](Timers::Id id) {
+            if (this->__rivet_timer_m1_t0 == id) this->__rivet_every_m1_t0();
+        });
+        if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "ModeWatcher sees system Safe";
+        break;
     }
-    if (sys_mode == "Safe") {
-        { std::stringstream _ss; _ss << "ModeWatcher sees system Safe"; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    default:
+        break;
     }
 }
 
 void ModeWatcher::onLocalChange() {
     this->__rivet_unsub_local_listeners();
+    (void)this->current_state;
 }
 
-void ModeWatcher::set_state(const std::string& st) {
-    this->current_state = st;
-    this->onLocalChange();
+void ModeWatcher::set_state(ModeId st) {
+    if (!this->__rivet_states.request(st)) return;
+    do {
+        this->current_state = st;
+        this->onLocalChange();
+    } while (this->__rivet_states.next(st));
 }
 
 bool LoggerNode::hbSeen(int v) {
-    { std::stringstream _ss; _ss << "LOG hb=" << v; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "LOG hb=" << v;
     return true;
 }
 
 bool LoggerNode::readySeen(bool v) {
-    { std::stringstream _ss; _ss << "LOG ready=" << v; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "LOG ready=" << v;
     return true;
 }
 
 bool LoggerNode::pingSeen(int v) {
-    { std::stringstream _ss; _ss << "LOG ping=" << v; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "LOG ping=" << v;
     return true;
 }
 
 bool LoggerNode::fpingSeen(double v) {
-    { std::stringstream _ss; _ss << "LOG fping=" << v; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "LOG fping=" << v;
     return true;
 }
 
-bool LoggerNode::msgSeen(std::string s) {
-    std::cout << "LOG msg: " << s << std::endl;
+bool LoggerNode::msgSeen(const std::string& s) {
+    LogLine() << "LOG msg: " << s;
     return true;
 }
 
 bool LoggerNode::gateSeen(bool b) {
-    { std::stringstream _ss; _ss << "LOG gate=" << b; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "LOG gate=" << b;
     return true;
 }
 
 bool LoggerNode::stageSeen(int v) {
-    { std::stringstream _ss; _ss << "LOG stage=" << v; Logger::log(this->name, LogLevel::DEBUG, _ss.str()); }
+    if (LogLevel::DEBUG >= this->log_level) LogLine(this->name, LogLevel::DEBUG) << "LOG stage=" << v;
     return true;
 }
 
 bool LoggerNode::mhDone(bool b) {
-    { std::stringstream _ss; _ss << "LOG math.done=" << b; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "LOG math.done=" << b;
     return true;
 }
 
 bool LoggerNode::mhScore(int v) {
-    { std::stringstream _ss; _ss << "LOG math.score=" << v; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "LOG math.score=" << v;
     return true;
 }
 
 bool LoggerNode::mwSeen(int v) {
-    { std::stringstream _ss; _ss << "LOG watch.seen=" << v; Logger::log(this->name, LogLevel::INFO, _ss.str()); }
+    if (LogLevel::INFO >= this->log_level) LogLine(this->name, LogLevel::INFO) << "LOG watch.seen=" << v;
     return true;
 }
 
@@ -632,94 +2544,115 @@ void LoggerNode::__rivet_unsub_local_listeners() {
 }
 
 void LoggerNode::init() {
-    this->__rivet_unsub_sys_listeners();
-    this->__rivet_unsub_local_listeners();
 }
 
-void LoggerNode::onSystemChange(std::string sys_mode) {
+void LoggerNode::onSystemChange(ModeId sys_mode) {
     (void)sys_mode;
     return;
 }
 
 void LoggerNode::onLocalChange() {
     this->__rivet_unsub_local_listeners();
+    (void)this->current_state;
 }
 
-void LoggerNode::set_state(const std::string& st) {
-    this->current_state = st;
-    this->onLocalChange();
+void LoggerNode::set_state(ModeId st) {
+    if (!this->__rivet_states.request(st)) return;
+    do {
+        this->current_state = st;
+        this->onLocalChange();
+    } while (this->__rivet_states.next(st));
 }
 
 int main() {
+    EventLoop& loop = EventLoop::instance();
     CommandCenter_inst = new CommandCenter();
     MathHarness_inst = new MathHarness();
     ModeWatcher_inst = new ModeWatcher();
     LoggerNode_inst = new LoggerNode();
-    SystemManager::on_transition.push_back([](std::string m) { CommandCenter_inst->onSystemChange(m); });
-    SystemManager::on_transition.push_back([](std::string m) { MathHarness_inst->onSystemChange(m); });
-    SystemManager::on_transition.push_back([](std::string m) { ModeWatcher_inst->onSystemChange(m); });
-    CommandCenter_inst->ready.subscribe([=](auto val) {
+    SystemManager::declare(SysMode::names, SysMode::Count);
+    SystemManager::on("CommandCenter", {SysMode::Startup, SysMode::Active, SysMode::Diagnostics, SysMode::Safe}, [](ModeId m) { CommandCenter_inst->onSystemChange(m); });
+    SystemManager::on("MathHarness", {SysMode::Safe}, [](ModeId m) { MathHarness_inst->onSystemChange(m); });
+    SystemManager::on("ModeWatcher", {SysMode::Active, SysMode::Safe}, [](ModeId m) { ModeWatcher_inst->onSystemChange(m); });
+    CommandCenter_inst->ready.subscribe([=](const auto& val) {
         MathHarness_inst->onReady(val);
     });
-    CommandCenter_inst->ping.subscribe([=](auto val) {
+    CommandCenter_inst->ping.subscribe([=](const auto& val) {
         MathHarness_inst->onPing(val);
     });
-    CommandCenter_inst->fping.subscribe([=](auto val) {
+    CommandCenter_inst->fping.subscribe([=](const auto& val) {
         MathHarness_inst->onFloatPing(val);
     });
-    CommandCenter_inst->stage.subscribe([=](auto val) {
+    CommandCenter_inst->stage.subscribe([=](const auto& val) {
         MathHarness_inst->onStage(val);
     });
-    CommandCenter_inst->msg.subscribe([=](auto val) {
+    CommandCenter_inst->msg.subscribe([=](const auto& val) {
         MathHarness_inst->onSysMsg(val);
     });
-    CommandCenter_inst->msg.subscribe([=](auto val) {
+    CommandCenter_inst->msg.subscribe([=](const auto& val) {
         ModeWatcher_inst->onMsg(val);
     });
-    CommandCenter_inst->gate.subscribe([=](auto val) {
+    CommandCenter_inst->gate.subscribe([=](const auto& val) {
         ModeWatcher_inst->onGate(val);
     });
-    MathHarness_inst->done.subscribe([=](auto val) {
+    MathHarness_inst->done.subscribe([=](const auto& val) {
         ModeWatcher_inst->onDone(val);
     });
-    MathHarness_inst->score.subscribe([=](auto val) {
+    MathHarness_inst->score.subscribe([=](const auto& val) {
         ModeWatcher_inst->onScore(val);
     });
-    CommandCenter_inst->hb.subscribe([=](auto val) {
+    CommandCenter_inst->hb.subscribe([=](const auto& val) {
         LoggerNode_inst->hbSeen(val);
     });
-    CommandCenter_inst->ready.subscribe([=](auto val) {
+    CommandCenter_inst->ready.subscribe([=](const auto& val) {
         LoggerNode_inst->readySeen(val);
     });
-    CommandCenter_inst->ping.subscribe([=](auto val) {
+    CommandCenter_inst->ping.subscribe([=](const auto& val) {
         LoggerNode_inst->pingSeen(val);
     });
-    CommandCenter_inst->fping.subscribe([=](auto val) {
+    CommandCenter_inst->fping.subscribe([=](const auto& val) {
         LoggerNode_inst->fpingSeen(val);
     });
-    CommandCenter_inst->msg.subscribe([=](auto val) {
+    CommandCenter_inst->msg.subscribe([=](const auto& val) {
         LoggerNode_inst->msgSeen(val);
     });
-    CommandCenter_inst->gate.subscribe([=](auto val) {
+    CommandCenter_inst->gate.subscribe([=](const auto& val) {
         LoggerNode_inst->gateSeen(val);
     });
-    CommandCenter_inst->stage.subscribe([=](auto val) {
+    CommandCenter_inst->stage.subscribe([=](const auto& val) {
         LoggerNode_inst->stageSeen(val);
     });
-    MathHarness_inst->done.subscribe([=](auto val) {
+    MathHarness_inst->done.subscribe([=](const auto& val) {
         LoggerNode_inst->mhDone(val);
     });
-    MathHarness_inst->score.subscribe([=](auto val) {
+    MathHarness_inst->score.subscribe([=](const auto& val) {
         LoggerNode_inst->mhScore(val);
     });
-    ModeWatcher_inst->seen.subscribe([=](auto val) {
+    ModeWatcher_inst->seen.subscribe([=](const auto& val) {
         LoggerNode_inst->mwSeen(val);
     });
+    MathHarness_inst->__rivet_listen_modes();
     CommandCenter_inst->init();
     MathHarness_inst->init();
     ModeWatcher_inst->init();
     LoggerNode_inst->init();
-    std::cout << "--- Rivet System Started ---" << std::endl;
-    while(true) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }
+    const bool timer_stats = std::getenv("RIVET_TIMER_STATS") != nullptr;
+    Timers::instance().set_waker([] { EventLoop::instance().wake(); });
+    loop.add_source([] { return Timers::instance().advance(); });
+    const bool loop_stats = std::getenv("RIVET_LOOP_STATS") != nullptr;
+    unsigned long tick = 0;
+    loop.every(100000000, [&] {
+        ++tick;
+        Rcu::collect();
+        if (timer_stats && tick % 10 == 0) Timers::instance().dump_stats(LogLine().stream());
+        if (loop_stats && tick % 10 == 0) loop.dump_stats(LogLine().stream());
+    });
+    LogLine() << "--- Rivet System Started ---";
+    const int sig = loop.run();
+    LogLine() << "[SYS] " << signal_name(sig) << ", shutting down";
+    SystemManager::set_mode(SysMode::Shutdown);
+    Rcu::collect();
+    LogLine() << "--- Rivet System Stopped ---";
+    Logger::instance().stop();
     return 0;
 }
@@ -0,0 +1,35 @@
+# Generates a .rv program with the given flags, builds it with ThreadSanitizer,
+# runs it for SECONDS and fails on any race report or unclean shutdown.
+#
+#   cmake -DRIVET=<rivet> -DSOURCE=<file.rv> -DWORK_DIR=<dir> -DCXX=<compiler>
+#         -DTIMEOUT=<timeout> -DSECONDS=<n> "-DFLAGS=<rivet flags>"
+#         -P run_stress.cmake
+
+get_filename_component(name "${SOURCE}" NAME)
+file(MAKE_DIRECTORY "${WORK_DIR}")
+file(COPY "${SOURCE}" DESTINATION "${WORK_DIR}")
+set(rv "${WORK_DIR}/${name}")
+
+execute_process(COMMAND "${RIVET}" "${rv}" --cpp ${FLAGS}
+                RESULT_VARIABLE rc OUTPUT_VARIABLE out ERROR_VARIABLE out)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "rivet failed (${rc}):\n${out}")
+endif()
+
+execute_process(COMMAND "${CXX}" "${rv}.cpp" -o "${rv}.bin" -std=c++17 -O1 -g
+                        -fsanitize=thread -pthread
+                RESULT_VARIABLE rc OUTPUT_VARIABLE out ERROR_VARIABLE out)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "compiling the generated program failed (${rc}):\n${out}")
+endif()
+
+# SIGINT runs the program's normal shutdown; timeout then exits with 124.
+execute_process(COMMAND "${TIMEOUT}" -s INT "${SECONDS}" "${rv}.bin"
+                WORKING_DIRECTORY "${WORK_DIR}"
+                RESULT_VARIABLE rc OUTPUT_VARIABLE out ERROR_VARIABLE out)
+if (out MATCHES "ThreadSanitizer")
+  message(FATAL_ERROR "ThreadSanitizer reported:\n${out}")
+endif()
+if (NOT (rc EQUAL 0 OR rc EQUAL 124) OR NOT out MATCHES "Rivet System Stopped")
+  message(FATAL_ERROR "program did not shut down cleanly (${rc}):\n${out}")
+endif()